@@ -3,6 +3,7 @@
 #include <concepts>
 #include <coroutine>
 #include <exception>
+#include <memory>
 #include <optional>
 #include <utility>
 
@@ -23,7 +24,7 @@ struct generator {
     }
 
     void await_transform() = delete;
-    void unhandled_exception() { except = std::current_exception(); std::cout << "exceptino!\n"; }
+    void unhandled_exception() { except = std::current_exception(); }
     void return_void() {}
 
     std::optional<T> value;
@@ -40,7 +41,7 @@ struct generator {
   generator(const generator &) = delete;
   generator &operator=(const generator &) = delete;
 
-  generator(generator &&other) noexcept : _ch(std::move(other._ch)) {}
+  generator(generator &&other) noexcept : _ch(std::exchange(other._ch, {})) {}
   generator &operator=(generator &&other) noexcept {
     if (this != std::addressof(other)) {
       destroy();
@@ -263,7 +263,7 @@ ParseResult parse_movetext(std::string_view pgn, MoveVisitor auto visitor) {
         auto ss = stream.peek(-2, 7);
         if (ss == "1/2-1/2") {
           result = GameResult::Draw;
-          //stream.pos += 6;
+          stream.pos += 5;
         } else {
           return {stream.pos - 1, ParseError::Invalid, "malformed result token"};
         }
@@ -273,10 +273,10 @@ ParseResult parse_movetext(std::string_view pgn, MoveVisitor auto visitor) {
         auto ss = stream.peek(-2, 3);
         if (ss == "1-0") {
           result = GameResult::White;
-          stream.pos += 2;
+          stream.pos += 1;
         } else if (ss == "0-1") {
           result = GameResult::Black;
-          stream.pos += 2;
+          stream.pos += 1;
         } else {
           return {stream.pos - 1, ParseError::Invalid, "malformed result token"};
         }
@@ -373,7 +373,7 @@ ParseResult parse_tags(std::string_view pgn, TagVisitor auto visitor) {
 
     std::size_t pos = stream.pos;
     bool closing_bracket = false;
-    for (++stream.pos; ; ++stream.pos) {
+    for (++stream.pos; !stream.eof(); ++stream.pos) {
       if (stream.accept(']')) {
         closing_bracket = true;
         break;
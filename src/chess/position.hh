@@ -49,7 +49,7 @@ struct Position {
     return {byteswap(x), byteswap(y), byteswap(z), byteswap(white)};
   }
 
-  constexpr bool operator!=(const Position &pos) const { return *this == pos; }
+  constexpr bool operator!=(const Position &pos) const { return !(*this == pos); }
   constexpr bool operator==(const Position &pos) const {
     return x == pos.x && y == pos.y && z == pos.z && white == pos.white;
   }
@@ -68,6 +68,9 @@ struct DbCategory : std::error_category {
     switch (static_cast<DbError>(ev)) {
     case BadMagic:    return "bad magic";
     case BadChecksum: return "bad checksum";
+    case Corrupted:   return "corrupted data";
+    case OutOfMemory: return "out of memory";
+    case Cancelled:   return "cancelled";
     default:          return "(unknown error)";
     }
   }
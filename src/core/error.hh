@@ -46,8 +46,11 @@ enum class DbError {
 
   BadMagic,
   BadChecksum,
+  Corrupted,
 
   OutOfMemory,
+
+  Cancelled,
 };
 
 template <> struct std::is_error_code_enum<DbError> : std::true_type {};
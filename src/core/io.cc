@@ -69,6 +69,38 @@ std::error_code mm_file::open(const fs::path &path, size_t size, bool temp)
   return {};
 }
 
+void mm_file::sync() {
+  if (is_open())
+    FlushViewOfFile(mem, mem_size);
+}
+
+std::error_code mm_file::grow(size_t size)
+{
+  if (size <= file_size)
+    return {};
+
+  sync();
+  UnmapViewOfFile(mem);
+  mem = nullptr;
+
+  file_size = size;
+  mem_size = round_up(size);
+
+  auto fh = (HANDLE)_get_osfhandle(file);
+  auto mh = CreateFileMapping(fh, nullptr, PAGE_READWRITE,
+                              mem_size >> 32, mem_size & 0xffffffff, nullptr);
+  if (mh == nullptr) // CreateFileMapping failed
+    return {static_cast<int>(GetLastError()), std::system_category()};
+
+  mem = reinterpret_cast<std::byte *>(MapViewOfFile(mh, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, mem_size));
+  if (mem == nullptr) { // MapViewOfFile failed
+    CloseHandle(mh);
+    return {static_cast<int>(GetLastError()), std::system_category()};
+  }
+
+  return {};
+}
+
 void mm_file::close() {
   if (!is_open())
     return;
@@ -145,6 +177,35 @@ std::error_code mm_file::open(const fs::path &path, size_t size, bool temp)
   return {};
 }
 
+void mm_file::sync() {
+  if (is_open() && msync(mem, mem_size, MS_SYNC) < 0)
+    logger.error("msync({}, {}) failed\n", static_cast<const void *>(mem), mem_size);
+}
+
+std::error_code mm_file::grow(size_t size)
+{
+  if (size <= file_size)
+    return {};
+
+  const auto new_mem_size = round_up(size);
+  if (const int e = posix_fallocate(file, 0, new_mem_size)) // fallocate failed
+    return {e, std::generic_category()};
+
+  auto new_mem = reinterpret_cast<std::byte *>(
+    mmap(NULL, new_mem_size, PROT_WRITE | PROT_READ, MAP_SHARED, file, 0));
+
+  if (new_mem == MAP_FAILED) // failed to memory map, the old mapping is kept
+    return {errno, std::generic_category()};
+
+  if (munmap(mem, mem_size) < 0)
+    logger.error("munmap({}, {}) failed\n", static_cast<const void *>(mem), mem_size);
+
+  mem = new_mem;
+  file_size = size;
+  mem_size = new_mem_size;
+  return {};
+}
+
 void mm_file::close() {
   if (!is_open())
     return;
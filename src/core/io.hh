@@ -2,10 +2,12 @@
 
 #include "core/error.hh"
 
+#include <algorithm>
 #include <cstdint>
 #include <expected>
 #include <filesystem>
 #include <span>
+#include <utility>
 
 namespace fs = std::filesystem;
 
@@ -25,15 +27,40 @@ public:
 	~mm_file() { close(); }
 
 	mm_file(const mm_file &) = delete;
-	mm_file(mm_file &&) = default;
+	mm_file &operator=(const mm_file &) = delete;
+
+	mm_file(mm_file &&other) noexcept
+		: mem(std::exchange(other.mem, nullptr)), file(std::exchange(other.file, 0)),
+		  file_size(std::exchange(other.file_size, 0)), mem_size(std::exchange(other.mem_size, 0))
+	{
+	}
+
+	mm_file &operator=(mm_file &&other) noexcept {
+		if (this != &other) {
+			close();
+			mem       = std::exchange(other.mem, nullptr);
+			file      = std::exchange(other.file, 0);
+			file_size = std::exchange(other.file_size, 0);
+			mem_size  = std::exchange(other.mem_size, 0);
+		}
+
+		return *this;
+	}
 
 	std::error_code open(const fs::path &path, std::size_t size = 0, bool temp = false);
 	void close();
 	void sync();
 
+	// extends the file and maps it again, which invalidates every span of
+	// the old mapping
+	std::error_code grow(std::size_t size);
+
 	std::size_t size() const { return file_size; }
 
-	bool is_open() { return file > 0; };
+	// the file is truncated to this size when closed
+	void shrink(std::size_t size) { file_size = std::min(size, file_size); }
+
+	bool is_open() const { return file > 0; };
 
 	std::span<std::byte> mutable_span() { return {mem, file_size}; }
 	std::span<const std::byte> span() const { return {mem, file_size}; }
@@ -1,33 +1,296 @@
 #pragma once
 
 #include "chess/movegen.hh"
+#include "chess/pgn.hh"
 #include "core/error.hh"
+#include "db/namepool.hh"
+#include "util/bits.hh"
 #include "util/iterator.hh"
+#include "util/vector.hh"
 
 #include <array>
+#include <format>
+#include <limits>
 #include <optional>
 #include <span>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace cdb::db {
 
+/**
+ * Move data is a stream of 16-bit little-endian tokens:
+ *
+ *  bits  0-5  source square
+ *  bits 6-11  destination square
+ *  bits 12-14 piece type (or promotion piece)
+ *  bit     15 castling
+ *
+ * Squares are relative to the side to move, like chess::Position. A move can
+ * never have the same source and destination, so tokens with src == dst are
+ * used as control tokens, with the kind stored in the piece type bits:
+ *
+ *  Comment        u16 length followed by the comment text
+ *  NAGs           u8 count followed by one byte per NAG
+ *  VariationStart following moves replace the previous move
+ *  VariationEnd   return to the enclosing line
+ *
+ * Annotations (comments and NAGs) always follow the move they refer to.
+ */
+namespace Token {
+  using Type = std::uint16_t;
+  constexpr Type Comment        = 0x0000;
+  constexpr Type NAGs           = 0x1000;
+  constexpr Type VariationStart = 0x2000;
+  constexpr Type VariationEnd   = 0x3000;
+
+  constexpr std::size_t Size = 2;
+
+  constexpr bool is_move(Type token) {
+    return (token & 0x3f) != ((token >> 6) & 0x3f);
+  }
+
+  constexpr Type encode(const chess::Move &move) {
+    return static_cast<Type>(move.src | (move.dst << 6)
+                             | (static_cast<unsigned>(move.piece) << 12)
+                             | (move.castling << 15));
+  }
+
+  constexpr chess::Move decode(Type token) {
+    return {static_cast<chess::Square>(token & 0x3f),
+            static_cast<chess::Square>((token >> 6) & 0x3f),
+            static_cast<chess::PieceType>((token >> 12) & 0x7),
+            bool(token >> 15)};
+  }
+
+  // number of bytes following an annotation token, or zero for other tokens
+  constexpr std::size_t payload_size(Type token, std::span<const std::byte> data) {
+    if (token == Comment) return data.size() < 2 ? data.size() + 1 : 2 + read_le<2>(data);
+    if (token == NAGs)    return data.empty()    ? 1               : 1 + read_le<1>(data);
+    return 0;
+  }
+}
+
+/**
+ * Game records are laid out as:
+ *
+ *  u8  format
+ *  u16 tag data size, tag data           (if HasTagData)
+ *  u16 move data size, move data
+ *  u16 checkpoint data size, checkpoints (if HasCheckpoints)
+ *
+ * Empty records (free space) are a zero format byte followed by the u16
+ * number of free bytes after the 3 byte header.
+ */
+namespace GameFormat { // todo: make bitmask class
+  using Type = std::uint8_t;
+  constexpr Type Empty          = 0x0;
+  constexpr Type HasTagData     = 0x1;
+  constexpr Type HasComments    = 0x2;
+  constexpr Type HasNAGs        = 0x4;
+  constexpr Type HasCheckpoints = 0x8;
+}
+
+// returns the size of the record at the start of data
+inline std::size_t record_size(std::span<const std::byte> data) {
+  const auto format = read_le<1>(data);
+  if (format == GameFormat::Empty)
+    return 3 + read_le<2>(data, 1);
+
+  std::size_t size = 1;
+  if (format & GameFormat::HasTagData)
+    size += 2 + read_le<2>(data, size);
+
+  size += 2 + read_le<2>(data, size);
+
+  if (format & GameFormat::HasCheckpoints)
+    size += 2 + read_le<2>(data, size);
+
+  return size;
+}
+
+// returns the tag data of the (non-empty) record at the start of data, which
+// is empty if it has none
+inline std::span<const std::byte> record_tag_data(std::span<const std::byte> data) {
+  if (!(read_le<1>(data) & GameFormat::HasTagData))
+    return {};
+
+  return data.subspan(3, read_le<2>(data, 1));
+}
+
+// returns the move data of the (non-empty) record at the start of data
+inline std::span<const std::byte> record_move_data(std::span<const std::byte> data) {
+  const auto offset = read_le<1>(data) & GameFormat::HasTagData ? 3 + read_le<2>(data, 1) : 1;
+  return data.subspan(offset + 2, read_le<2>(data, offset));
+}
+
+// builds a game record from its parts, which must each be shorter than 64 KiB
+inline Result<std::vector<std::byte>> write_record(GameFormat::Type format,
+                                                   std::span<const std::byte> tag_data,
+                                                   std::span<const std::byte> move_data,
+                                                   std::span<const std::byte> checkpoint_data = {}) {
+  constexpr auto MaxPartSize = std::numeric_limits<std::uint16_t>::max();
+  if (tag_data.size() > MaxPartSize || move_data.size() > MaxPartSize
+      || checkpoint_data.size() > MaxPartSize)
+    return std::unexpected(IOError::NotEnoughSpace);
+
+  format &= ~(GameFormat::HasTagData | GameFormat::HasCheckpoints);
+  if (!tag_data.empty())        format |= GameFormat::HasTagData;
+  if (!checkpoint_data.empty()) format |= GameFormat::HasCheckpoints;
+
+  std::vector<std::byte> record;
+  record.reserve(1 + 2 + tag_data.size() + 2 + move_data.size() + 2 + checkpoint_data.size());
+
+  const auto put = [&] (std::span<const std::byte> part) {
+    const auto pos = record.size();
+    record.resize(pos + 2);
+    write_le<2>(std::span {record}, part.size(), pos);
+    record.insert(record.end(), part.begin(), part.end());
+  };
+
+  record.push_back(static_cast<std::byte>(format));
+  if (format & GameFormat::HasTagData)     put(tag_data);
+  put(move_data);
+  if (format & GameFormat::HasCheckpoints) put(checkpoint_data);
+
+  return record;
+}
+
+/**
+ * Checkpoint data holds a snapshot of the mainline position every few plies,
+ * so that decoding can begin part way through a game:
+ *
+ *  u8 interval, u8 count, then for each checkpoint:
+ *  u16 ply, u16 move data offset, packed position
+ *
+ * Positions are packed as the occupied squares, then the x, y, z and white
+ * bitboards compressed to the occupied squares with pext, then the en passant
+ * square (0xff if none). A checkpoint is only ever placed on a mainline move
+ * token, so decoding from it starts outside of any variation.
+ */
+struct Checkpoint {
+  static constexpr std::size_t HeaderSize = 2;
+  static constexpr std::size_t Size = 29;
+
+  std::uint16_t ply, offset;
+  chess::Position pos;
+
+  Checkpoint(std::uint16_t ply, std::uint16_t offset, const chess::Position &pos)
+    : ply(ply), offset(offset), pos(pos)
+  {
+  }
+
+  Checkpoint(std::span<const std::byte, Size> data)
+    : ply(read_le<2>(data)), offset(read_le<2>(data, 2)), pos()
+  {
+    const auto occ = read_le<8>(data, 4);
+    const auto ep  = read_le<1>(data, 28);
+
+    pos.x     = pdep(read_le<4>(data, 12), occ);
+    pos.y     = pdep(read_le<4>(data, 16), occ);
+    pos.z     = pdep(read_le<4>(data, 20), occ);
+    pos.white = pdep(read_le<4>(data, 24), occ);
+
+    if (ep != 0xff)
+      pos.white |= chess::square_bb(static_cast<chess::Square>(ep));
+
+#ifndef NDEBUG
+    pos.fen = pos.to_fen(ply % 2);
+#endif
+  }
+
+  void write(std::span<std::byte, Size> data) const {
+    const auto occ = pos.occupied();
+    const auto ep  = pos.white &~ occ;
+
+    write_le<2>(data, ply);
+    write_le<2>(data, offset, 2);
+    write_le<8>(data, occ, 4);
+    write_le<4>(data, pext(pos.x, occ), 12);
+    write_le<4>(data, pext(pos.y, occ), 16);
+    write_le<4>(data, pext(pos.z, occ), 20);
+    write_le<4>(data, pext(pos.white, occ), 24);
+    write_le<1>(data, static_cast<unsigned>(ep ? lsb(ep) : 0xff), 28);
+  }
+};
+
+// returns the last checkpoint at or before the given ply
+inline std::optional<Checkpoint> find_checkpoint(std::span<const std::byte> data, unsigned ply) {
+  if (data.size() < Checkpoint::HeaderSize)
+    return std::nullopt;
+
+  const unsigned count = read_le<1>(data, 1);
+  if (Checkpoint::HeaderSize + count * Checkpoint::Size > data.size())
+    return std::nullopt;
+
+  for (unsigned i = count; i--; ) {
+    const auto entry = data.subspan(Checkpoint::HeaderSize + i * Checkpoint::Size)
+                           .first<Checkpoint::Size>();
+    if (read_le<2>(entry) <= ply)
+      return Checkpoint {entry};
+  }
+
+  return std::nullopt;
+}
+
+namespace DecodeMode {
+  using Type = std::uint8_t;
+  constexpr Type Eager           = 0x0; // positions are computed as each move is decoded
+  constexpr Type LazyPositions   = 0x1; // positions are computed when first accessed
+  constexpr Type SkipAnnotations = 0x2; // comments and NAGs are skipped without being read
+  constexpr Type MovesOnly       = LazyPositions | SkipAnnotations;
+}
+
 class [[nodiscard]] GameStep {
+public:
+  static constexpr unsigned MaxVariationDepth = 16;
+
 private:
   friend class GameDecoder;
 
-  chess::Position _prev {}, _next {};
+  struct Line {
+    chess::Position prev, next;
+  };
+
+  // position state is only up to date for tokens before _synced, and is
+  // brought up to date by replaying the move data up to _cursor
+  mutable chess::Position _prev {}, _next {chess::startpos};
+  mutable static_vector<Line, MaxVariationDepth> _lines;
+  mutable std::uint32_t _synced = 0;
+
+  std::span<const std::byte> _input;
+  std::uint32_t _cursor = 0;
+
+  // ply of the current line, and of each enclosing line
+  unsigned _ply = 0;
+  std::array<unsigned, MaxVariationDepth> _plies {};
+
   chess::Move _move {};
   std::string_view _comment;
   std::span<const std::byte> _nags;
   unsigned _var_depth = 0, _var_idx = 0;
 
-protected:
-  void set_variation_index(unsigned var_idx) { _var_idx = var_idx; }
-  void set_variation_depth(unsigned var_depth) { _var_depth = var_depth; }
-  void set_nags(std::span<const std::byte> nags) { _nags = nags; }
-  void set_comment(std::string_view comment) { _comment = comment; }
+  // applies a move or variation token to the position state
+  void apply(Token::Type token) const {
+    if (Token::is_move(token)) {
+      _prev = std::exchange(_next, chess::make_move(_next, Token::decode(token)));
+    } else if (token == Token::VariationStart) {
+      _lines.emplace_back(_prev, _next);
+      _next = _prev;
+    } else if (token == Token::VariationEnd) {
+      _prev = _lines.back().prev;
+      _next = _lines.back().next;
+      _lines.pop_back();
+    }
+  }
 
-  void advance(const chess::Move &move) {
-    _prev = std::exchange(_next, chess::make_move(_next, move));
+  void sync() const {
+    while (_synced < _cursor) {
+      const auto token = read_le<2>(_input, _synced);
+      _synced += Token::Size + Token::payload_size(token, _input.subspan(_synced + Token::Size));
+      apply(token);
+    }
   }
 
 public:
@@ -38,8 +301,11 @@ public:
 
   GameStep(GameStep &&) = default;
 
-  const chess::Position &previous() const { return _prev; }
-  const chess::Position &next() const { return _next; }
+  const chess::Position &previous() const { sync(); return _prev; }
+  const chess::Position &next() const { sync(); return _next; }
+
+  // number of plies from the start of the game to next()
+  unsigned ply() const { return _ply; }
 
   unsigned variation_index() const { return _var_idx; }
   unsigned variation_depth() const { return _var_depth; }
@@ -54,27 +320,98 @@ private:
   std::uint32_t steps = 0, bytes_read = 0;
   std::error_code ec {};
   std::span<const std::byte> input;
-  GameStep step {};
+  DecodeMode::Type mode = DecodeMode::Eager;
+  mutable GameStep step {};
 
   static constexpr auto End = std::numeric_limits<decltype(steps)>::max();
 
   void advance() {
     if (steps == End)
       return;
-    
-    if (bytes_read >= input.size()) {
+
+    auto decoded = decode_step();
+    if (!decoded) {
       steps = End;
-      return;
+      ec = decoded.error();
+    } else if (!*decoded) {
+      steps = End;
+    } else {
+      ++steps;
     }
+  }
 
-    auto read = decode_step(input.subspan(bytes_read), step);
-    if (read) {
-      bytes_read += *read;
-      ++steps;
-    } else {
-      steps = End;
-      ec = read.error();
+  // decodes the next move and any annotations following it,
+  // returns false if the end of the move data was reached
+  Result<bool> decode_step() {
+    step._comment = {};
+    step._nags = {};
+
+    for (;;) {
+      if (bytes_read == input.size())
+        return false;
+      else if (bytes_read + Token::Size > input.size())
+        return std::unexpected(ParseError::Invalid);
+
+      const auto token = read_le<2>(input, bytes_read);
+      bytes_read += Token::Size;
+
+      if (Token::is_move(token)) {
+        step._move = Token::decode(token);
+        step._cursor = bytes_read;
+        ++step._ply;
+        break;
+      } else if (token == Token::VariationStart) {
+        if (step._var_depth == GameStep::MaxVariationDepth || step._ply == 0)
+          return std::unexpected(ParseError::Illegal);
+
+        // the variation replaces the previous move
+        step._plies[step._var_depth] = step._ply--;
+        ++step._var_depth;
+        ++step._var_idx;
+      } else if (token == Token::VariationEnd) {
+        if (step._var_depth == 0)
+          return std::unexpected(ParseError::Illegal);
+
+        step._ply = step._plies[--step._var_depth];
+      } else if (token == Token::Comment || token == Token::NAGs) {
+        // annotations before the first move belong to the game, not a move
+        const auto payload_size = Token::payload_size(token, input.subspan(bytes_read));
+        if (bytes_read + payload_size > input.size())
+          return std::unexpected(ParseError::Invalid);
+
+        bytes_read += payload_size;
+      } else {
+        return std::unexpected(ParseError::Invalid);
+      }
     }
+
+    while (bytes_read + Token::Size <= input.size()) {
+      const auto token = read_le<2>(input, bytes_read);
+      if (token != Token::Comment && token != Token::NAGs)
+        break;
+
+      const auto payload = input.subspan(bytes_read + Token::Size);
+      const auto payload_size = Token::payload_size(token, payload);
+      if (payload_size > payload.size())
+        return std::unexpected(ParseError::Invalid);
+
+      bytes_read += Token::Size + payload_size;
+
+      if (mode & DecodeMode::SkipAnnotations)
+        continue;
+
+      if (token == Token::Comment) {
+        const auto text = payload.subspan(2, payload_size - 2);
+        step._comment = {reinterpret_cast<const char *>(text.data()), text.size()};
+      } else {
+        step._nags = payload.subspan(1, payload_size - 1);
+      }
+    }
+
+    if (!(mode & DecodeMode::LazyPositions))
+      step.sync();
+
+    return true;
   }
 
 public:
@@ -83,9 +420,29 @@ public:
   {
   }
 
-  GameDecoder(std::span<const std::byte> input)
-    : input(input)
+  GameDecoder(std::span<const std::byte> input, DecodeMode::Type mode = DecodeMode::Eager)
+    : input(input), mode(mode)
   {
+    step._input = input;
+    advance();
+  }
+
+  // starts decoding from a checkpoint, the first step is the move after it
+  GameDecoder(std::span<const std::byte> input, const Checkpoint &checkpoint,
+              DecodeMode::Type mode = DecodeMode::Eager)
+    : bytes_read(checkpoint.offset), input(input), mode(mode)
+  {
+    if (checkpoint.offset > input.size()) {
+      steps = End;
+      ec = ParseError::Invalid;
+      return;
+    }
+
+    step._input = input;
+    step._next = checkpoint.pos;
+    step._synced = step._cursor = checkpoint.offset;
+    step._ply = checkpoint.ply;
+    advance();
   }
 
   GameDecoder(const GameDecoder &) = delete;
@@ -93,27 +450,336 @@ public:
 
   GameDecoder(GameDecoder &&) = default;
 
-  virtual ~GameDecoder() = default;
+  std::error_code error() const { return ec; }
 
-  virtual Result<unsigned> decode_step(std::span<const std::byte> input, GameStep &step) {
-    return std::unexpected(CoreError::NotImplemented);
-  }
+  // bytes of the input decoded so far
+  std::size_t bytes_decoded() const { return bytes_read; }
 
+  GameStep &value() const { return step; }
+  void increment() { advance(); }
   bool equal(const GameDecoder &other) const { return steps == other.steps; }
 };
 
-class DecoderImpl final : public GameDecoder {
+class GameEncoder {
+private:
+  std::vector<std::byte> _data, _checkpoints;
+  unsigned _var_depth = 0, _ply = 0, _checkpoint_interval = 0;
+
+  // mainline position, only tracked if checkpoints are enabled
+  chess::Position _pos = chess::startpos;
+
+  void put(Token::Type token) {
+    const auto pos = _data.size();
+    _data.resize(pos + Token::Size);
+    write_le<2>(std::span {_data}, token, pos);
+  }
+
+  void put_checkpoint() {
+    if (_checkpoints.empty()) {
+      _checkpoints.push_back(static_cast<std::byte>(_checkpoint_interval));
+      _checkpoints.push_back(std::byte {0});
+    }
+
+    const auto count = read_le<1>(std::span {_checkpoints}, 1);
+    if (count == std::numeric_limits<decltype(count)>::max()
+        || _data.size() > std::numeric_limits<std::uint16_t>::max())
+      return;
+
+    const auto pos = _checkpoints.size();
+    _checkpoints.resize(pos + Checkpoint::Size);
+
+    Checkpoint {static_cast<std::uint16_t>(_ply), static_cast<std::uint16_t>(_data.size()), _pos}
+      .write(std::span {_checkpoints}.subspan(pos).first<Checkpoint::Size>());
+    write_le<1>(std::span {_checkpoints}, count + 1u, 1);
+  }
+
 public:
-  DecoderImpl(std::span<const std::byte> input) : GameDecoder(input) {}
+  // a checkpoint is written every checkpoint_interval mainline plies, or
+  // never if it is zero
+  GameEncoder(unsigned checkpoint_interval = 0)
+    : _checkpoint_interval(std::min(checkpoint_interval, 255u))
+  {
+  }
+
+  void move(const chess::Move &move) {
+    if (_var_depth == 0) {
+      if (_checkpoint_interval) {
+        if (_ply && _ply % _checkpoint_interval == 0)
+          put_checkpoint();
+
+        _pos = chess::make_move(_pos, move);
+      }
+
+      ++_ply;
+    }
 
-  Result<unsigned> decode_step(std::span<const std::byte> input, GameStep &step) override {
-    /* parsing logic */
-    return std::unexpected(CoreError::NotImplemented);
+    put(Token::encode(move));
+  }
+
+  Result<void> comment(std::string_view text) {
+    if (_data.empty() || text.size() > std::numeric_limits<std::uint16_t>::max())
+      return std::unexpected(ParseError::Invalid);
+
+    put(Token::Comment);
+    put(static_cast<std::uint16_t>(text.size()));
+
+    const auto bytes = std::as_bytes(std::span {text});
+    _data.insert(_data.end(), bytes.begin(), bytes.end());
+    return {};
+  }
+
+  Result<void> nags(std::span<const std::uint8_t> nags) {
+    if (_data.empty() || nags.size() > std::numeric_limits<std::uint8_t>::max())
+      return std::unexpected(ParseError::Invalid);
+
+    put(Token::NAGs);
+    _data.push_back(static_cast<std::byte>(nags.size()));
+
+    const auto bytes = std::as_bytes(nags);
+    _data.insert(_data.end(), bytes.begin(), bytes.end());
+    return {};
+  }
+
+  Result<void> begin_variation() {
+    if (_data.empty() || _var_depth == GameStep::MaxVariationDepth)
+      return std::unexpected(ParseError::Illegal);
+
+    ++_var_depth;
+    put(Token::VariationStart);
+    return {};
+  }
+
+  Result<void> end_variation() {
+    if (_var_depth == 0)
+      return std::unexpected(ParseError::Illegal);
+
+    --_var_depth;
+    put(Token::VariationEnd);
+    return {};
+  }
+
+  std::span<const std::byte> data() const { return _data; }
+  std::span<const std::byte> checkpoints() const { return _checkpoints; }
+
+  void clear() {
+    _data.clear();
+    _checkpoints.clear();
+    _var_depth = _ply = 0;
+    _pos = chess::startpos;
   }
 };
 
+/**
+ * Tag data is a sequence of tags, each stored as:
+ *
+ *  u8 tag id
+ *  varint name length, name (Custom tags only)
+ *  value, depending on the kind of tag:
+ *    String  varint length, text
+ *    Integer varint
+ *    Date    varint, packed as year << 9 | month << 5 | day (0 if unknown)
+ *    Result  u8, chess::GameResult
+ *    ECO     varint, packed as 100 * letter + number + 1
+ *    Name    varint, id in the database's NamePool
+ *
+ * Name values are used for player, event and site tags when the game belongs
+ * to a database, and are marked by the Interned bit in the tag id. Tags whose
+ * values cannot be packed are stored as Custom tags, so encoding is lossless.
+ */
+namespace TagId {
+  using Type = std::uint8_t;
+  constexpr Type Custom      = 0;
+  constexpr Type Event       = 1;
+  constexpr Type Site        = 2;
+  constexpr Type Date        = 3;
+  constexpr Type Round       = 4;
+  constexpr Type White       = 5;
+  constexpr Type Black       = 6;
+  constexpr Type Result      = 7;
+  constexpr Type ECO         = 8;
+  constexpr Type WhiteElo    = 9;
+  constexpr Type BlackElo    = 10;
+  constexpr Type PlyCount    = 11;
+  constexpr Type EventDate   = 12;
+  constexpr Type Opening     = 13;
+  constexpr Type Variation   = 14;
+  constexpr Type Annotator   = 15;
+  constexpr Type TimeControl = 16;
+  constexpr Type Termination = 17;
+  constexpr Type WhiteTitle  = 18;
+  constexpr Type BlackTitle  = 19;
+  constexpr Type Count       = 20;
+
+  constexpr Type Interned    = 0x80;
+
+  constexpr std::array<std::string_view, Count> Names {
+    "", "Event", "Site", "Date", "Round", "White", "Black", "Result",
+    "ECO", "WhiteElo", "BlackElo", "PlyCount", "EventDate", "Opening",
+    "Variation", "Annotator", "TimeControl", "Termination", "WhiteTitle", "BlackTitle"
+  };
+
+  constexpr Type from_name(std::string_view name) {
+    for (Type id = 1; id < Count; ++id)
+      if (Names[id] == name)
+        return id;
+
+    return Custom;
+  }
+
+  // tags whose values are interned in the database's name pool
+  constexpr bool is_name(Type id) {
+    return id == Event || id == Site || id == White || id == Black;
+  }
+}
+
+namespace TagKind {
+  using Type = std::uint8_t;
+  constexpr Type String  = 0;
+  constexpr Type Integer = 1;
+  constexpr Type Date    = 2;
+  constexpr Type Result  = 3;
+  constexpr Type ECO     = 4;
+  constexpr Type Name    = 5;
+
+  constexpr Type of(TagId::Type id) {
+    switch (id) {
+    case TagId::Date:
+    case TagId::EventDate: return Date;
+    case TagId::WhiteElo:
+    case TagId::BlackElo:
+    case TagId::PlyCount:  return Integer;
+    case TagId::Result:    return Result;
+    case TagId::ECO:       return ECO;
+    default:               return String;
+    }
+  }
+}
+
+namespace TagValue {
+  // fixed-width digit field, leading zeros allowed
+  constexpr std::optional<std::uint32_t> parse_digits(std::string_view s) {
+    if (s.empty() || s.size() > 9)
+      return std::nullopt;
+
+    std::uint32_t n = 0;
+    for (char c : s) {
+      if (c < '0' || c > '9')
+        return std::nullopt;
+
+      n = 10 * n + (c - '0');
+    }
+
+    return n;
+  }
+
+  // leading zeros would be lost, so "0123" is left as a string
+  constexpr std::optional<std::uint32_t> pack_integer(std::string_view s) {
+    if (s.size() > 1 && s[0] == '0')
+      return std::nullopt;
+
+    return parse_digits(s);
+  }
+
+  // "YYYY.MM.DD", where any field may be question marks. zero marks an
+  // unknown field, so dates with zero fields are left as strings
+  constexpr std::optional<std::uint32_t> pack_date(std::string_view s) {
+    if (s.size() != 10 || s[4] != '.' || s[7] != '.')
+      return std::nullopt;
+
+    std::uint32_t packed = 0;
+    for (auto [pos, len, shift, max] : {std::array<unsigned, 4> {0, 4, 9, 9999},
+                                        std::array<unsigned, 4> {5, 2, 5, 12},
+                                        std::array<unsigned, 4> {8, 2, 0, 31}}) {
+      const auto field = s.substr(pos, len);
+      if (field.find_first_not_of('?') == std::string_view::npos)
+        continue;
+
+      const auto n = parse_digits(field);
+      if (!n || *n == 0 || *n > max)
+        return std::nullopt;
+
+      packed |= *n << shift;
+    }
+
+    return packed;
+  }
+
+  constexpr unsigned year(std::uint32_t date)  { return date >> 9; }
+  constexpr unsigned month(std::uint32_t date) { return (date >> 5) & 0xf; }
+  constexpr unsigned day(std::uint32_t date)   { return date & 0x1f; }
+
+  constexpr std::optional<std::uint32_t> pack_result(std::string_view s) {
+    using enum chess::GameResult;
+    if (s == "1-0")     return static_cast<std::uint32_t>(White);
+    if (s == "0-1")     return static_cast<std::uint32_t>(Black);
+    if (s == "1/2-1/2") return static_cast<std::uint32_t>(Draw);
+    if (s == "*")       return static_cast<std::uint32_t>(Incomplete);
+    return std::nullopt;
+  }
+
+  constexpr std::optional<std::uint32_t> pack_eco(std::string_view s) {
+    if (s.size() != 3 || s[0] < 'A' || s[0] > 'E')
+      return std::nullopt;
+
+    const auto n = parse_digits(s.substr(1));
+    if (!n)
+      return std::nullopt;
+
+    return 100 * (s[0] - 'A') + *n + 1;
+  }
+
+  constexpr std::optional<std::uint32_t> pack(TagKind::Type kind, std::string_view s) {
+    switch (kind) {
+    case TagKind::Integer: return pack_integer(s);
+    case TagKind::Date:    return pack_date(s);
+    case TagKind::Result:  return pack_result(s);
+    case TagKind::ECO:     return pack_eco(s);
+    default:               return std::nullopt;
+    }
+  }
+}
+
 struct Tag {
-  std::string name, value;
+  TagId::Type id = TagId::Custom;
+  TagKind::Type kind = TagKind::String;
+
+  // views into the tag data, TagId::Names or the name pool, value is empty
+  // for tags that are packed as numbers
+  std::string_view name, value;
+
+  // packed value, or name id for interned tags
+  std::uint32_t number = 0;
+
+  // formats the value as it would appear in PGN
+  std::string to_string() const {
+    switch (kind) {
+    case TagKind::Integer:
+      return std::format("{}", number);
+    case TagKind::Date: {
+      auto field = [] (unsigned n, unsigned width) {
+        return n ? std::format("{:0{}}", n, width) : std::string(width, '?');
+      };
+
+      return std::format("{}.{}.{}", field(TagValue::year(number), 4),
+                         field(TagValue::month(number), 2), field(TagValue::day(number), 2));
+    }
+    case TagKind::Result: {
+      using enum chess::GameResult;
+      switch (static_cast<chess::GameResult>(number)) {
+      case White: return "1-0";
+      case Black: return "0-1";
+      case Draw:  return "1/2-1/2";
+      default:    return "*";
+      }
+    }
+    case TagKind::ECO:
+      return number ? std::format("{}{:02}", char('A' + (number - 1) / 100), (number - 1) % 100) : "?";
+    case TagKind::Name:
+      return value.empty() ? std::format("#{}", number) : std::string(value);
+    default:
+      return std::string(value);
+    }
+  }
 };
 
 class TagDecoder : public iterator_facade<TagDecoder, Tag> {
@@ -121,14 +787,15 @@ private:
   std::uint32_t steps = 0, bytes_read = 0;
   std::error_code ec {};
   std::span<const std::byte> input;
-  Tag tag {};
+  const NamePool *names = nullptr;
+  mutable Tag tag {};
 
   static constexpr auto End = std::numeric_limits<decltype(steps)>::max();
 
   void advance() {
     if (steps == End)
       return;
-    
+
     if (bytes_read >= input.size()) {
       steps = End;
       return;
@@ -144,15 +811,85 @@ private:
     }
   }
 
+  Result<std::string_view> decode_string(std::span<const std::byte> input, std::size_t &pos) {
+    std::uint64_t size = 0;
+    const auto n = read_varint(input, size, pos);
+    if (!n || pos + n + size > input.size())
+      return std::unexpected(ParseError::Invalid);
+
+    const auto text = input.subspan(pos + n, size);
+    pos += n + size;
+    return std::string_view {reinterpret_cast<const char *>(text.data()), text.size()};
+  }
+
+  Result<unsigned> decode_tag(std::span<const std::byte> input) {
+    std::size_t pos = 1;
+
+    const auto id = read_le<1>(input);
+    const bool interned = id & TagId::Interned;
+
+    tag = {};
+    tag.id = id & ~TagId::Interned;
+    tag.kind = interned ? TagKind::Name : TagKind::of(tag.id);
+
+    if (tag.id >= TagId::Count || (interned && !TagId::is_name(tag.id)))
+      return std::unexpected(ParseError::Reserved);
+
+    if (tag.id == TagId::Custom) {
+      auto name = decode_string(input, pos);
+      if (!name)
+        return std::unexpected(name.error());
+
+      tag.name = *name;
+    } else {
+      tag.name = TagId::Names[tag.id];
+    }
+
+    switch (tag.kind) {
+    case TagKind::String: {
+      auto value = decode_string(input, pos);
+      if (!value)
+        return std::unexpected(value.error());
+
+      tag.value = *value;
+      break;
+    }
+    case TagKind::Result:
+      if (pos >= input.size())
+        return std::unexpected(ParseError::Invalid);
+
+      tag.number = read_le<1>(input, pos++);
+      break;
+    default: {
+      std::uint64_t number = 0;
+      const auto n = read_varint(input, number, pos);
+      if (!n || number > std::numeric_limits<std::uint32_t>::max())
+        return std::unexpected(ParseError::Invalid);
+
+      tag.number = static_cast<std::uint32_t>(number);
+      pos += n;
+
+      if (tag.kind == TagKind::Name && names && tag.number < names->size())
+        tag.value = names->name(tag.number);
+
+      break;
+    }
+    }
+
+    return pos;
+  }
+
 public:
   TagDecoder()
     : steps(End)
   {
   }
 
-  TagDecoder(std::span<const std::byte> input)
-    : input(input)
+  // interned names are resolved if a name pool is given
+  TagDecoder(std::span<const std::byte> input, const NamePool *names = nullptr)
+    : input(input), names(names)
   {
+    advance();
   }
 
   TagDecoder(const TagDecoder &) = delete;
@@ -160,13 +897,73 @@ public:
 
   TagDecoder(TagDecoder &&) = default;
 
-  virtual ~TagDecoder() = default;
+  std::error_code error() const { return ec; }
+
+  Tag &value() const { return tag; }
+  void increment() { advance(); }
+  bool equal(const TagDecoder &other) const { return steps == other.steps; }
+};
 
-  virtual Result<unsigned> decode_tag(std::span<const std::byte> input) {
-    return std::unexpected(CoreError::NotImplemented);
+class TagEncoder {
+private:
+  std::vector<std::byte> _data;
+  NamePoolBuilder *_names = nullptr;
+
+  void put_varint(std::uint64_t value) {
+    const auto pos = _data.size();
+    _data.resize(pos + varint_size(value));
+    write_varint(_data, value, pos);
   }
 
-  bool equal(const TagDecoder &other) const { return steps == other.steps; }
+  void put_string(std::string_view s) {
+    put_varint(s.size());
+
+    const auto bytes = std::as_bytes(std::span {s});
+    _data.insert(_data.end(), bytes.begin(), bytes.end());
+  }
+
+public:
+  // names are interned if a name pool is given
+  TagEncoder(NamePoolBuilder *names = nullptr)
+    : _names(names)
+  {
+  }
+
+  // value should not include the surrounding quotes
+  void add(std::string_view name, std::string_view value) {
+    const auto id = TagId::from_name(name);
+    const auto kind = TagKind::of(id);
+
+    if (_names && TagId::is_name(id)) {
+      _data.push_back(static_cast<std::byte>(id | TagId::Interned));
+      put_varint(_names->intern(value));
+    } else if (id == TagId::Custom) {
+      _data.push_back(static_cast<std::byte>(TagId::Custom));
+      put_string(name);
+      put_string(value);
+    } else if (kind == TagKind::String) {
+      _data.push_back(static_cast<std::byte>(id));
+      put_string(value);
+    } else if (const auto packed = TagValue::pack(kind, value)) {
+      _data.push_back(static_cast<std::byte>(id));
+
+      if (kind == TagKind::Result)
+        _data.push_back(static_cast<std::byte>(*packed));
+      else
+        put_varint(*packed);
+    } else {
+      // keep values that do not fit the packed format as they are
+      _data.push_back(static_cast<std::byte>(TagId::Custom));
+      put_string(name);
+      put_string(value);
+    }
+  }
+
+  std::span<const std::byte> data() const { return _data; }
+
+  void clear() {
+    _data.clear();
+  }
 };
 
 } // cdb::db
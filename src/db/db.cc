@@ -2,12 +2,18 @@
 #include "core/error.hh"
 #include "core/logger.hh"
 #include "db/db.hh"
+#include "db/import.hh"
+#include "db/material.hh"
 #include "util/bits.hh"
 #include "util/bytesize.hh"
 #include "util/komihash.hh"
+#include "util/top_n.hh"
 
+#include <chrono>
+#include <ctime>
 #include <filesystem>
 #include <ranges>
+#include <thread>
 #include <vector>
 
 using namespace cdb;
@@ -17,6 +23,203 @@ namespace fs = std::filesystem;
 static const log::logger logger("db");
 
 namespace {
+  // number of workers for a pass over the pages, on all hardware threads if
+  // threads is zero
+  unsigned no_workers(unsigned threads, std::uint32_t no_pages) {
+    if (threads == 0)
+      threads = std::thread::hardware_concurrency();
+
+    return std::max(1u, std::min(threads, no_pages));
+  }
+
+  // the options for a pass with one builder per worker
+  ScanOptions per_worker(ScanOptions options, std::size_t workers) {
+    options.threads = static_cast<unsigned>(workers);
+    return options;
+  }
+
+  // the options for a scan whose results must be sorted by game
+  ScanOptions in_order(ScanOptions options) {
+    options.ordered = true;
+    return options;
+  }
+
+  // whether a page holds any of the candidates, which are sorted, since pages
+  // hold consecutive ids
+  bool has_candidates(const PageAllocator &pages, std::span<const std::uint32_t> ids, std::uint32_t page_no) {
+    const auto first = std::ranges::lower_bound(ids, pages.page(page_no).first_game());
+    return first != ids.end()
+           && (page_no + 1 >= pages.no_pages() || *first < pages.page(page_no + 1).first_game());
+  }
+
+  // games of a page checked against a query, and those that matched
+  struct PageCount {
+    std::uint32_t games = 0, hits = 0;
+  };
+
+  // wall and process CPU time since construction
+  class StageTimer {
+  private:
+    std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+    std::clock_t cpu = std::clock();
+
+  public:
+    void stop(StageStats &stats) const {
+      stats.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall).count();
+      stats.cpu_ms = 1000.0 * (std::clock() - cpu) / CLOCKS_PER_SEC;
+    }
+  };
+
+  // the metadata an import stores for a game, read back from its record
+  GameMetadata record_metadata(std::span<const std::byte> record, const NamePool *names, StageStats &stats) {
+    GameMetadata game;
+    stats.bytes += record_tag_data(record).size();
+    for (auto it = TagDecoder(record_tag_data(record), names); it != TagDecoder(); ++it)
+      game.add_tag(it->name, it->to_string());
+
+    game.material = Material::of(chess::startpos, false).signature();
+    game.home_pawns = home_pawns(chess::startpos, false);
+
+    std::uint32_t plies = 0;
+    auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations);
+    for (; it != GameDecoder(); ++it) {
+      ++stats.plies;
+      if (it->variation_depth())
+        continue;
+
+      ++plies;
+      const bool black = it->ply() % 2;
+      game.material |= Material::of(it->next(), black).signature();
+      game.home_pawns = home_pawns(it->next(), black);
+    }
+
+    stats.bytes += it.bytes_decoded();
+    game.ply_count = static_cast<std::uint16_t>(std::min(plies, 0xffffu));
+    return game;
+  }
+
+  // checks the predicates a plan leaves to the records, replaying each game
+  // once for all of them
+  class RecordScan {
+  private:
+    const Query &query;
+    const QueryPlan &plan;
+    const NamePool *names;
+
+    std::vector<std::uint64_t> position_keys;
+    std::vector<std::uint16_t> position_home_pawns;
+    bool replay;
+
+  public:
+    RecordScan(const Query &query, const QueryPlan &plan, const NamePool *names)
+      : query(query), plan(plan), names(names)
+    {
+      for (const auto i : plan.scan_positions) {
+        const auto &[pos, black] = query.positions[i];
+        position_keys.push_back(PositionIndex::key(pos, black));
+        position_home_pawns.push_back(home_pawns(pos, black));
+      }
+
+      replay = !query.materials.empty() || !query.patterns.empty() || !position_keys.empty() || plan.scan_line;
+    }
+
+    // counts the bytes and plies decoded in the stats
+    bool matches(std::uint32_t id, std::span<const std::byte> record, StageStats &stats) const {
+      if (!plan.metadata.all() && id >= plan.metadata_games
+          && !plan.metadata.matches(record_metadata(record, names, stats)))
+        return false;
+
+      for (const auto i : plan.scan_tags) {
+        const auto &tag = query.tags[i];
+        stats.bytes += record_tag_data(record).size();
+
+        bool found = false;
+        for (auto it = TagDecoder(record_tag_data(record), names); it != TagDecoder() && !found; ++it)
+          found = (TagField::of(it->id) & tag.fields) && tag.matches(it->value);
+
+        if (!found)
+          return false;
+      }
+
+      if (!replay)
+        return true;
+
+      auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations);
+      const bool matched = replays(it, stats);
+      stats.bytes += it.bytes_decoded();
+      return matched;
+    }
+
+  private:
+    bool replays(GameDecoder &it, StageStats &stats) const {
+      const auto no_materials = query.materials.size(), no_positions = position_keys.size();
+      const auto line = plan.scan_line ? std::span {query.line} : std::span<const chess::Move> {};
+
+      // materials, then positions, then patterns, each found at some ply
+      std::vector<bool> found(no_materials + no_positions + query.patterns.size());
+      auto left = found.size();
+      const auto mark = [&] (std::size_t i) {
+        if (!found[i]) {
+          found[i] = true;
+          --left;
+        }
+      };
+
+      const auto start = Material::of(chess::startpos, false);
+      for (std::size_t i = 0; i < no_materials; ++i)
+        if (query.materials[i] == start)
+          mark(i);
+
+      std::size_t ply = 0;
+      for (; it != GameDecoder(); ++it) {
+        ++stats.plies;
+        if (it->variation_depth())
+          continue;
+
+        if (ply < line.size() && Token::encode(it->move()) != Token::encode(line[ply]))
+          return false;
+
+        ++ply;
+        const auto &pos = it->next();
+        const bool black = it->ply() % 2;
+
+        for (std::size_t i = 0; i < no_materials; ++i)
+          if (!found[i] && Material::of(pos, black) == query.materials[i])
+            mark(i);
+
+        for (std::size_t i = 0; i < no_positions; ++i) {
+          if (found[no_materials + i])
+            continue;
+
+          // home pawns never come back, so the game has left the position behind
+          const auto target = position_home_pawns[i];
+          if ((home_pawns(pos, black) & target) != target)
+            return false;
+
+          const auto &position = query.positions[plan.scan_positions[i]];
+          if (black == position.black && PositionIndex::key(pos, black) == position_keys[i])
+            mark(no_materials + i);
+        }
+
+        for (std::size_t i = 0; i < query.patterns.size(); ++i) {
+          if (found[no_materials + no_positions + i])
+            continue;
+
+          if (!query.patterns[i].reachable(pos, black))
+            return false;
+
+          if (query.patterns[i].matches(pos, black))
+            mark(no_materials + no_positions + i);
+        }
+
+        if (left == 0 && ply >= line.size())
+          return true;
+      }
+
+      return left == 0 && ply >= line.size();
+    }
+  };
+
   template <std::size_t S>
   std::string read_c_str(std::span<const std::byte, S> data,
                               std::size_t offset = 0,
@@ -34,10 +237,11 @@ namespace {
     return s;
   }
 
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+
   Result<DbHeader> read_header(std::span<const std::byte, HeaderSize> header_span) {
     DbHeader hdr;
 
-    const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
     const auto magic = header_span.subspan<0, Magic.size()>();
     if (!std::ranges::equal(magic, MagicBytes)) {
       logger.error("bad header - magic does not match");
@@ -63,10 +267,30 @@ namespace {
 
     return hdr;
   }
+
+  void write_header(std::span<std::byte, HeaderSize> header_span, const DbHeader &hdr) {
+    std::ranges::fill(header_span, std::byte {0});
+    std::ranges::copy(MagicBytes, header_span.begin());
+
+    const auto name = std::as_bytes(std::span {hdr.name}).first(std::min(hdr.name.size(), NameLength - 1));
+    std::ranges::copy(name, header_span.begin() + 20);
+
+    write_le<4>(header_span, hdr.version,       16);
+    write_le<8>(header_span, hdr.data_length,   84);
+    write_le<8>(header_span, hdr.data_offset,   92);
+    write_le<8>(header_span, hdr.data_checksum, 100);
+    write_le<8>(header_span, hdr.no_games,      108);
+    write_le<4>(header_span, hdr.no_pages,      116);
+    write_le<8>(header_span, hdr.date_modified, 120);
+
+    const std::uint32_t checksum = komihash(header_span.subspan<16, HeaderSize - 16>(), 0) >> 32;
+    write_le<4>(header_span, checksum, 12);
+  }
 }
 
 Result<Db> Db::open(const fs::path &path) {
   Db db;
+  db.path = path;
 
   if (auto ec = db.file.open(path)) {
     logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
@@ -80,7 +304,84 @@ Result<Db> Db::open(const fs::path &path) {
   } else
     db.hdr = std::move(*hdr);
 
-  db.page_alloc = std::make_unique<PageAllocator>(db.file.mutable_span(), db.hdr.data_length);
+  const auto file_size = db.file.span().size();
+  if (db.hdr.data_offset < HeaderSize || db.hdr.data_offset > file_size
+      || db.hdr.data_length > file_size - db.hdr.data_offset) {
+    logger.error("file '{}' has corrupted header: data lies outside the file", path.lexically_normal().string());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  db.page_alloc = std::make_unique<PageAllocator>(db.file.mutable_span().subspan(db.hdr.data_offset),
+                                                  db.hdr.data_length);
+
+  if (const auto pos = db.page_alloc->corrupted_at()) {
+    logger.error("file '{}' has a corrupted page at offset {}", path.lexically_normal().string(), *pos);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  if (const auto names_path = sidecar_path(path, ".names"); fs::exists(names_path)) {
+    auto names = NamePool::open(names_path);
+    if (!names)
+      return std::unexpected(names.error());
+
+    db.name_pool = std::move(*names);
+  }
+
+  if (const auto meta_path = sidecar_path(path, ".meta"); fs::exists(meta_path)) {
+    auto metadata = MetadataStore::open(meta_path);
+    if (!metadata)
+      return std::unexpected(metadata.error());
+
+    db.metadata_store = std::move(*metadata);
+  }
+
+  if (const auto positions_path = sidecar_path(path, ".positions"); fs::exists(positions_path)) {
+    auto positions = PositionIndex::open(positions_path);
+    if (!positions)
+      return std::unexpected(positions.error());
+
+    db.position_index = std::move(*positions);
+  }
+
+  if (const auto filters_path = sidecar_path(path, ".bloom"); fs::exists(filters_path)) {
+    auto filters = PageFilters::open(filters_path);
+    if (!filters)
+      return std::unexpected(filters.error());
+
+    db.page_filters = std::move(*filters);
+  }
+
+  if (const auto tree_path = sidecar_path(path, ".tree"); fs::exists(tree_path)) {
+    auto tree = OpeningTree::open(tree_path);
+    if (!tree)
+      return std::unexpected(tree.error());
+
+    db.opening_tree = std::move(*tree);
+  }
+
+  if (const auto lines_path = sidecar_path(path, ".lines"); fs::exists(lines_path)) {
+    auto lines = LineTrie::open(lines_path);
+    if (!lines)
+      return std::unexpected(lines.error());
+
+    db.line_trie = std::move(*lines);
+  }
+
+  if (const auto tags_path = sidecar_path(path, ".tags"); fs::exists(tags_path)) {
+    auto tags = TagIndex::open(tags_path);
+    if (!tags)
+      return std::unexpected(tags.error());
+
+    db.tag_index = std::move(*tags);
+  }
+
+  if (const auto sorted_path = sidecar_path(path, ".sorted"); fs::exists(sorted_path)) {
+    auto sorted = SortedIndex::open(sorted_path);
+    if (!sorted)
+      return std::unexpected(sorted.error());
+
+    db.sorted_index = std::move(*sorted);
+  }
 
   return db;
 }
@@ -104,10 +405,792 @@ Result<Db> Db::create(const fs::path &path, std::size_t size) {
   db.hdr.no_games = 0;
   db.hdr.no_pages = 0;
 
+  db.hdr.name = path.stem().string();
+  db.path = path;
+  db.hdr.date_modified = 0;
+
+  db.page_alloc = std::make_unique<PageAllocator>(db.file.mutable_span().subspan(HeaderSize), 0);
+
   return db;
 }
 
-Result<Db> Db::from_pgn(const fs::path &db_path, const fs::path &pgn_path) {
+void Db::commit() {
+  if (!file.is_open())
+    return;
+
+  if (page_filters.enabled()) {
+    // filters are rebuilt before the pages' changed flags are cleared
+    std::uint32_t page_no = 0;
+    bool rebuilt = false;
+    for (auto &page : *page_alloc) {
+      if (page.changed() || page_no >= page_filters.no_pages()) {
+        page_filters.build(page_no, page_keys(page_no));
+        rebuilt = true;
+      }
+
+      ++page_no;
+    }
+
+    // a stale file would hide games from rebuilt pages once reopened, so it
+    // is removed if it cannot be replaced
+    const auto filters_path = sidecar_path(path, ".bloom");
+    if (rebuilt || !fs::exists(filters_path)) {
+      if (auto ec = page_filters.write(filters_path)) {
+        logger.error("failed to write page filters to '{}' ({})", filters_path.lexically_normal().string(), ec.message());
+
+        std::error_code remove_ec;
+        fs::remove(filters_path, remove_ec);
+      }
+    }
+  }
+
+  for (auto &page : *page_alloc)
+    if (page.changed())
+      page.commit();
+
+  hdr.date_modified = std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+
+  write_header(file.mutable_span().subspan<0, HeaderSize>(), hdr);
+  file.sync();
+  ++changes;
+}
+
+void Db::close() {
+  commit();
+
+  page_alloc.reset();
+  name_pool = {};
+  metadata_store = {};
+  position_index = {};
+  page_filters = {};
+  opening_tree = {};
+  line_trie = {};
+  tag_index = {};
+  sorted_index = {};
+  query_cache.reset();
+
+  // room left for appends is not kept on disk
+  file.shrink(hdr.data_offset + hdr.data_length);
+  file.close();
+}
+
+std::error_code Db::grow(std::size_t size) {
+  const auto extra = std::max({size, page_alloc->max_space() / 4, 32 * PageSize});
+  if (auto ec = file.grow(hdr.data_offset + page_alloc->max_space() + extra))
+    return ec;
+
+  page_alloc->remap(file.mutable_span().subspan(hdr.data_offset));
+  return {};
+}
+
+Result<std::uint32_t> Db::append(std::span<const std::byte> record) {
+  if (record.size() > MaxRecordSize)
+    return std::unexpected(IOError::NotEnoughSpace);
+
+  const std::uint32_t id = hdr.no_games;
+  const auto no_pages = page_alloc->no_pages();
+
+  if (no_pages == 0 || !page_alloc->page(no_pages - 1).append(record)) {
+    if (page_alloc->space_remaining() < PageSize) {
+      if (auto ec = grow(PageSize)) {
+        logger.error("failed to grow database ({})", ec.message());
+        return std::unexpected(ec);
+      }
+    }
+
+    auto page_no = page_alloc->allocate(PageSize, id);
+    if (!page_no) {
+      logger.error("database is full ({} used)", best_size_unit {page_alloc->space_used()});
+      return std::unexpected(page_no.error());
+    }
+
+    page_alloc->page(*page_no).append(record);
+    hdr.no_pages = page_alloc->no_pages();
+  }
+
+  hdr.no_games += 1;
+  hdr.data_length = page_alloc->space_used();
+  ++changes;
+
+  return id;
+}
+
+void Db::enable_filters(unsigned bits_per_key) {
+  // pages without a filter have theirs built on the next commit
+  if (bits_per_key != page_filters.bits_per_key())
+    page_filters = PageFilters {bits_per_key};
+}
+
+std::vector<std::uint64_t> Db::page_keys(std::uint32_t page_no) const {
+  std::vector<std::uint64_t> keys;
+
+  page_alloc->page(page_no).for_each_record([&] (std::uint32_t, std::span<const std::byte> record) {
+    for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations); it != GameDecoder(); ++it)
+      if (it->variation_depth() == 0)
+        keys.push_back(PositionIndex::key(it->next(), it->ply() % 2));
+  });
+
+  return keys;
+}
+
+void Db::enable_cache(std::size_t max_bytes) {
+  if (!max_bytes)
+    query_cache.reset();
+  else if (!query_cache || query_cache->max_bytes() != max_bytes)
+    query_cache = std::make_unique<QueryCache>(max_bytes);
+}
+
+QueryCacheStats Db::cache_stats() const {
+  return query_cache ? query_cache->stats() : QueryCacheStats {};
+}
+
+Result<roaring_bitmap> Db::select(const Query &query, const ScanOptions &options, QueryProfile *profile) const {
+  if (!query_cache || profile)
+    return evaluate(query, options, profile);
+
+  auto key = query.key();
+  if (auto games = query_cache->find(key, changes))
+    return std::move(*games);
+
+  auto games = evaluate(query, options, nullptr);
+  if (games)
+    query_cache->insert(std::move(key), changes, *games);
+
+  return games;
+}
+
+std::optional<roaring_bitmap> Db::narrow(const Query &query, const QueryPlan &plan,
+                                         std::vector<StageStats> &stages) const {
+  // every game, until a stage narrows them down
+  roaring_bitmap candidates;
+  bool all = true;
+
+  const auto keep = [&] (roaring_bitmap games) {
+    candidates = all ? std::move(games) : candidates & games;
+    all = false;
+  };
+
+  for (const auto &stage : plan.stages) {
+    if (stage.kind == PlanStage::Record || (!all && candidates.empty()))
+      break;
+
+    const StageTimer timer;
+    auto &stats = stages.emplace_back();
+    stats.rows_in = all ? hdr.no_games : candidates.cardinality();
+
+    switch (stage.kind) {
+    case PlanStage::Tag:
+    case PlanStage::Line:
+      // looked up while planning
+      keep(stage.games);
+      break;
+
+    case PlanStage::Position: {
+      const auto &[pos, black] = query.positions[stage.predicate];
+      keep(position_index.find(pos, black).games());
+      stats.probes = 1;
+      break;
+    }
+
+    case PlanStage::Metadata:
+      // games the store lacks pass, to be checked by the record scan
+      if (stage.access == Access::Index || all) {
+        auto games = metadata_store.select(plan.metadata);
+        if (plan.metadata_games < hdr.no_games)
+          games.add_range(plan.metadata_games, hdr.no_games - 1);
+
+        keep(std::move(games));
+        stats.probes = 1;
+      } else {
+        std::vector<std::uint32_t> games;
+        candidates.for_each([&] (std::uint32_t id) {
+          if (id >= plan.metadata_games || plan.metadata.matches(metadata_store[id]))
+            games.push_back(id);
+        });
+
+        stats.probes = stats.rows_in;
+        candidates = roaring_bitmap::from_sorted(games);
+      }
+      break;
+
+    case PlanStage::Record:
+      break;
+    }
+
+    stats.rows_out = candidates.cardinality();
+    timer.stop(stats);
+  }
+
+  if (all)
+    return std::nullopt;
+
+  return candidates;
+}
+
+Result<roaring_bitmap> Db::evaluate(const Query &query, const ScanOptions &options, QueryProfile *profile) const {
+  if (options.stop.stopped())
+    return std::unexpected(DbError::Cancelled);
+
+  const StageTimer total_timer;
+  StageStats planning, total;
+
+  const auto plan = this->plan(query);
+  planning.probes = plan.probes;
+  total_timer.stop(planning);
+
+  std::vector<StageStats> stages;
+  auto narrowed = narrow(query, plan, stages);
+  const bool all = !narrowed;
+  auto candidates = all ? roaring_bitmap {} : std::move(*narrowed);
+
+  // the records of the games left are checked last, in one pass over the pages
+  if (plan.stages.size() > stages.size() && plan.stages.back().kind == PlanStage::Record
+      && (all || !candidates.empty())) {
+    const StageTimer timer;
+    auto &stats = stages.emplace_back();
+    stats.rows_in = all ? hdr.no_games : candidates.cardinality();
+
+    const RecordScan scan {query, plan, name_pool.is_open() ? &name_pool : nullptr};
+    const auto ids = all ? std::vector<std::uint32_t> {} : candidates.to_vector();
+    const auto no_pages = page_alloc->no_pages();
+
+    std::vector<StageStats> page_stats(no_pages);
+    const auto games = collect_pages<std::uint32_t>(no_pages, in_order(options), [&] (std::uint32_t page_no,
+                                                                                      std::vector<std::uint32_t> &hits) {
+      if (!all && !has_candidates(*page_alloc, ids, page_no))
+        return;
+
+      auto &page = page_stats[page_no];
+      page.pages = 1;
+      page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+        if ((all || candidates.contains(id)) && scan.matches(id, record, page))
+          hits.push_back(id);
+      });
+    });
+
+    if (!games)
+      return std::unexpected(games.error());
+
+    for (const auto &page : page_stats)
+      stats += page;
+
+    candidates = roaring_bitmap::from_sorted(*games);
+    stats.rows_out = candidates.cardinality();
+    timer.stop(stats);
+  } else if (all && hdr.no_games) {
+    candidates.add_range(0, hdr.no_games - 1);
+  }
+
+  if (profile) {
+    for (const auto &stats : stages)
+      total += stats;
+
+    total.rows_in = hdr.no_games;
+    total.rows_out = candidates.cardinality();
+    total.probes += planning.probes;
+    total_timer.stop(total);
+
+    *profile = {plan, planning, std::move(stages), total};
+  }
+
+  return candidates;
+}
+
+async::generator<std::uint32_t> Db::stream(Query query, ScanOptions options, std::error_code *status) const {
+  if (status)
+    *status = {};
+
+  const auto plan = this->plan(query);
+  std::vector<StageStats> stages;
+  const auto narrowed = narrow(query, plan, stages);
+
+  if (plan.stages.empty() || plan.stages.back().kind != PlanStage::Record) {
+    if (!narrowed) {
+      for (std::uint32_t id = 0; id < hdr.no_games; ++id)
+        co_yield id;
+    } else {
+      for (const auto id : narrowed->to_vector())
+        co_yield id;
+    }
+
+    co_return;
+  }
+
+  if (narrowed && narrowed->empty())
+    co_return;
+
+  const RecordScan scan {query, plan, name_pool.is_open() ? &name_pool : nullptr};
+  const auto ids = narrowed ? narrowed->to_vector() : std::vector<std::uint32_t> {};
+
+  // declared last, so it stops its workers before what they use goes
+  MorselStream<std::uint32_t> games {page_alloc->no_pages(), options, [&] (std::uint32_t page_no,
+                                                                           std::vector<std::uint32_t> &hits) {
+    if (narrowed && !has_candidates(*page_alloc, ids, page_no))
+      return;
+
+    StageStats stats;
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      if ((!narrowed || narrowed->contains(id)) && scan.matches(id, record, stats))
+        hits.push_back(id);
+    });
+  }};
+
+  while (const auto hits = games.next())
+    for (const auto id : *hits)
+      co_yield id;
+
+  if (status && games.cancelled())
+    *status = DbError::Cancelled;
+}
+
+async::generator<CountEstimate> Db::estimate(Query query, SampleOptions options, std::error_code *status) const {
+  if (status)
+    *status = {};
+
+  const auto plan = this->plan(query);
+  std::vector<StageStats> stages;
+  const auto narrowed = narrow(query, plan, stages);
+  const std::uint64_t no_games = narrowed ? narrowed->cardinality() : hdr.no_games;
+  const auto no_pages = page_alloc->no_pages();
+
+  if (plan.stages.empty() || plan.stages.back().kind != PlanStage::Record || no_games == 0) {
+    co_yield CountEstimate {no_games, no_games, no_games, no_pages, no_pages};
+    co_return;
+  }
+
+  const RecordScan scan {query, plan, name_pool.is_open() ? &name_pool : nullptr};
+  const auto ids = narrowed ? narrowed->to_vector() : std::vector<std::uint32_t> {};
+  const auto order = PageSample::order(no_pages, options.seed);
+  PageSample sample {no_pages, no_games};
+
+  // pages come back in the sampled order, so the pages counted at any point
+  // are a random sample of them
+  options.scan.ordered = true;
+
+  MorselStream<PageCount> counts {no_pages, options.scan, [&] (std::uint32_t i, std::vector<PageCount> &out) {
+    const auto page_no = order[i];
+    auto &count = out.emplace_back();
+    if (narrowed && !has_candidates(*page_alloc, ids, page_no))
+      return;
+
+    StageStats stats;
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      if (narrowed && !narrowed->contains(id))
+        return;
+
+      ++count.games;
+      if (scan.matches(id, record, stats))
+        ++count.hits;
+    });
+  }};
+
+  const auto step = std::max(1u, options.step_pages);
+  std::uint32_t since = 0;
+  bool first = true;
+
+  while (const auto pages = counts.next()) {
+    for (const auto &count : *pages)
+      sample.add(count.games, count.hits);
+
+    since += static_cast<std::uint32_t>(pages->size());
+    if (since >= step) {
+      since = 0;
+      first = false;
+      co_yield sample.estimate(options.z);
+    }
+  }
+
+  if (status && counts.cancelled())
+    *status = DbError::Cancelled;
+
+  // the rest of the pages, or where the scan was stopped
+  if (since || first)
+    co_yield sample.estimate(options.z);
+}
+
+Result<std::vector<PositionEntry>> Db::find(const Pattern &pattern, const ScanOptions &options) const {
+  // games whose final home pawns rule out a match are skipped undecoded
+  const bool prefilter = pattern.moved_pawns() && metadata_store.is_open()
+                         && metadata_store.size() == hdr.no_games;
+
+  roaring_bitmap candidates;
+  if (prefilter) {
+    MetadataFilter filter;
+    filter.moved_pawns = pattern.moved_pawns();
+    candidates = metadata_store.select(filter);
+  }
+
+  return collect_pages<PositionEntry>(page_alloc->no_pages(), in_order(options), [&] (std::uint32_t page_no, std::vector<PositionEntry> &hits) {
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      if (prefilter && !candidates.contains(id))
+        return;
+
+      for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations); it != GameDecoder(); ++it) {
+        if (it->variation_depth())
+          continue;
+
+        // the rest of the mainline follows from this position
+        const bool black = it->ply() % 2;
+        if (!pattern.reachable(it->next(), black))
+          break;
+
+        if (pattern.matches(it->next(), black))
+          hits.push_back({id, static_cast<std::uint16_t>(it->ply())});
+      }
+    });
+  });
+}
+
+Result<std::vector<PositionEntry>> Db::find(const chess::Position &pos, bool black, const ScanOptions &options) const {
+  const auto key = PositionIndex::key(pos, black);
+  if (covers(position_index))
+    return position_index.find(key).entries();
+
+  const auto target_home_pawns = home_pawns(pos, black);
+  const auto before = page_filters.stats();
+
+  // sorted by game, as the index's posting lists are
+  auto entries = collect_pages<PositionEntry>(page_alloc->no_pages(), in_order(options), [&] (std::uint32_t page_no, std::vector<PositionEntry> &hits) {
+    // filters are rebuilt on commit, so a page changed since may hold
+    // positions its filter has not seen
+    const bool filtered = !page_alloc->page(page_no).changed() && page_no < page_filters.no_pages();
+    if (filtered && !page_filters.may_contain(page_no, key))
+      return;
+
+    const auto no_hits = hits.size();
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations); it != GameDecoder(); ++it) {
+        if (it->variation_depth())
+          continue;
+
+        // home pawns never come back, so the game has left the position behind
+        if ((home_pawns(it->next(), it->ply() % 2) & target_home_pawns) != target_home_pawns)
+          break;
+
+        if (it->ply() % 2 == black && PositionIndex::key(it->next(), black) == key)
+          hits.push_back({id, static_cast<std::uint16_t>(it->ply())});
+      }
+    });
+
+    if (filtered && hits.size() == no_hits)
+      page_filters.false_positive();
+  });
+
+  if (page_filters.enabled() && entries) {
+    const auto after = page_filters.stats();
+    logger.debug("page filters skipped {} of {} pages ({} false positives)",
+                after.skipped - before.skipped, after.tested - before.tested,
+                after.false_positives - before.false_positives);
+  }
+
+  return entries;
+}
+
+std::error_code Db::build_opening_tree(unsigned max_ply, const ScanOptions &options) {
+  // results, Elo and dates are unknown without metadata
+  const bool has_metadata = metadata_store.is_open() && metadata_store.size() == hdr.no_games;
+  const auto no_pages = page_alloc->no_pages();
+
+  std::vector<OpeningTreeBuilder> builders(no_workers(options.threads, no_pages));
+  const auto status = scan_pages(no_pages, per_worker(options, builders.size()), [&] (unsigned worker, std::uint32_t page_no) {
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      const auto game = has_metadata ? metadata_store[id] : GameMetadata {};
+
+      for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations); it != GameDecoder(); ++it) {
+        if (it->variation_depth())
+          continue;
+
+        if (it->ply() > max_ply)
+          break;
+
+        builders[worker].add(it->previous(), (it->ply() - 1) % 2, it->move(), game);
+      }
+    });
+  });
+
+  if (status)
+    return status;
+
+  for (std::size_t i = 1; i < builders.size(); ++i)
+    builders.front().merge(std::move(builders[i]));
+
+  // the old tree is still mapped from the file being replaced
+  opening_tree = {};
+
+  const auto tree_path = sidecar_path(path, ".tree");
+  if (auto ec = builders.front().write(tree_path))
+    return ec;
+
+  auto tree = OpeningTree::open(tree_path);
+  if (!tree)
+    return tree.error();
+
+  opening_tree = std::move(*tree);
+  return {};
+}
+
+std::span<const std::byte> Db::record(std::uint32_t id) const {
+  // pages hold consecutive ids from their first game
+  std::uint32_t lo = 0, hi = page_alloc->no_pages();
+  while (lo < hi) {
+    const auto mid = lo + (hi - lo) / 2;
+    if (page_alloc->page(mid).first_game() <= id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  std::span<const std::byte> found;
+  if (lo > 0) {
+    page_alloc->page(lo - 1).for_each_record([&] (std::uint32_t i, std::span<const std::byte> record) {
+      if (i == id)
+        found = record;
+    });
+  }
+
+  return found;
+}
+
+std::error_code Db::build_line_trie(unsigned max_plies, const ScanOptions &options) {
+  const auto no_pages = page_alloc->no_pages();
+
+  std::vector<LineTrieBuilder> builders(no_workers(options.threads, no_pages), LineTrieBuilder {max_plies});
+  const auto status = scan_pages(no_pages, per_worker(options, builders.size()), [&] (unsigned worker, std::uint32_t page_no) {
+    std::vector<Token::Type> moves;
+
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      moves.clear();
+
+      for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations);
+           it != GameDecoder() && moves.size() < max_plies; ++it)
+        if (!it->variation_depth())
+          moves.push_back(Token::encode(it->move()));
+
+      builders[worker].add(id, moves);
+    });
+  });
+
+  if (status)
+    return status;
+
+  for (std::size_t i = 1; i < builders.size(); ++i)
+    builders.front().merge(std::move(builders[i]));
+
+  // the old trie is still mapped from the file being replaced
+  line_trie = {};
+
+  const auto lines_path = sidecar_path(path, ".lines");
+  if (auto ec = builders.front().write(lines_path))
+    return ec;
+
+  auto lines = LineTrie::open(lines_path);
+  if (!lines)
+    return lines.error();
+
+  line_trie = std::move(*lines);
+  return {};
+}
+
+Result<std::vector<std::uint32_t>> Db::find_line(std::span<const chess::Move> moves, const ScanOptions &options) const {
+  const auto begins_with = [&] (std::span<const std::byte> record) {
+    std::size_t ply = 0;
+    for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations);
+         it != GameDecoder() && ply < moves.size(); ++it) {
+      if (it->variation_depth())
+        continue;
+
+      if (Token::encode(it->move()) != Token::encode(moves[ply++]))
+        return false;
+    }
+
+    return ply == moves.size();
+  };
+
+  // games from a leaf of the trie are only candidates, which are checked a
+  // page at a time like a scan, so each page is walked once
+  const bool narrowed = covers(line_trie);
+  std::vector<std::uint32_t> candidates;
+
+  if (narrowed) {
+    const auto match = line_trie.find(moves);
+    for (std::size_t i = 0; i < match.size(); ++i)
+      candidates.push_back(match[i]);
+
+    std::ranges::sort(candidates);
+    if (match.exact || candidates.empty())
+      return candidates;
+  }
+
+  const auto hits = collect_pages<PositionEntry>(page_alloc->no_pages(), in_order(options), [&] (std::uint32_t page_no, std::vector<PositionEntry> &hits) {
+    if (narrowed && !has_candidates(*page_alloc, candidates, page_no))
+      return;
+
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      if ((!narrowed || std::ranges::binary_search(candidates, id)) && begins_with(record))
+        hits.push_back({id, static_cast<std::uint16_t>(moves.size())});
+    });
+  });
+
+  if (!hits)
+    return std::unexpected(hits.error());
+
+  std::vector<std::uint32_t> games;
+  for (const auto &hit : *hits)
+    games.push_back(hit.game);
+
+  return games;
+}
+
+std::error_code Db::build_tag_index(const ScanOptions &options) {
+  const auto no_pages = page_alloc->no_pages();
+
+  // values are views into the pages or the name pool, which outlive the
+  // builders
+  std::vector<TagIndexBuilder> builders(no_workers(options.threads, no_pages));
+  const auto status = scan_pages(no_pages, per_worker(options, builders.size()), [&] (unsigned worker, std::uint32_t page_no) {
+    page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+      const NamePool *names = name_pool.is_open() ? &name_pool : nullptr;
+
+      for (auto it = TagDecoder(record_tag_data(record), names); it != TagDecoder(); ++it)
+        builders[worker].add(id, it->id, it->value);
+    });
+  });
+
+  if (status)
+    return status;
+
+  for (std::size_t i = 1; i < builders.size(); ++i)
+    builders.front().merge(std::move(builders[i]));
+
+  // the old index is still mapped from the file being replaced
+  tag_index = {};
+
+  const auto tags_path = sidecar_path(path, ".tags");
+  if (auto ec = builders.front().write(tags_path, hdr.no_games))
+    return ec;
+
+  auto tags = TagIndex::open(tags_path);
+  if (!tags)
+    return tags.error();
+
+  tag_index = std::move(*tags);
+  return {};
+}
+
+std::error_code Db::build_sorted_index() {
+  if (!metadata_store.is_open() || metadata_store.size() != hdr.no_games) {
+    logger.error("cannot sort games without metadata for every game");
+    return DbError::Corrupted;
+  }
+
+  SortedIndexBuilder builder;
+  for (std::uint32_t id = 0; id < metadata_store.size(); ++id)
+    builder.push(metadata_store[id]);
+
+  // the old index is still mapped from the file being replaced
+  sorted_index = {};
+
+  const auto sorted_path = sidecar_path(path, ".sorted");
+  if (auto ec = builder.write(sorted_path))
+    return ec;
+
+  auto sorted = SortedIndex::open(sorted_path);
+  if (!sorted)
+    return sorted.error();
+
+  sorted_index = std::move(*sorted);
+  return {};
+}
+
+std::vector<std::uint32_t> Db::top(SortKey key, std::size_t n, bool descending,
+                                   const roaring_bitmap *candidates) const {
+  using Entry = SortedIndex::Entry;
+
+  // the index and the metadata hold the games up to when they were written,
+  // and the games appended since are read from their records
+  const std::uint32_t stored = metadata_store.is_open() ? std::min<std::uint64_t>(metadata_store.size(), hdr.no_games) : 0;
+  const std::uint32_t indexed = sorted_index.is_open() && sorted_index.size() <= hdr.no_games ? sorted_index.size() : 0;
+  bool has_index = indexed && indexed >= stored;
+
+  // about n * games / candidates index entries are read before n candidates
+  // are found, so fewer candidates than that are cheaper to look up directly
+  if (has_index && stored == indexed && candidates) {
+    const double count = candidates->cardinality();
+    has_index = count * count > double(n) * hdr.no_games;
+  }
+
+  const std::uint32_t covered = has_index ? indexed : stored;
+
+  // ties are broken by game id in the same direction, so that entries read
+  // from the index come in exactly the order of the heap
+  const auto select = [&] <class Compare> (Compare cmp) {
+    top_n<Entry, Compare> heap(n, cmp);
+    std::size_t read = 0;
+
+    const auto push = [&] (std::uint32_t game, const GameMetadata &metadata) {
+      if (const auto value = SortedIndex::value(key, metadata))
+        heap.push({value, game});
+    };
+
+    StageStats appended;
+    if (covered < hdr.no_games) {
+      const auto no_pages = page_alloc->no_pages();
+      for (std::uint32_t page_no = 0; page_no < no_pages; ++page_no) {
+        // pages hold consecutive ids from their first game
+        if (page_no + 1 < no_pages && page_alloc->page(page_no + 1).first_game() <= covered)
+          continue;
+
+        page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+          if (id >= covered && (!candidates || candidates->contains(id)))
+            push(id, record_metadata(record, name_pool.is_open() ? &name_pool : nullptr, appended));
+        });
+      }
+    }
+
+    if (has_index) {
+      // entries come in the order of the heap, so no later entry can take a
+      // place once n of them are in it
+      std::size_t taken = 0;
+      for (const auto &entry : sorted_index.scan(key, {1}, descending)) {
+        if (taken == n)
+          break;
+
+        ++read;
+        if (!candidates || candidates->contains(entry.game)) {
+          heap.push(entry);
+          ++taken;
+        }
+      }
+    } else if (candidates) {
+      candidates->for_each([&] (std::uint32_t game) {
+        if (game < covered) {
+          ++read;
+          push(game, metadata_store[game]);
+        }
+      });
+    } else {
+      for (std::uint32_t game = 0; game < covered; ++game) {
+        ++read;
+        push(game, metadata_store[game]);
+      }
+    }
+
+    logger.debug("top {} games read {} {} and {} bytes of appended games", n, read,
+                 has_index ? "index entries" : "games", appended.bytes);
+
+    std::vector<std::uint32_t> games;
+    for (const auto &entry : heap.take())
+      games.push_back(entry.game);
+
+    return games;
+  };
+
+  return descending ? select(std::greater<Entry> {}) : select(std::less<Entry> {});
+}
+
+Result<Db> Db::from_pgn(const fs::path &db_path, const fs::path &pgn_path,
+                        const ImportOptions &options) {
   using FileInfo = std::tuple<std::size_t, fs::path>;
   std::vector<FileInfo> pgn_files;
   std::size_t total_size = 0;
@@ -145,7 +1228,9 @@ Result<Db> Db::from_pgn(const fs::path &db_path, const fs::path &pgn_path) {
   logger.info("total size: {}", best_size_unit {total_size});
   logger.info("allocating {} for database", best_size_unit {total_size});
 
-  const auto max_encoded_size = total_size; /* todo */
+  // encoded games are always smaller than their PGN, but the last page may
+  // not be full
+  const auto max_encoded_size = HeaderSize + total_size + PageSize;
   const auto si = fs::space(pgn_path);
   if (max_encoded_size >= si.available) {
     logger.error("not enough space on disk ({} remaining, need {})",
@@ -154,6 +1239,85 @@ Result<Db> Db::from_pgn(const fs::path &db_path, const fs::path &pgn_path) {
   }
 
   auto db = create(db_path, max_encoded_size);
+  if (!db)
+    return db;
+
+  // built for every page on the final commit
+  db->enable_filters(options.page_filter_bits);
+
+  Importer importer {*db, options};
+
+  for (const auto &[size, path] : pgn_files) {
+    if (size == 0)
+      continue;
+
+    // mapped rather than read, so large PGN files are never copied
+    io::mm_file pgn;
+    if (auto ec = pgn.open(path)) {
+      logger.error("failed to open '{}' ({})", path.string(), ec.message());
+      return std::unexpected(ec);
+    }
+
+    const auto data = pgn.span();
+    if (auto ec = importer.import_pgn({reinterpret_cast<const char *>(data.data()), data.size()})) {
+      logger.error("failed to import '{}' ({})", path.string(), ec.message());
+      return std::unexpected(ec);
+    }
+  }
+
+  if (auto ec = importer.finish(db_path))
+    return std::unexpected(ec);
+
+  if (options.intern_names) {
+    auto names = NamePool::open(sidecar_path(db_path, ".names"));
+    if (!names)
+      return std::unexpected(names.error());
+
+    db->name_pool = std::move(*names);
+  }
+
+  auto metadata = MetadataStore::open(sidecar_path(db_path, ".meta"));
+  if (!metadata)
+    return std::unexpected(metadata.error());
+
+  db->metadata_store = std::move(*metadata);
+
+  if (options.index_positions) {
+    auto positions = PositionIndex::open(sidecar_path(db_path, ".positions"));
+    if (!positions)
+      return std::unexpected(positions.error());
+
+    db->position_index = std::move(*positions);
+  }
+
+  if (options.opening_tree_plies) {
+    if (auto ec = db->build_opening_tree(options.opening_tree_plies, {.stop = options.stop}))
+      return std::unexpected(ec);
+  }
+
+  if (options.line_trie_plies) {
+    if (auto ec = db->build_line_trie(options.line_trie_plies, {.stop = options.stop}))
+      return std::unexpected(ec);
+  }
+
+  if (options.index_tags) {
+    if (auto ec = db->build_tag_index({.stop = options.stop}))
+      return std::unexpected(ec);
+  }
+
+  if (options.sort_games) {
+    if (options.stop.stopped())
+      return std::unexpected(DbError::Cancelled);
+
+    if (auto ec = db->build_sorted_index())
+      return std::unexpected(ec);
+  }
+
+  logger.info("imported {} games ({} skipped) into {} pages, {} used",
+              importer.games(), importer.skipped(), db->hdr.no_pages,
+              best_size_unit {db->hdr.data_length});
+
+  db->commit();
 
   return db;
 }
@@ -1,8 +1,26 @@
 #pragma once
 
+#include "async/generator.hh"
 #include "core/io.hh"
+#include "db/expr.hh"
+#include "db/linetrie.hh"
+#include "db/metadata.hh"
+#include "db/namepool.hh"
+#include "db/openingtree.hh"
+#include "db/pagefilter.hh"
+#include "db/pattern.hh"
+#include "db/positionindex.hh"
+#include "db/query.hh"
+#include "db/querycache.hh"
+#include "db/sample.hh"
+#include "db/scan.hh"
+#include "db/sortedindex.hh"
+#include "db/tagindex.hh"
 #include "db/page.hh"
 
+#include <memory>
+#include <optional>
+
 namespace cdb::db {
 
 constexpr std::string_view Magic = "\u00bfChessDB\x1a\r\n";
@@ -32,18 +50,31 @@ private:
 
   std::size_t _data_length = 0;
 
+  // offset of the first page whose size is invalid, if any
+  std::optional<std::size_t> _corrupted_at;
+
 public:
   PageAllocator() = default;
 
   PageAllocator(std::span<std::byte> mem, std::size_t data_length)
     : _mem(mem), _pages(), _data_length(data_length)
   {
-    for (;;) {
-      // loop over pages
-      break;
+    for (std::size_t pos = 0; pos + PageHeader::Size <= data_length; ) {
+      const std::size_t size = read_le<2>(_mem, pos);
+      if (size < PageHeader::Size || size > data_length - pos) {
+        _corrupted_at = pos;
+        break;
+      }
+
+      _pages.emplace_back(_mem.subspan(pos, size), false);
+      pos += size;
     }
   }
 
+  std::optional<std::size_t> corrupted_at() const {
+    return _corrupted_at;
+  }
+
   std::size_t space_used() const {
     return _data_length;
   }
@@ -56,15 +87,29 @@ public:
     return max_space() - space_used();
   }
 
-  Result<std::uint32_t> allocate(std::size_t size) {
+  // moves every page to a larger mapping of the same data
+  void remap(std::span<std::byte> mem) {
+    assert(mem.size() >= _data_length);
+
+    std::size_t pos = 0;
+    for (auto &page : _pages) {
+      page.move_to(mem.subspan(pos, page.size()));
+      pos += page.size();
+    }
+
+    _mem = mem;
+  }
+
+  Result<std::uint32_t> allocate(std::size_t size, std::uint32_t first_game) {
     if (size > space_remaining()) {
       // todo: log
       return std::unexpected(DbError::OutOfMemory);
     }
 
-    Page &page = _pages.emplace_back(_mem.subspan(_data_length, size), true);
-
+    _pages.emplace_back(_mem.subspan(_data_length, size), true, first_game);
     _data_length += size;
+
+    return no_pages() - 1;
   }
 
   std::uint32_t no_pages() const {
@@ -85,26 +130,244 @@ public:
   auto end()   { return _pages.end(); }
 };
 
+struct ImportOptions {
+  // a checkpoint position is stored every this many plies, or never if zero
+  unsigned checkpoint_interval = 32;
+
+  // store player, event and site names in a name pool next to the database
+  bool intern_names = true;
+
+  // index mainline positions so that games can be found by position
+  bool index_positions = true;
+
+  // bits per position in each page's Bloom filter, or zero for no filters
+  unsigned page_filter_bits = 10;
+
+  // plies of each game counted in the opening tree, or zero for no tree
+  unsigned opening_tree_plies = 30;
+
+  // plies of each game in the line trie, or zero for no trie
+  unsigned line_trie_plies = 30;
+
+  // index player, event and site names for exact, prefix and substring search
+  bool index_tags = true;
+
+  // sort games by date and Elo, so that the most recent or highest rated are
+  // found without sorting
+  bool sort_games = true;
+
+  // stops the import between games or pages, which then fails with
+  // DbError::Cancelled and leaves the files written so far
+  StopCondition stop {};
+};
+
 class Db {
 private:
   DbHeader hdr;
 
+  fs::path path;
   io::mm_file file;
   std::unique_ptr<PageAllocator> page_alloc;
 
+  NamePool name_pool;
+  MetadataStore metadata_store;
+  PositionIndex position_index;
+  PageFilters page_filters;
+  OpeningTree opening_tree;
+  LineTrie line_trie;
+  TagIndex tag_index;
+  SortedIndex sorted_index;
+
+  // results of queries, if enabled, for the generation of the games
+  std::unique_ptr<QueryCache> query_cache;
+  std::uint64_t changes = 0;
+
+  // keys of every mainline position in a page
+  std::vector<std::uint64_t> page_keys(std::uint32_t page_no) const;
+
+  // the record of a game, or an empty span if there is no such game
+  std::span<const std::byte> record(std::uint32_t id) const;
+
+  // extends the file by at least size bytes for pages, and a share of its
+  // size so that it is mapped again rarely
+  std::error_code grow(std::size_t size);
+
+  // runs a plan's stages up to its record scan, returning the games left, or
+  // nothing if no stage narrowed them down
+  std::optional<roaring_bitmap> narrow(const Query &query, const QueryPlan &plan,
+                                       std::vector<StageStats> &stages) const;
+
+  // runs a query's plan, without the cache
+  Result<roaring_bitmap> evaluate(const Query &query, const ScanOptions &options, QueryProfile *profile) const;
+
 public:
+  // write changed pages and the header to disk
+  void commit();
   void close();
 
   static Result<Db> open(const fs::path &path);
   static Result<Db> create(const fs::path &path, std::size_t size /*bytes*/);
-  static Result<Db> from_pgn(const fs::path &db_path, const fs::path &pgn_path);
+  static Result<Db> from_pgn(const fs::path &db_path, const fs::path &pgn_path,
+                             const ImportOptions &options = {});
 
-  void for_each(std::invocable<> auto fn) {
-    for (auto &page : *page_alloc) {
-      for (auto &game : page.games()) {
-        
-      }
-    }
+  // path of a file stored alongside the database, e.g. the name pool
+  static fs::path sidecar_path(const fs::path &db_path, std::string_view extension) {
+    return fs::path(db_path).replace_extension(extension);
+  }
+
+  std::uint64_t no_games() const { return hdr.no_games; }
+
+  // whether an index is open and was built from every game, as games appended
+  // since are not in it
+  template <class Index>
+  bool covers(const Index &index) const { return index.is_open() && index.no_games() == hdr.no_games; }
+
+  // names are only available if the database has a name pool
+  const NamePool &names() const { return name_pool; }
+
+  // metadata is only available if the database was imported with it
+  const MetadataStore &metadata() const { return metadata_store; }
+
+  // positions are only available if the database was imported with them
+  const PositionIndex &positions() const { return position_index; }
+
+  // page filters are built on commit once enabled, and kept next to the
+  // database
+  const PageFilters &filters() const { return page_filters; }
+  void enable_filters(unsigned bits_per_key);
+
+  // the opening tree is only available once built, which import does by default
+  const OpeningTree &openings() const { return opening_tree; }
+
+  // counts every move up to max_ply in one pass over the pages, with a
+  // partial tree per thread, and writes the tree next to the database
+  std::error_code build_opening_tree(unsigned max_ply, const ScanOptions &options = {});
+
+  // the line trie is only available once built, which import does by default
+  const LineTrie &lines() const { return line_trie; }
+
+  // collects the first max_plies moves of every game in one pass over the
+  // pages and writes the trie next to the database
+  std::error_code build_line_trie(unsigned max_plies, const ScanOptions &options = {});
+
+  // games whose mainline begins with the moves, sorted by id. uses the line
+  // trie if there is one, replaying only games past its leaves.
+  Result<std::vector<std::uint32_t>> find_line(std::span<const chess::Move> moves,
+                                               const ScanOptions &options = {}) const;
+
+  // the tag index is only available once built, which import does by default
+  const TagIndex &tags() const { return tag_index; }
+
+  // collects the names of every game in one pass over the pages and writes
+  // the index next to the database
+  std::error_code build_tag_index(const ScanOptions &options = {});
+
+  // the sorted index is only available once built, which import does by default
+  const SortedIndex &sorted() const { return sorted_index; }
+
+  // sorts the games by each key from their metadata and writes the index next
+  // to the database
+  std::error_code build_sorted_index();
+
+  // the first n games in the order of the key, highest values first if
+  // descending, among the candidates if given. games whose value is unknown
+  // are left out. reads the sorted index in order and stops after n games if
+  // there is one, or else keeps the best n of every candidate's metadata.
+  // games appended since either was written are read from their records.
+  std::vector<std::uint32_t> top(SortKey key, std::size_t n, bool descending = true,
+                                 const roaring_bitmap *candidates = nullptr) const;
+
+  // how a query would be run, see QueryPlan
+  QueryPlan plan(const Query &query) const { return QueryPlan::make(query, *this); }
+
+  // games matching every predicate of the query, evaluated in the order of
+  // its plan. records are scanned in parallel with the options, which may
+  // stop the query. the plan and what each stage did are kept in the profile
+  // if there is one, which always runs the query. otherwise results come
+  // from the query cache if it is enabled and has them.
+  Result<roaring_bitmap> select(const Query &query, const ScanOptions &options = {},
+                                QueryProfile *profile = nullptr) const;
+
+  /**
+   * Games matching the query, in order, as they are found. Index lookups run
+   * first, then the records of the games left are checked on several
+   * threads, a morsel of pages at a time and never far ahead of the reader,
+   * so the first games come after one morsel and a reader that stops reading
+   * (or destroys the generator) stops the scan, as does stopping it through
+   * the options, after which it ends early. Once it ends, the status if given
+   * is DbError::Cancelled if it was stopped before its last game, or
+   * DbError::Corrupted if the query could not run. The database and the
+   * status must outlive the generator and not move.
+   */
+  async::generator<std::uint32_t> stream(Query query, ScanOptions options = {.morsel_pages = 1},
+                                         std::error_code *status = nullptr) const;
+
+  /**
+   * Estimates of how many games match the query, each closer than the last.
+   * Index lookups run first, and if they answer the query the one estimate is
+   * exact. Otherwise the records left are checked a page at a time in a
+   * random order, see PageSample, with an estimate every few pages, until
+   * every page is checked and the last estimate is exact. A reader that
+   * stops reading keeps the estimate it has, and stopping the scan through
+   * the options ends the estimates early, with a last one that is not exact.
+   * The status is set as for stream. The database and the status must
+   * outlive the generator and not move.
+   */
+  async::generator<CountEstimate> estimate(Query query, SampleOptions options = {},
+                                           std::error_code *status = nullptr) const;
+
+  // changes with every append and commit, so results for a generation hold
+  // until the next
+  std::uint64_t generation() const { return changes; }
+
+  // keeps the results of queries within a budget of bytes, see QueryCache,
+  // or stops keeping them if it is zero
+  void enable_cache(std::size_t max_bytes);
+
+  // hits, misses and evictions of the query cache, all zero if it is disabled
+  QueryCacheStats cache_stats() const;
+
+  // every mainline position matching the pattern, sorted by game. pages are
+  // scanned in parallel with the options.
+  Result<std::vector<PositionEntry>> find(const Pattern &pattern, const ScanOptions &options = {}) const;
+
+  // every mainline occurrence of a position, sorted by game, from the position
+  // index if there is one, or else by a scan that skips pages using their
+  // filters, except pages changed since the last commit
+  Result<std::vector<PositionEntry>> find(const chess::Position &pos, bool black,
+                                          const ScanOptions &options = {}) const;
+
+  // appends a game record, returning the new game's id. the file grows as
+  // needed, which maps it again, so records read before are invalid.
+  Result<std::uint32_t> append(std::span<const std::byte> record);
+
+  // calls fn with the id and record of every game, on several threads at once
+  std::error_code for_each(std::invocable<std::uint32_t, std::span<const std::byte>> auto fn,
+                           const ScanOptions &options = {}) const {
+    return scan_pages(page_alloc->no_pages(), options, [&] (unsigned, std::uint32_t page_no) {
+      page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+        fn(id, record);
+      });
+    });
+  }
+
+  // ids of the games for which predicate(id, record) holds, checked on several
+  // threads at once, sorted if the options keep results in order
+  template <std::predicate<std::uint32_t, std::span<const std::byte>> F>
+  Result<std::vector<std::uint32_t>> filter(F &&predicate, const ScanOptions &options = {}) const {
+    return collect_pages<std::uint32_t>(page_alloc->no_pages(), options,
+                                        [&] (std::uint32_t page_no, std::vector<std::uint32_t> &ids) {
+      page_alloc->page(page_no).for_each_record([&] (std::uint32_t id, std::span<const std::byte> record) {
+        if (predicate(id, record))
+          ids.push_back(id);
+      });
+    });
+  }
+
+  // ids of the games matching an expression, see expr.hh
+  template <expr::Expression E>
+  Result<std::vector<std::uint32_t>> filter(const E &expression, const ScanOptions &options = {}) const {
+    return filter(expr::compile(expression, &metadata_store, &name_pool), options);
   }
 };
 
@@ -0,0 +1,420 @@
+#pragma once
+
+#include "chess/pgn.hh"
+#include "chess/position.hh"
+#include "db/codec.hh"
+#include "db/material.hh"
+#include "db/metadata.hh"
+#include "db/namepool.hh"
+#include "db/pattern.hh"
+#include "db/positionindex.hh"
+
+#include <bitset>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Predicates on games written as C++ expressions, e.g.
+ *
+ *   using namespace cdb::db::expr;
+ *   db.filter(white_elo >= 2600 && reaches(*Material::parse("RP v R")));
+ *
+ * Each expression is its own type, so a scan over it is compiled for that
+ * predicate alone, without a tree of predicates to interpret for each game or
+ * each ply. A game is first checked against its metadata, which settles
+ * column comparisons and rules out games whose material signature or home
+ * pawns cannot match, and only games that could still match are replayed,
+ * once for every predicate on the moves, and only until each has been found
+ * or can no longer be.
+ *
+ * Predicates on the moves hold if the mainline reaches them at some ply, each
+ * at a ply of its own, as with Query.
+ */
+namespace cdb::db::expr {
+
+// the outcome of a predicate given what is known of a game so far
+enum class Truth : std::uint8_t { False, True, Unknown };
+
+constexpr Truth truth(bool b) {
+  return b ? Truth::True : Truth::False;
+}
+
+// what replaying a game has found of the predicates on its moves, each with a
+// bit in the order they appear in the expression
+template <std::size_t N>
+struct Replay {
+  std::bitset<N> found, settled;
+
+  bool done() const { return settled.all(); }
+
+  void settle(std::size_t i, bool matched) {
+    found[i] = matched;
+    settled[i] = true;
+  }
+};
+
+/**
+ * The base of every expression. An expression E has:
+ *
+ *  - E::Terminals, the number of predicates on the moves it has
+ *  - check(game, moves), its truth given the game's metadata, where moves is
+ *    false if the columns derived from the moves (material signatures and
+ *    home pawns) are not known
+ *  - visit<I>(pos, black, replay), called for each position of the mainline,
+ *    with its predicates on the moves numbered from I
+ *  - eval<I>(game, found), its value once the game has been replayed
+ */
+struct Node {};
+
+template <class T>
+concept Expression = std::derived_from<std::remove_cvref_t<T>, Node>;
+
+// a column of the game metadata, as a value of type T
+template <auto Member, class T = std::remove_cvref_t<decltype(std::declval<GameMetadata>().*Member)>>
+struct Column {
+  using value_type = T;
+
+  static constexpr T get(const GameMetadata &game) {
+    return static_cast<T>(game.*Member);
+  }
+};
+
+// columns are zero where unknown, as in GameMetadata
+inline constexpr Column<&GameMetadata::date> date;
+inline constexpr Column<&GameMetadata::white_elo> white_elo;
+inline constexpr Column<&GameMetadata::black_elo> black_elo;
+inline constexpr Column<&GameMetadata::eco> eco;
+inline constexpr Column<&GameMetadata::ply_count> ply_count;
+inline constexpr Column<&GameMetadata::result, chess::GameResult> result;
+
+// the first day of a year, to compare dates with
+constexpr std::uint32_t year(unsigned y) {
+  return MetadataFilter::year(y);
+}
+
+template <class C, class Op>
+class Compare : public Node {
+private:
+  typename C::value_type _value;
+
+public:
+  static constexpr std::size_t Terminals = 0;
+
+  constexpr explicit Compare(typename C::value_type value) : _value(value) {}
+
+  constexpr Truth check(const GameMetadata &game, bool) const {
+    return truth(Op {}(C::get(game), _value));
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &, bool, Replay<N> &) const {}
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &game, const std::bitset<N> &) const {
+    return Op {}(C::get(game), _value);
+  }
+};
+
+template <auto M, class T>
+constexpr auto operator==(Column<M, T>, std::type_identity_t<T> value) {
+  return Compare<Column<M, T>, std::ranges::equal_to> {value};
+}
+
+template <auto M, class T>
+constexpr auto operator!=(Column<M, T>, std::type_identity_t<T> value) {
+  return Compare<Column<M, T>, std::ranges::not_equal_to> {value};
+}
+
+template <auto M, class T>
+constexpr auto operator<(Column<M, T>, std::type_identity_t<T> value) {
+  return Compare<Column<M, T>, std::ranges::less> {value};
+}
+
+template <auto M, class T>
+constexpr auto operator<=(Column<M, T>, std::type_identity_t<T> value) {
+  return Compare<Column<M, T>, std::ranges::less_equal> {value};
+}
+
+template <auto M, class T>
+constexpr auto operator>(Column<M, T>, std::type_identity_t<T> value) {
+  return Compare<Column<M, T>, std::ranges::greater> {value};
+}
+
+template <auto M, class T>
+constexpr auto operator>=(Column<M, T>, std::type_identity_t<T> value) {
+  return Compare<Column<M, T>, std::ranges::greater_equal> {value};
+}
+
+// the mainline reaches a material configuration
+class ReachesMaterial : public Node {
+private:
+  Material _material;
+
+public:
+  static constexpr std::size_t Terminals = 1;
+
+  constexpr explicit ReachesMaterial(const Material &material) : _material(material) {}
+
+  constexpr Truth check(const GameMetadata &game, bool moves) const {
+    return moves && !(game.material & _material.signature()) ? Truth::False : Truth::Unknown;
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &pos, bool black, Replay<N> &replay) const {
+    if (!replay.settled[I] && Material::of(pos, black) == _material)
+      replay.settle(I, true);
+  }
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &, const std::bitset<N> &found) const {
+    return found[I];
+  }
+};
+
+// the mainline reaches a position with a side to move
+class ReachesPosition : public Node {
+private:
+  std::uint64_t _key;
+  std::uint16_t _home_pawns;
+  bool _black;
+
+public:
+  static constexpr std::size_t Terminals = 1;
+
+  ReachesPosition(const chess::Position &pos, bool black)
+    : _key(PositionIndex::key(pos, black)), _home_pawns(home_pawns(pos, black)), _black(black) {}
+
+  // pawns that left home before the position are gone by the end of the game
+  constexpr Truth check(const GameMetadata &game, bool moves) const {
+    return moves && (game.home_pawns & ~_home_pawns) ? Truth::False : Truth::Unknown;
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &pos, bool black, Replay<N> &replay) const {
+    if (replay.settled[I])
+      return;
+
+    if ((home_pawns(pos, black) & _home_pawns) != _home_pawns)
+      replay.settle(I, false);
+    else if (black == _black && PositionIndex::key(pos, black) == _key)
+      replay.settle(I, true);
+  }
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &, const std::bitset<N> &found) const {
+    return found[I];
+  }
+};
+
+// the mainline reaches a position matching a pattern
+class MatchesPattern : public Node {
+private:
+  Pattern _pattern;
+  std::uint16_t _moved_pawns;
+
+public:
+  static constexpr std::size_t Terminals = 1;
+
+  explicit MatchesPattern(const Pattern &pattern) : _pattern(pattern), _moved_pawns(pattern.moved_pawns()) {}
+
+  constexpr Truth check(const GameMetadata &game, bool moves) const {
+    return moves && (game.home_pawns & _moved_pawns) ? Truth::False : Truth::Unknown;
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &pos, bool black, Replay<N> &replay) const {
+    if (replay.settled[I])
+      return;
+
+    if (!_pattern.reachable(pos, black))
+      replay.settle(I, false);
+    else if (_pattern.matches(pos, black))
+      replay.settle(I, true);
+  }
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &, const std::bitset<N> &found) const {
+    return found[I];
+  }
+};
+
+inline ReachesMaterial reaches(const Material &material) {
+  return ReachesMaterial {material};
+}
+
+inline ReachesPosition reaches(const chess::Position &pos, bool black) {
+  return ReachesPosition {pos, black};
+}
+
+inline MatchesPattern matches(const Pattern &pattern) {
+  return MatchesPattern {pattern};
+}
+
+template <class A, class B>
+class And : public Node {
+private:
+  A _a;
+  B _b;
+
+public:
+  static constexpr std::size_t Terminals = A::Terminals + B::Terminals;
+
+  constexpr And(A a, B b) : _a(std::move(a)), _b(std::move(b)) {}
+
+  constexpr Truth check(const GameMetadata &game, bool moves) const {
+    const auto a = _a.check(game, moves);
+    if (a == Truth::False)
+      return a;
+
+    const auto b = _b.check(game, moves);
+    return a == Truth::True ? b : (b == Truth::False ? b : Truth::Unknown);
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &pos, bool black, Replay<N> &replay) const {
+    _a.template visit<I>(pos, black, replay);
+    _b.template visit<I + A::Terminals>(pos, black, replay);
+  }
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &game, const std::bitset<N> &found) const {
+    return _a.template eval<I>(game, found) && _b.template eval<I + A::Terminals>(game, found);
+  }
+};
+
+template <class A, class B>
+class Or : public Node {
+private:
+  A _a;
+  B _b;
+
+public:
+  static constexpr std::size_t Terminals = A::Terminals + B::Terminals;
+
+  constexpr Or(A a, B b) : _a(std::move(a)), _b(std::move(b)) {}
+
+  constexpr Truth check(const GameMetadata &game, bool moves) const {
+    const auto a = _a.check(game, moves);
+    if (a == Truth::True)
+      return a;
+
+    const auto b = _b.check(game, moves);
+    return a == Truth::False ? b : (b == Truth::True ? b : Truth::Unknown);
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &pos, bool black, Replay<N> &replay) const {
+    _a.template visit<I>(pos, black, replay);
+    _b.template visit<I + A::Terminals>(pos, black, replay);
+  }
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &game, const std::bitset<N> &found) const {
+    return _a.template eval<I>(game, found) || _b.template eval<I + A::Terminals>(game, found);
+  }
+};
+
+template <class A>
+class Not : public Node {
+private:
+  A _a;
+
+public:
+  static constexpr std::size_t Terminals = A::Terminals;
+
+  constexpr explicit Not(A a) : _a(std::move(a)) {}
+
+  constexpr Truth check(const GameMetadata &game, bool moves) const {
+    const auto a = _a.check(game, moves);
+    return a == Truth::Unknown ? a : truth(a == Truth::False);
+  }
+
+  template <std::size_t I, std::size_t N>
+  void visit(const chess::Position &pos, bool black, Replay<N> &replay) const {
+    _a.template visit<I>(pos, black, replay);
+  }
+
+  template <std::size_t I, std::size_t N>
+  constexpr bool eval(const GameMetadata &game, const std::bitset<N> &found) const {
+    return !_a.template eval<I>(game, found);
+  }
+};
+
+template <Expression A, Expression B>
+constexpr auto operator&&(A a, B b) {
+  return And<A, B> {std::move(a), std::move(b)};
+}
+
+template <Expression A, Expression B>
+constexpr auto operator||(A a, B b) {
+  return Or<A, B> {std::move(a), std::move(b)};
+}
+
+template <Expression A>
+constexpr auto operator!(A a) {
+  return Not<A> {std::move(a)};
+}
+
+/**
+ * An expression as a predicate on a game's id and record, for Db::filter and
+ * Db::for_each. Games are looked up in the metadata store if it has them, or
+ * else their columns are read from their tags, with the ply count counted
+ * from their moves, and every game that the columns allow is replayed.
+ */
+template <Expression E>
+class Compiled {
+private:
+  E _expr;
+  const MetadataStore *_metadata;
+  const NamePool *_names;
+
+  GameMetadata from_tags(std::span<const std::byte> record) const {
+    GameMetadata game;
+    for (auto it = TagDecoder(record_tag_data(record), _names); it != TagDecoder(); ++it)
+      game.add_tag(it->name, it->to_string());
+
+    std::uint32_t plies = 0;
+    for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations); it != GameDecoder(); ++it)
+      plies += !it->variation_depth();
+
+    game.ply_count = static_cast<std::uint16_t>(std::min(plies, 0xffffu));
+    return game;
+  }
+
+public:
+  Compiled(E expr, const MetadataStore *metadata, const NamePool *names)
+    : _expr(std::move(expr)), _metadata(metadata && metadata->is_open() ? metadata : nullptr),
+      _names(names && names->is_open() ? names : nullptr) {}
+
+  bool operator()(std::uint32_t id, std::span<const std::byte> record) const {
+    const bool stored = _metadata && id < _metadata->size();
+    const auto game = stored ? (*_metadata)[id] : from_tags(record);
+
+    // column comparisons are always settled by the metadata
+    const auto known = _expr.check(game, stored);
+    if (E::Terminals == 0 || known != Truth::Unknown)
+      return known == Truth::True;
+
+    Replay<E::Terminals> replay;
+    _expr.template visit<0>(chess::startpos, false, replay);
+
+    for (auto it = GameDecoder(record_move_data(record), DecodeMode::SkipAnnotations);
+         it != GameDecoder() && !replay.done(); ++it) {
+      if (!it->variation_depth())
+        _expr.template visit<0>(it->next(), it->ply() % 2, replay);
+    }
+
+    return _expr.template eval<0>(game, replay.found);
+  }
+};
+
+template <Expression E>
+Compiled<E> compile(E expr, const MetadataStore *metadata, const NamePool *names = nullptr) {
+  return {std::move(expr), metadata, names};
+}
+
+} // cdb::db::expr
@@ -12,14 +12,6 @@
 namespace cdb::db {
   class Db;
 
-  namespace GameFormat { // todo: make bitmask class
-    using Type = std::uint8_t;
-    constexpr Type Empty       = 0x0;
-    constexpr Type HasTagData  = 0x1;
-    constexpr Type HasComments = 0x2;
-    constexpr Type HasNAGs     = 0x4;
-  }
-
   class Game {
   private:
     Db *_db; // weak/shared_ptr ??? should be page instead?
@@ -48,19 +40,35 @@ namespace cdb::db {
       return format() & GameFormat::HasNAGs;
     }
 
+    bool has_checkpoints() const {
+      return format() & GameFormat::HasCheckpoints;
+    }
+
   public: /* data */
     unsigned tag_data_size() const {
-      assert(has_tags());
-      return read_le<2>(_data, 1);
+      return has_tags() ? read_le<2>(_data, 1) : 0;
     }
 
     std::span<std::byte> tag_data() const {
-      return _data.subspan(1, tag_data_size());
+      return _data.subspan(3, tag_data_size());
+    }
+
+    std::size_t move_data_offset() const {
+      return has_tags() ? 3 + tag_data_size() : 1;
     }
 
     std::span<std::byte> move_data() const {
-      auto offset = 3 + tag_data_size();
-      return _data.subspan(offset, read_le<2>(_data, offset));
+      auto offset = move_data_offset();
+      return _data.subspan(offset + 2, read_le<2>(_data, offset));
+    }
+
+    std::span<std::byte> checkpoint_data() const {
+      if (!has_checkpoints())
+        return {};
+
+      auto offset = move_data_offset();
+      offset += 2 + read_le<2>(_data, offset);
+      return _data.subspan(offset + 2, read_le<2>(_data, offset));
     }
 
     std::uint64_t checksum() const {
@@ -70,16 +78,27 @@ namespace cdb::db {
   public: /* codec */
     struct Moves {
       const Game &game;
+      DecodeMode::Type mode;
+      unsigned ply;
 
       GameDecoder begin() const {
-        return DecoderImpl(game.move_data());
+        if (ply)
+          if (auto checkpoint = find_checkpoint(game.checkpoint_data(), ply))
+            return {game.move_data(), *checkpoint, mode};
+
+        return {game.move_data(), mode};
       }
 
       GameDecoder end() const {
         return {};
       }
     };
-    Moves moves() const { return {*this}; }
+
+    // decoding starts from the last checkpoint at or before the given ply,
+    // so the first step may be before it
+    Moves moves(DecodeMode::Type mode = DecodeMode::Eager, unsigned ply = 0) const {
+      return {*this, mode, ply};
+    }
 
     struct Tags {
       const Game &game;
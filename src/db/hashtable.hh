@@ -0,0 +1,210 @@
+#pragma once
+
+#include "core/error.hh"
+#include "util/bits.hh"
+#include "util/komihash.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace cdb::db {
+
+/**
+ * Inspired by absl:
+ * https://github.com/abseil/abseil-cpp/blob/master/absl/container/internal/raw_hash_set.h#L438
+ *
+ * empty    = 0b10000000
+ * deleted  = 0b11000000
+ * sentinel = 0b11111111
+ * hash     = 0b01111111
+ */
+namespace Metadata {
+  using Type = std::uint8_t;
+  constexpr Type Hash     = 0b01111111;
+  constexpr Type Empty    = 0b10000000;
+  constexpr Type Deleted  = 0b11000000;
+  constexpr Type Sentinel = 0b11111111;
+}
+
+// a group of control bytes that are compared all at once
+struct Group {
+  static constexpr std::size_t Width = 16;
+
+  const Metadata::Type *ctrl;
+
+  // bit i is set if control byte i is equal to md
+  std::uint32_t match(Metadata::Type md) const {
+#ifdef __SSE2__
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(md))));
+#else
+    std::uint32_t bits = 0;
+    for (std::size_t i = 0; i < Width; ++i)
+      bits |= std::uint32_t(ctrl[i] == md) << i;
+
+    return bits;
+#endif
+  }
+
+  std::uint32_t match_empty() const { return match(Metadata::Empty); }
+};
+
+template <class Key>
+struct KeyHash {
+  std::uint64_t operator()(const Key &key) const { return komihashv(&key, sizeof key, 0); }
+};
+
+// for keys that are already well mixed hashes
+struct IdentityHash {
+  std::uint64_t operator()(std::uint64_t key) const { return key; }
+};
+
+/**
+ * Read only open addressing hash table over a block of memory, so it can be
+ * stored in a file and memory mapped. Slots are probed a group of control
+ * bytes at a time, using the low 7 bits of the hash to filter candidates:
+ *
+ *  u64 capacity, u64 size
+ *  u8  ctrl[capacity]
+ *  slots[capacity], each key then value
+ *
+ * Keys and values are copied as they are in memory, so must be trivially
+ * copyable, and keys are compared by their bytes.
+ */
+template <class Key, class Value, class Hash = KeyHash<Key>>
+  requires std::has_unique_object_representations_v<Key> && std::is_trivially_copyable_v<Value>
+class HashTable {
+public:
+  static constexpr std::size_t HeaderSize = 16;
+  static constexpr std::size_t SlotSize = sizeof(Key) + sizeof(Value);
+
+private:
+  std::span<const std::byte> _data;
+  std::size_t _capacity = 0, _size = 0;
+
+  const Metadata::Type *ctrl() const {
+    return reinterpret_cast<const Metadata::Type *>(_data.data() + HeaderSize);
+  }
+
+  const std::byte *slot(std::size_t i) const {
+    return _data.data() + HeaderSize + _capacity + SlotSize * i;
+  }
+
+  // visits groups in triangular order, which covers every group when the
+  // number of groups is a power of two
+  template <class F>
+  static auto probe(std::uint64_t hash, std::size_t capacity, F &&f) {
+    const auto mask = capacity / Group::Width - 1;
+    auto g = (hash >> 7) & mask;
+
+    for (std::size_t i = 1; ; g = (g + i++) & mask)
+      if (auto r = f(g * Group::Width))
+        return *r;
+  }
+
+public:
+  HashTable() = default;
+
+  static constexpr std::size_t capacity_for(std::size_t count) {
+    // keep the load factor below 7/8
+    return std::bit_ceil(std::max(count + count / 7 + 1, Group::Width));
+  }
+
+  static constexpr std::size_t bytes(std::size_t count) {
+    const auto capacity = capacity_for(count);
+    return HeaderSize + capacity + SlotSize * capacity;
+  }
+
+  static Result<HashTable> open(std::span<const std::byte> data) {
+    if (data.size() < HeaderSize)
+      return std::unexpected(DbError::Corrupted);
+
+    HashTable table;
+    table._capacity = read_le<8>(data);
+    table._size     = read_le<8>(data, 8);
+
+    if (!std::has_single_bit(table._capacity) || table._capacity < Group::Width
+        || table._size >= table._capacity
+        || (data.size() - HeaderSize) / (SlotSize + 1) < table._capacity)
+      return std::unexpected(DbError::Corrupted);
+
+    table._data = data.first(HeaderSize + table._capacity * (SlotSize + 1));
+    return table;
+  }
+
+  // builds a table of the given key-value pairs into data, which must be at
+  // least bytes(size of items) long. keys must be unique.
+  template <std::ranges::sized_range R>
+  static HashTable build(std::span<std::byte> data, R &&items) {
+    const auto capacity = capacity_for(std::ranges::size(items));
+    assert(data.size() >= bytes(std::ranges::size(items)));
+
+    write_le<8>(data, capacity);
+    write_le<8>(data, std::ranges::size(items), 8);
+
+    auto ctrl  = reinterpret_cast<Metadata::Type *>(data.data() + HeaderSize);
+    auto slots = data.data() + HeaderSize + capacity;
+    std::fill_n(ctrl, capacity, Metadata::Empty);
+
+    for (const auto &[key, value] : items) {
+      const auto hash = Hash {}(key);
+
+      const auto i = probe(hash, capacity, [&] (std::size_t g) -> std::optional<std::size_t> {
+        if (const auto empty = Group {ctrl + g}.match_empty())
+          return g + std::countr_zero(empty);
+
+        return std::nullopt;
+      });
+
+      ctrl[i] = hash & Metadata::Hash;
+      std::memcpy(slots + SlotSize * i, &key, sizeof key);
+      std::memcpy(slots + SlotSize * i + sizeof key, &value, sizeof value);
+    }
+
+    return *open(data.first(bytes(std::ranges::size(items))));
+  }
+
+  std::size_t size() const { return _size; }
+  std::size_t capacity() const { return _capacity; }
+  bool empty() const { return _size == 0; }
+
+  std::optional<Value> find(const Key &key) const {
+    if (_capacity == 0)
+      return std::nullopt;
+
+    const auto hash = Hash {}(key);
+
+    return probe(hash, _capacity, [&] (std::size_t g) -> std::optional<std::optional<Value>> {
+      const Group group {ctrl() + g};
+
+      for (auto bits = group.match(hash & Metadata::Hash); bits; bits &= bits - 1) {
+        const auto s = slot(g + std::countr_zero(bits));
+
+        if (std::memcmp(s, &key, sizeof key) == 0) {
+          Value value;
+          std::memcpy(&value, s + sizeof key, sizeof value);
+          return value;
+        }
+      }
+
+      // a group with an empty slot ends the probe sequence
+      if (group.match_empty())
+        return std::optional<Value> {};
+
+      return std::nullopt;
+    });
+  }
+};
+
+} // cdb::db
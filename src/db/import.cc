@@ -0,0 +1,152 @@
+#include "chess/pgn.hh"
+#include "core/logger.hh"
+#include "db/import.hh"
+#include "util/bytesize.hh"
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("import");
+
+namespace {
+  std::string_view strip(std::string_view s, char open, char close) {
+    if (s.size() >= 2 && s.front() == open && s.back() == close)
+      return s.substr(1, s.size() - 2);
+
+    return s;
+  }
+
+  // returns the start of the game after the one at pos, skipping its tags
+  // and movetext
+  std::size_t next_game(std::string_view pgn, std::size_t pos) {
+    constexpr std::string_view Whitespace = "\r\n \t";
+
+    pos = pgn.find_first_not_of(Whitespace, pos);
+    while (pos != std::string_view::npos && pgn[pos] == '[') {
+      pos = pgn.find('\n', pos);
+      if (pos == std::string_view::npos)
+        return pos;
+
+      pos = pgn.find_first_not_of(Whitespace, pos);
+    }
+
+    if (pos == std::string_view::npos)
+      return pos;
+
+    pos = pgn.find("\n[", pos);
+    return pos == std::string_view::npos ? pos : pos + 1;
+  }
+}
+
+Result<std::size_t> Importer::import_game(std::string_view pgn) {
+  const auto start = pgn.find_first_not_of("\r\n \t");
+  if (start == std::string_view::npos)
+    return 0;
+
+  _tags.clear();
+  _moves.clear();
+  _game_positions.clear();
+
+  GameMetadata metadata;
+  metadata.material = Material::of(chess::startpos, false).signature();
+  metadata.home_pawns = home_pawns(chess::startpos, false);
+
+  auto r = chess::parse_tags(pgn.substr(start), [&] (auto name, auto value) {
+    _tags.add(name, strip(value, '"', '"'));
+    metadata.add_tag(name, strip(value, '"', '"'));
+  });
+
+  if (r.ec)
+    return std::unexpected(r.ec);
+
+  std::size_t bytes_read = start + r.bytes_read;
+
+  GameFormat::Type format = 0;
+  unsigned move_no = 0;
+  bool ok = true;
+
+  r = chess::parse_movetext(pgn.substr(bytes_read), [&] (const chess::ParseStep &step) {
+    if (step.move_no == move_no)
+      return;
+
+    move_no = step.move_no;
+    _moves.move(step.move);
+    metadata.material |= Material::of(step.next, move_no % 2 == 1).signature();
+    metadata.home_pawns = home_pawns(step.next, move_no % 2 == 1);
+
+    if (_options.index_positions)
+      _game_positions.emplace_back(step.next, move_no % 2 == 1);
+
+    if (const auto comment = strip(step.comment, '{', '}'); !comment.empty()) {
+      ok = ok && _moves.comment(comment).has_value();
+      format |= GameFormat::HasComments;
+    }
+  });
+
+  if (r.ec)
+    return std::unexpected(r.ec);
+
+  if (!ok)
+    return std::unexpected(ParseError::Invalid);
+
+  bytes_read += r.bytes_read;
+
+  auto record = write_record(format, _tags.data(), _moves.data(), _moves.checkpoints());
+  if (!record)
+    return std::unexpected(record.error());
+
+  const auto id = _db.append(*record);
+  if (!id)
+    return std::unexpected(id.error());
+
+  for (std::size_t i = 0; i < _game_positions.size() && i < 0xffff; ++i) {
+    const auto &[pos, black] = _game_positions[i];
+    _positions.add(pos, black, *id, i + 1);
+  }
+
+  metadata.ply_count = std::min(move_no, 0xffffu);
+
+  _metadata.push(metadata);
+
+  return bytes_read;
+}
+
+std::error_code Importer::import_pgn(std::string_view pgn) {
+  for (std::size_t pos = 0; pos < pgn.size(); ) {
+    if (_options.stop.stopped())
+      return DbError::Cancelled;
+
+    const auto r = import_game(pgn.substr(pos));
+
+    if (r) {
+      if (*r == 0)
+        break;
+
+      pos += *r;
+      ++_games;
+    } else if (r.error() == DbError::OutOfMemory) {
+      return r.error();
+    } else {
+      logger.warn("skipping game at byte {} ({})", pos, r.error().message());
+      ++_skipped;
+
+      pos = next_game(pgn, pos);
+    }
+  }
+
+  return {};
+}
+
+std::error_code Importer::finish(const fs::path &db_path) {
+  if (auto ec = _metadata.write(Db::sidecar_path(db_path, ".meta")))
+    return ec;
+
+  if (_options.index_positions)
+    if (auto ec = _positions.write(Db::sidecar_path(db_path, ".positions"), _db.no_games()))
+      return ec;
+
+  if (!_options.intern_names)
+    return {};
+
+  return _names.write(Db::sidecar_path(db_path, ".names"));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "db/codec.hh"
+#include "db/db.hh"
+#include "db/metadata.hh"
+#include "db/namepool.hh"
+#include "db/positionindex.hh"
+
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * Encodes PGN games and appends them to a database. Player, event and site
+ * names are interned, filterable metadata (including material signatures) is
+ * collected and mainline positions are indexed as games are encoded, and
+ * these are written out once all games have been imported.
+ */
+class Importer {
+private:
+  Db &_db;
+  ImportOptions _options;
+
+  NamePoolBuilder _names;
+  MetadataBuilder _metadata;
+  PositionIndexBuilder _positions;
+
+  // positions are only added to the index once their game has been stored
+  std::vector<std::pair<chess::Position, bool>> _game_positions;
+  TagEncoder _tags;
+  GameEncoder _moves;
+
+  std::uint64_t _games = 0, _skipped = 0;
+
+  // returns the number of bytes read, or zero if there are no games left
+  Result<std::size_t> import_game(std::string_view pgn);
+
+public:
+  Importer(Db &db, const ImportOptions &options)
+    : _db(db), _options(options), _tags(options.intern_names ? &_names : nullptr),
+      _moves(options.checkpoint_interval)
+  {
+  }
+
+  Importer(const Importer &) = delete;
+  Importer &operator=(const Importer &) = delete;
+
+  // games that cannot be parsed are skipped. fails with DbError::Cancelled
+  // if the options' stop condition is met between games.
+  std::error_code import_pgn(std::string_view pgn);
+
+  // writes the name pool, metadata and position index next to the database
+  std::error_code finish(const fs::path &db_path);
+
+  std::uint64_t games() const { return _games; }
+  std::uint64_t skipped() const { return _skipped; }
+};
+
+} // cdb::db
@@ -0,0 +1,219 @@
+#include "chess/pgn.hh"
+#include "core/logger.hh"
+#include "db/linetrie.hh"
+#include "util/bytesize.hh"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("lines");
+
+Result<LineTrie> LineTrie::open(const fs::path &path) {
+  LineTrie trie;
+
+  if (auto ec = trie._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = trie._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad line trie - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad line trie - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  trie._max_plies = read_le<4>(data, 12);
+  trie._no_nodes  = read_le<4>(data, 16);
+  const std::size_t no_games = read_le<4>(data, 20);
+
+  const auto nodes_size = NodeSize * trie._no_nodes;
+  if (HeaderSize + nodes_size + 4 * no_games > data.size()) {
+    logger.error("bad line trie - {} nodes do not fit in {} bytes", trie._no_nodes, data.size());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  trie._nodes = data.subspan(HeaderSize, nodes_size);
+  trie._games = data.subspan(HeaderSize + nodes_size, 4 * no_games);
+
+  return trie;
+}
+
+LineTrie::Match LineTrie::find(std::span<const chess::Move> moves) const {
+  if (_no_nodes == 0)
+    return {};
+
+  const auto token = [&] (std::uint32_t node) -> Token::Type { return read_le<2>(_nodes, NodeSize * node); };
+  const auto games = [&] (std::uint32_t node) {
+    const std::size_t first = read_le<4>(_nodes, NodeSize * node + 8);
+    const std::size_t count = read_le<4>(_nodes, NodeSize * node + 12);
+    return _games.subspan(4 * first, 4 * count);
+  };
+
+  std::uint32_t node = 0;
+  for (std::size_t ply = 0; ply < moves.size(); ++ply) {
+    const auto first = first_child(node), last = first_child(node + 1);
+
+    // the games of a leaf cut short by the maximum plies, or left as a
+    // single game, may still continue with the moves
+    if (first == last) {
+      const Match leaf {games(node), false};
+      return ply == _max_plies || leaf.size() == 1 ? leaf : Match {};
+    }
+
+    const auto move = Token::encode(moves[ply]);
+    auto lo = first, hi = last;
+    while (lo < hi) {
+      const auto mid = lo + (hi - lo) / 2;
+      if (token(mid) < move)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    if (lo == last || token(lo) != move)
+      return {};
+
+    node = lo;
+  }
+
+  return {games(node), true};
+}
+
+Result<std::vector<chess::Move>> LineTrie::parse(std::string_view line) {
+  std::vector<chess::Move> moves;
+
+  // steps are visited again after annotations, with the same move number
+  const auto r = chess::parse_movetext(line, [&] (const chess::ParseStep &step) {
+    if (step.move_no > moves.size())
+      moves.push_back(step.move);
+  });
+
+  if (r.ec) {
+    logger.error(R"(failed to parse line "{}" ({}))", line, r.ec.message());
+    return std::unexpected(r.ec);
+  }
+
+  return moves;
+}
+
+void LineTrieBuilder::add(std::uint32_t game, std::span<const Token::Type> moves) {
+  const auto n = std::min<std::size_t>(moves.size(), _max_plies);
+
+  _games.push_back(game);
+  _tokens.insert(_tokens.end(), moves.begin(), moves.begin() + n);
+  _first.push_back(_tokens.size());
+}
+
+void LineTrieBuilder::merge(LineTrieBuilder &&other) {
+  const auto offset = static_cast<std::uint32_t>(_tokens.size());
+
+  _games.insert(_games.end(), other._games.begin(), other._games.end());
+  _tokens.insert(_tokens.end(), other._tokens.begin(), other._tokens.end());
+  for (std::size_t i = 1; i < other._first.size(); ++i)
+    _first.push_back(offset + other._first[i]);
+
+  other = LineTrieBuilder {other._max_plies};
+}
+
+std::error_code LineTrieBuilder::write(const fs::path &path) {
+  const auto line = [&] (std::uint32_t i) {
+    return std::span {_tokens}.subspan(_first[i], _first[i + 1] - _first[i]);
+  };
+
+  // shorter lines sort before the lines they begin
+  std::vector<std::uint32_t> order(_games.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::sort(order, [&] (std::uint32_t a, std::uint32_t b) {
+    const auto x = line(a), y = line(b);
+    if (const auto c = std::lexicographical_compare_three_way(x.begin(), x.end(), y.begin(), y.end()); c != 0)
+      return c < 0;
+
+    return _games[a] < _games[b];
+  });
+
+  struct Node {
+    Token::Type move;
+    std::uint32_t first_child, first_game, count, depth;
+  };
+
+  // children are added in the order their parents are visited, so each
+  // node's children start where those of the previous node end
+  std::vector<Node> nodes {{0, 0, 0, static_cast<std::uint32_t>(order.size()), 0}};
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    nodes[i].first_child = nodes.size();
+
+    const auto [move, first_child, first, count, depth] = nodes[i];
+    if (count < 2 || depth == _max_plies)
+      continue;
+
+    for (auto j = first; j < first + count; ) {
+      // lines ending here come first and have no child
+      if (line(order[j]).size() <= depth) {
+        ++j;
+        continue;
+      }
+
+      const auto token = line(order[j])[depth];
+      auto k = j + 1;
+      while (k < first + count && line(order[k])[depth] == token)
+        ++k;
+
+      nodes.push_back({token, 0, j, k - j, depth + 1});
+      j = k;
+    }
+  }
+
+  if (nodes.size() > std::numeric_limits<std::uint32_t>::max()) {
+    logger.error("{} nodes do not fit in a line trie", nodes.size());
+    return DbError::OutOfMemory;
+  }
+
+  const auto nodes_size = LineTrie::NodeSize * nodes.size();
+  const auto size = LineTrie::HeaderSize + nodes_size + 4 * order.size();
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::fill(data.first(LineTrie::HeaderSize), std::byte {0});
+  std::ranges::copy(std::as_bytes(std::span {LineTrie::Magic}), data.begin());
+  write_le<4>(data, LineTrie::Version, 8);
+  write_le<4>(data, _max_plies, 12);
+  write_le<4>(data, static_cast<std::uint32_t>(nodes.size()), 16);
+  write_le<4>(data, static_cast<std::uint32_t>(order.size()), 20);
+
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    const auto offset = LineTrie::HeaderSize + LineTrie::NodeSize * i;
+    write_le<2>(data, nodes[i].move, offset);
+    write_le<2>(data, 0u, offset + 2);
+    write_le<4>(data, nodes[i].first_child, offset + 4);
+    write_le<4>(data, nodes[i].first_game, offset + 8);
+    write_le<4>(data, nodes[i].count, offset + 12);
+  }
+
+  for (std::size_t i = 0; i < order.size(); ++i)
+    write_le<4>(data, _games[order[i]], LineTrie::HeaderSize + nodes_size + 4 * i);
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote {} nodes over {} games to '{}' ({})", nodes.size(), order.size(),
+              path.lexically_normal().string(), best_size_unit {size});
+
+  *this = LineTrieBuilder {_max_plies};
+  return {};
+}
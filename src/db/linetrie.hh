@@ -0,0 +1,106 @@
+#pragma once
+
+#include "chess/movegen.hh"
+#include "core/error.hh"
+#include "core/io.hh"
+#include "db/codec.hh"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * A trie over the opening moves of every game, so that the games beginning
+ * with a line are found by one walk from the root. Games are sorted by their
+ * moves, so the games below any node are a contiguous range of that order,
+ * which is also the order that keeps games of the same opening together.
+ * Stored in a file next to the database:
+ *
+ *  header (32 bytes)
+ *    magic "cdblines", u32 version, u32 maximum plies, u32 node count,
+ *    u32 game count, u64 reserved
+ *  nodes   16 bytes each, in breadth first order:
+ *            u16 move token, u16 reserved, u32 first child, u32 first game,
+ *            u32 game count
+ *  games   u32 game ids, sorted by their moves
+ *
+ * Children of a node are sorted by move token and end at the first child of
+ * the next node. Nodes with a single game are not split any further, so the
+ * games of a line that ends past a leaf are only candidates.
+ *
+ * Nodes are plain records rather than a succinct encoding such as LOUDS.
+ * That costs 16 bytes a node instead of a few bits plus the move, but a step
+ * down is a binary search over one contiguous run of children, with no rank
+ * and select directory to build or probe. Since nodes stop at single games,
+ * there are far fewer of them than games times plies.
+ */
+class LineTrie {
+public:
+  static constexpr std::string_view Magic = "cdblines";
+  static constexpr std::uint32_t Version = 0;
+  static constexpr std::size_t HeaderSize = 32;
+  static constexpr std::size_t NodeSize = 16;
+
+  struct Match {
+    std::span<const std::byte> games; // u32 game ids
+    bool exact = true;                // else every game must be checked
+
+    std::size_t size() const { return games.size() / 4; }
+    std::uint32_t operator[](std::size_t i) const { return read_le<4>(games, 4 * i); }
+  };
+
+private:
+  io::mm_file _file;
+  std::uint32_t _max_plies = 0, _no_nodes = 0;
+  std::span<const std::byte> _nodes, _games;
+
+  std::uint32_t first_child(std::uint32_t node) const {
+    return node < _no_nodes ? read_le<4>(_nodes, NodeSize * node + 4) : _no_nodes;
+  }
+
+public:
+  LineTrie() = default;
+
+  static Result<LineTrie> open(const fs::path &path);
+
+  bool is_open() const { return _file.is_open(); }
+
+  std::uint32_t max_plies() const { return _max_plies; }
+  std::uint32_t size() const { return _no_nodes; }
+
+  // games [0, no_games()) are in the trie
+  std::uint32_t no_games() const { return _games.size() / 4; }
+
+  // games beginning with the moves, relative to the side to move
+  Match find(std::span<const chess::Move> moves) const;
+
+  // every game, in the order of their moves
+  Match games() const { return {_games}; }
+
+  // parses movetext such as "1. d4 Nf6 2. c4 e6" from the starting position
+  static Result<std::vector<chess::Move>> parse(std::string_view line);
+};
+
+class LineTrieBuilder {
+private:
+  std::uint32_t _max_plies;
+
+  // the moves of game i are _tokens[_first[i], _first[i + 1])
+  std::vector<std::uint32_t> _games, _first {0};
+  std::vector<Token::Type> _tokens;
+
+public:
+  explicit LineTrieBuilder(std::uint32_t max_plies) : _max_plies(max_plies) {}
+
+  // adds a game by its mainline moves, of which only the first plies are kept
+  void add(std::uint32_t game, std::span<const Token::Type> moves);
+
+  void merge(LineTrieBuilder &&other);
+
+  std::error_code write(const fs::path &path);
+};
+
+} // cdb::db
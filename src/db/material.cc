@@ -0,0 +1,89 @@
+#include "core/logger.hh"
+#include "db/material.hh"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+static const log::logger logger("material");
+
+namespace {
+  constexpr std::array<PieceType, 5> PieceTypes {
+    PieceType::Pawn, PieceType::Knight, PieceType::Bishop, PieceType::Rook, PieceType::Queen
+  };
+
+  constexpr std::string_view PieceChars = "PNBRQ";
+}
+
+unsigned Material::shift(bool black, PieceType piece_type) {
+  const auto it = std::ranges::find(PieceTypes, piece_type == PieceType::Castle ? PieceType::Rook
+                                                                               : piece_type);
+  assert(it != PieceTypes.end());
+  return 20 * black + 4 * (it - PieceTypes.begin());
+}
+
+Material Material::of(const Position &pos, bool black) {
+  const auto occ = pos.occupied();
+  const auto us = pos.white & occ, them = occ & ~pos.white;
+
+  std::uint64_t key = 0;
+  for (const auto piece_type : PieceTypes) {
+    const auto bb = pos.extract(piece_type);
+
+    // counts above 15 can only come from impossible positions
+    key |= std::uint64_t(std::min(std::popcount(bb & us), 15)) << shift(black, piece_type);
+    key |= std::uint64_t(std::min(std::popcount(bb & them), 15)) << shift(!black, piece_type);
+  }
+
+  return Material {key};
+}
+
+Result<Material> Material::parse(std::string_view material) {
+  std::uint64_t key = 0;
+  bool black = false;
+
+  for (std::size_t i = 0; i < material.size(); ++i) {
+    const auto c = material[i];
+
+    if (c == ' ' || c == '+' || c == 'K') {
+      continue;
+    } else if (c == 'v' && !black) {
+      black = true;
+      i += i + 1 < material.size() && material[i + 1] == 's';
+    } else if (const auto idx = PieceChars.find(c); idx != std::string_view::npos) {
+      const auto s = shift(black, PieceTypes[idx]);
+      if (((key >> s) & 0xf) == 0xf) {
+        logger.error(R"(too many pieces in "{}")", material);
+        return std::unexpected(ParseError::Illegal);
+      }
+
+      key += std::uint64_t(1) << s;
+    } else {
+      logger.error(R"(unexpected character '{}' in "{}")", c, material);
+      return std::unexpected(ParseError::Invalid);
+    }
+  }
+
+  if (!black) {
+    logger.error(R"(expected "vs" in "{}")", material);
+    return std::unexpected(ParseError::Invalid);
+  }
+
+  return Material {key};
+}
+
+std::string Material::to_string() const {
+  std::string s;
+
+  for (bool black : {false, true}) {
+    s += black ? " vs K" : "K";
+    for (std::size_t i = PieceTypes.size(); i--; )
+      s.append(count(black, PieceTypes[i]), PieceChars[i]);
+  }
+
+  return s;
+}
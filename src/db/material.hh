@@ -0,0 +1,79 @@
+#pragma once
+
+#include "chess/position.hh"
+#include "core/error.hh"
+
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cdb::db {
+
+/**
+ * The number of pawns, knights, bishops, rooks and queens of each side, with
+ * 4 bits per count (white first), so a configuration is a 40 bit key.
+ *
+ * Games store the set of configurations they pass through as a 64 bit
+ * signature, one bit per configuration. Since many configurations share a
+ * bit, a set bit only means the game might reach it, but a clear bit rules it
+ * out without replaying the game.
+ */
+class Material {
+private:
+  std::uint64_t _key = 0;
+
+  static unsigned shift(bool black, chess::PieceType piece_type);
+
+public:
+  constexpr Material() = default;
+  constexpr explicit Material(std::uint64_t key) : _key(key) {}
+
+  static Material of(const chess::Position &pos, bool black);
+
+  /**
+   * Parses the pieces of white then black, separated by "v" or "vs", e.g.
+   * "KRP vs KR" or "R+P v R". Kings and '+' are optional.
+   */
+  static Result<Material> parse(std::string_view material);
+
+  constexpr std::uint64_t key() const { return _key; }
+
+  unsigned count(bool black, chess::PieceType piece_type) const {
+    return (_key >> shift(black, piece_type)) & 0xf;
+  }
+
+  // the same configuration with the colours swapped
+  constexpr Material flipped() const {
+    return Material {(_key >> 20) | ((_key & 0xfffff) << 20)};
+  }
+
+  // the bit of this configuration in a game's signature
+  constexpr std::uint64_t signature() const {
+    // murmur3's finaliser, since keys differ in only a few low bits
+    auto h = _key;
+    h = (h ^ (h >> 33)) * 0xff51afd7ed558ccd;
+    h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53;
+    return std::uint64_t(1) << ((h ^ (h >> 33)) >> 58);
+  }
+
+  std::string to_string() const;
+
+  constexpr bool operator==(const Material &) const = default;
+};
+
+/**
+ * Pawns still on their starting squares, white's a2-h2 as bits 0-7 and
+ * black's a7-h7 as bits 8-15. A pawn that has left its square can never
+ * return, so over a game this only loses bits, and a game can only reach
+ * positions whose home pawns include those of its final position.
+ */
+inline std::uint16_t home_pawns(const chess::Position &pos, bool black) {
+  const auto p = black ? pos.rotated() : pos;
+  const auto pawns = p.extract(chess::PieceType::Pawn) & p.occupied();
+  const auto white = pawns & (black ? ~p.white : p.white), other = pawns & ~white;
+
+  return static_cast<std::uint16_t>(((white >> 8) & 0xff) | ((other >> 40) & 0xff00));
+}
+
+} // cdb::db
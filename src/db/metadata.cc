@@ -0,0 +1,325 @@
+#include "core/logger.hh"
+#include "db/metadata.hh"
+
+#include <algorithm>
+#include <array>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("metadata");
+
+namespace {
+  constexpr std::array<std::size_t, 8> ColumnWidths {4, 2, 2, 2, 2, 1, 8, 2};
+
+  constexpr std::size_t align(std::size_t n) {
+    return (n + MetadataStore::Alignment - 1) & ~(MetadataStore::Alignment - 1);
+  }
+
+  template <class T>
+  std::span<const T> column(std::span<const std::byte> data, unsigned i, std::uint32_t count) {
+    const auto offset = MetadataStore::column_offset(i, count);
+    return {reinterpret_cast<const T *>(data.data() + offset), count};
+  }
+
+  /*
+   * Predicate kernels, each clearing the bits of games that do not match.
+   * Unsigned comparisons are done as x == max(x, min) and x == min(x, max),
+   * since AVX2 only has signed compares.
+   */
+
+  template <class T>
+  std::uint64_t match_scalar(const T *x, std::size_t n, Range<T> r) {
+    std::uint64_t bits = 0;
+    for (std::size_t i = 0; i < n; ++i)
+      bits |= std::uint64_t(r.contains(x[i])) << i;
+
+    return bits;
+  }
+
+#ifdef __AVX2__
+  // 32 bits, one for each of the 32 values at x
+  std::uint32_t match32(const std::uint16_t *x, __m256i lo, __m256i hi) {
+    const auto match = [&] (const std::uint16_t *p) {
+      const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      return _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(v, lo), v),
+                              _mm256_cmpeq_epi16(_mm256_min_epu16(v, hi), v));
+    };
+
+    // packing interleaves the 128 bit lanes, so put them back in order
+    const auto packed = _mm256_packs_epi16(match(x), match(x + 16));
+    return _mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, 0b11011000));
+  }
+
+  std::uint32_t match32(const std::uint32_t *x, __m256i lo, __m256i hi) {
+    std::uint32_t bits = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+      const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + 8 * i));
+      const auto m = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_max_epu32(v, lo), v),
+                                      _mm256_cmpeq_epi32(_mm256_min_epu32(v, hi), v));
+      bits |= std::uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(m))) << (8 * i);
+    }
+
+    return bits;
+  }
+
+  __m256i broadcast(std::uint16_t x) { return _mm256_set1_epi16(x); }
+  __m256i broadcast(std::uint32_t x) { return _mm256_set1_epi32(x); }
+#endif
+
+  template <class T>
+  void and_range(std::span<const T> x, Range<T> r, std::span<std::uint64_t> words) {
+    if (r.all())
+      return;
+
+    std::size_t i = 0;
+
+#ifdef __AVX2__
+    const auto lo = broadcast(r.min), hi = broadcast(r.max);
+    for (; i + 64 <= x.size(); i += 64) {
+      const std::uint64_t bits = match32(x.data() + i, lo, hi)
+                               | std::uint64_t(match32(x.data() + i + 32, lo, hi)) << 32;
+      words[i / 64] &= bits;
+    }
+#endif
+
+    for (; i < x.size(); i += 64)
+      words[i / 64] &= match_scalar(x.data() + i, std::min<std::size_t>(64, x.size() - i), r);
+  }
+
+  // keeps games whose result has its bit set in the results mask
+  void and_results(std::span<const std::uint8_t> x, std::uint8_t results,
+                   std::span<std::uint64_t> words) {
+    if (results == 0xff)
+      return;
+
+    std::size_t i = 0;
+
+#ifdef __AVX2__
+    // results are less than 8, so a byte shuffle can look up their bits
+    std::array<std::uint8_t, 16> table {};
+    for (unsigned j = 0; j < 8; ++j)
+      table[j] = (results >> j) & 1 ? 0xff : 0;
+
+    const auto lookup = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data())));
+
+    for (; i + 64 <= x.size(); i += 64) {
+      const auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x.data() + i));
+      const auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x.data() + i + 32));
+
+      const std::uint64_t bits = std::uint32_t(_mm256_movemask_epi8(_mm256_shuffle_epi8(lookup, v0)))
+                               | std::uint64_t(std::uint32_t(_mm256_movemask_epi8(_mm256_shuffle_epi8(lookup, v1)))) << 32;
+      words[i / 64] &= bits;
+    }
+#endif
+
+    for (; i < x.size(); i += 64) {
+      std::uint64_t bits = 0;
+      for (std::size_t j = 0; j < 64 && i + j < x.size(); ++j)
+        bits |= std::uint64_t((results >> x[i + j]) & 1) << j;
+
+      words[i / 64] &= bits;
+    }
+  }
+
+  // keeps games with every bit of mask set
+  void and_bits(std::span<const std::uint64_t> x, std::uint64_t mask, std::span<std::uint64_t> words) {
+    if (mask == 0)
+      return;
+
+    std::size_t i = 0;
+
+#ifdef __AVX2__
+    const auto m = _mm256_set1_epi64x(static_cast<long long>(mask));
+    for (; i + 64 <= x.size(); i += 64) {
+      std::uint64_t bits = 0;
+      for (unsigned j = 0; j < 16; ++j) {
+        const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x.data() + i + 4 * j));
+        const auto match = _mm256_cmpeq_epi64(_mm256_and_si256(v, m), m);
+        bits |= std::uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(match))) << (4 * j);
+      }
+
+      words[i / 64] &= bits;
+    }
+#endif
+
+    for (; i < x.size(); i += 64) {
+      std::uint64_t bits = 0;
+      for (std::size_t j = 0; j < 64 && i + j < x.size(); ++j)
+        bits |= std::uint64_t((x[i + j] & mask) == mask) << j;
+
+      words[i / 64] &= bits;
+    }
+  }
+
+  // keeps games with no bit of mask set
+  void and_none(std::span<const std::uint16_t> x, std::uint16_t mask, std::span<std::uint64_t> words) {
+    if (mask == 0)
+      return;
+
+    std::size_t i = 0;
+
+#ifdef __AVX2__
+    const auto m = _mm256_set1_epi16(static_cast<short>(mask));
+    const auto none = [&] (const std::uint16_t *p) {
+      const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      return _mm256_cmpeq_epi16(_mm256_and_si256(v, m), _mm256_setzero_si256());
+    };
+
+    for (; i + 64 <= x.size(); i += 64) {
+      std::uint64_t bits = 0;
+      for (unsigned j = 0; j < 2; ++j) {
+        const auto p = x.data() + i + 32 * j;
+        const auto packed = _mm256_packs_epi16(none(p), none(p + 16));
+        bits |= std::uint64_t(std::uint32_t(_mm256_movemask_epi8(
+                  _mm256_permute4x64_epi64(packed, 0b11011000)))) << (32 * j);
+      }
+
+      words[i / 64] &= bits;
+    }
+#endif
+
+    for (; i < x.size(); i += 64) {
+      std::uint64_t bits = 0;
+      for (std::size_t j = 0; j < 64 && i + j < x.size(); ++j)
+        bits |= std::uint64_t((x[i + j] & mask) == 0) << j;
+
+      words[i / 64] &= bits;
+    }
+  }
+}
+
+void GameMetadata::add_tag(std::string_view name, std::string_view value) {
+  const auto id = TagId::from_name(name);
+  const auto packed = TagValue::pack(TagKind::of(id), value);
+  if (!packed)
+    return;
+
+  const auto u16 = static_cast<std::uint16_t>(std::min<std::uint32_t>(*packed, 0xffff));
+
+  switch (id) {
+  case TagId::Date:      date = *packed; break;
+  case TagId::WhiteElo:  white_elo = u16; break;
+  case TagId::BlackElo:  black_elo = u16; break;
+  case TagId::ECO:       eco = u16; break;
+
+  case TagId::Result:    result = *packed; break;
+  default: break;
+  }
+}
+
+std::size_t MetadataStore::column_offset(unsigned column, std::uint32_t count) {
+  std::size_t offset = HeaderSize;
+  for (unsigned i = 0; i < column; ++i)
+    offset += align(ColumnWidths[i] * std::size_t(count));
+
+  return offset;
+}
+
+std::size_t MetadataStore::file_size(std::uint32_t count) {
+  return column_offset(ColumnWidths.size(), count);
+}
+
+Result<MetadataStore> MetadataStore::open(const fs::path &path) {
+  MetadataStore store;
+
+  if (auto ec = store._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = store._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad metadata - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const auto version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad metadata - version {} is not {}", version, Version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  store._count = read_le<4>(data, 12);
+  if (file_size(store._count) > data.size()) {
+    logger.error("bad metadata - {} games do not fit in {} bytes", store._count, data.size());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  store._date      = column<std::uint32_t>(data, 0, store._count);
+  store._white_elo = column<std::uint16_t>(data, 1, store._count);
+  store._black_elo = column<std::uint16_t>(data, 2, store._count);
+  store._eco       = column<std::uint16_t>(data, 3, store._count);
+  store._ply_count = column<std::uint16_t>(data, 4, store._count);
+  store._result    = column<std::uint8_t>(data, 5, store._count);
+  store._material  = column<std::uint64_t>(data, 6, store._count);
+  store._home_pawns = column<std::uint16_t>(data, 7, store._count);
+
+  return store;
+}
+
+roaring_bitmap MetadataStore::select(const MetadataFilter &filter) const {
+  // the kernels work on a flat bitmap, one bit per game, which is then
+  // compressed for combining with other predicates
+  std::vector<std::uint64_t> words((_count + 63) / 64, ~std::uint64_t(0));
+  if (_count % 64)
+    words.back() >>= 64 - _count % 64;
+
+  and_range(_date,      filter.date,      words);
+  and_range(_white_elo, filter.white_elo, words);
+  and_range(_black_elo, filter.black_elo, words);
+  and_range(_eco,       filter.eco,       words);
+  and_range(_ply_count, filter.ply_count, words);
+  and_results(_result,  filter.results,   words);
+  and_bits(_material,   filter.material,  words);
+  and_none(_home_pawns, filter.moved_pawns, words);
+
+  return roaring_bitmap::from_words(words);
+}
+
+std::error_code MetadataBuilder::write(const fs::path &path) const {
+  const std::uint32_t count = _games.size();
+  const auto size = MetadataStore::file_size(count);
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::fill(data, std::byte {0});
+  std::ranges::copy(std::as_bytes(std::span {MetadataStore::Magic}), data.begin());
+  write_le<4>(data, MetadataStore::Version, 8);
+  write_le<4>(data, count, 12);
+
+  const auto put = [&] (unsigned column, auto member) {
+    const auto offset = MetadataStore::column_offset(column, count);
+    const auto width = ColumnWidths[column];
+
+    for (std::uint32_t id = 0; id < count; ++id)
+      write_le<sizeof(_games[id].*member)>(data, static_cast<std::uint64_t>(_games[id].*member),
+                                           offset + width * id);
+  };
+
+  put(0, &GameMetadata::date);
+  put(1, &GameMetadata::white_elo);
+  put(2, &GameMetadata::black_elo);
+  put(3, &GameMetadata::eco);
+  put(4, &GameMetadata::ply_count);
+  put(5, &GameMetadata::result);
+  put(6, &GameMetadata::material);
+  put(7, &GameMetadata::home_pawns);
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote metadata for {} games ({} bytes) to '{}'", count, size,
+              path.lexically_normal().string());
+  return {};
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "core/error.hh"
+#include "core/io.hh"
+#include "db/codec.hh"
+#include "db/material.hh"
+#include "util/roaring.hh"
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace cdb::db {
+
+static_assert(std::endian::native == std::endian::little,
+              "metadata columns are mapped directly and must be little endian");
+
+// the metadata of a game that can be filtered on, with zero meaning unknown
+struct GameMetadata {
+  std::uint32_t date = 0;          // packed as in TagValue::pack_date
+  std::uint16_t white_elo = 0, black_elo = 0;
+  std::uint16_t eco = 0;           // packed as in TagValue::pack_eco
+  std::uint16_t ply_count = 0;
+  std::uint8_t  result = 0;        // chess::GameResult
+  std::uint64_t material = 0;      // signatures of every mainline Material
+  std::uint16_t home_pawns = 0;    // home_pawns() of the final position
+
+  // reads the value of a tag, ignoring tags that are not stored. the ply
+  // count is always counted from the moves, never taken from a PlyCount tag.
+  void add_tag(std::string_view name, std::string_view value);
+};
+
+template <class T>
+struct Range {
+  T min = 0, max = std::numeric_limits<T>::max();
+
+  constexpr bool all() const { return min == 0 && max == std::numeric_limits<T>::max(); }
+  constexpr bool contains(T x) const { return min <= x && x <= max; }
+};
+
+struct MetadataFilter {
+  Range<std::uint32_t> date;
+  Range<std::uint16_t> white_elo, black_elo, eco, ply_count;
+
+  // bit i is set if chess::GameResult i is accepted
+  std::uint8_t results = 0xff;
+
+  // signature bits that must all be set, see Material
+  std::uint64_t material = 0;
+
+  // home pawns, as in db::home_pawns, that must have moved by the end
+  std::uint16_t moved_pawns = 0;
+
+  static constexpr std::uint32_t year(unsigned y) { return y << 9; }
+
+  // dates between the start of first_year and the end of last_year
+  MetadataFilter &years(unsigned first_year, unsigned last_year) {
+    date = {year(first_year), year(last_year + 1) - 1};
+    return *this;
+  }
+
+  MetadataFilter &decisive() {
+    results = 1 << int(chess::GameResult::White) | 1 << int(chess::GameResult::Black);
+    return *this;
+  }
+
+  // games that may reach the material configuration at some point
+  MetadataFilter &reaches(const Material &m) {
+    material |= m.signature();
+    return *this;
+  }
+
+  // whether the filter accepts every game
+  bool all() const {
+    return date.all() && white_elo.all() && black_elo.all() && eco.all() && ply_count.all()
+           && results == 0xff && material == 0 && moved_pawns == 0;
+  }
+
+  // checks one game, as MetadataStore::select does for every game
+  bool matches(const GameMetadata &game) const {
+    return date.contains(game.date) && white_elo.contains(game.white_elo)
+           && black_elo.contains(game.black_elo) && eco.contains(game.eco)
+           && ply_count.contains(game.ply_count) && (results >> game.result & 1)
+           && (game.material & material) == material && (game.home_pawns & moved_pawns) == 0;
+  }
+};
+
+/**
+ * Game metadata stored column-wise in a file next to the database, so that
+ * filtering games only has to scan a few small arrays instead of decoding
+ * every game's tags:
+ *
+ *  header (32 bytes)
+ *    magic "cdbmeta\0", u32 version, u32 game count, u64 reserved x 2
+ *  u32 date[count]
+ *  u16 white_elo[count], u16 black_elo[count], u16 eco[count], u16 ply_count[count]
+ *  u8  result[count]
+ *  u64 material[count]
+ *  u16 home_pawns[count]
+ *
+ * Each column is indexed by game id and starts on a 32 byte boundary.
+ */
+class MetadataStore {
+public:
+  static constexpr std::string_view Magic {"cdbmeta\0", 8};
+  static constexpr std::size_t HeaderSize = 32;
+  static constexpr std::size_t Alignment = 32;
+  static constexpr std::uint32_t Version = 2;
+
+private:
+  io::mm_file _file;
+  std::uint32_t _count = 0;
+
+  std::span<const std::uint32_t> _date;
+  std::span<const std::uint16_t> _white_elo, _black_elo, _eco, _ply_count;
+  std::span<const std::uint8_t> _result;
+  std::span<const std::uint64_t> _material;
+  std::span<const std::uint16_t> _home_pawns;
+
+public:
+  MetadataStore() = default;
+
+  static Result<MetadataStore> open(const fs::path &path);
+
+  // offset and total size of the columns for a number of games
+  static std::size_t column_offset(unsigned column, std::uint32_t count);
+  static std::size_t file_size(std::uint32_t count);
+
+  bool is_open() const { return _file.is_open(); }
+  std::uint32_t size() const { return _count; }
+
+  GameMetadata operator[](std::uint32_t id) const {
+    return {_date[id], _white_elo[id], _black_elo[id], _eco[id], _ply_count[id], _result[id],
+            _material[id], _home_pawns[id]};
+  }
+
+  // games matching every part of the filter
+  roaring_bitmap select(const MetadataFilter &filter) const;
+};
+
+class MetadataBuilder {
+private:
+  std::vector<GameMetadata> _games;
+
+public:
+  void push(const GameMetadata &game) { _games.push_back(game); }
+  std::uint32_t size() const { return _games.size(); }
+
+  std::error_code write(const fs::path &path) const;
+};
+
+} // cdb::db
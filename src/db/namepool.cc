@@ -0,0 +1,147 @@
+#include "core/logger.hh"
+#include "db/namepool.hh"
+#include "util/komihash.hh"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("names");
+
+namespace {
+  std::uint64_t hash(std::string_view name) {
+    return komihash(std::as_bytes(std::span {name}), 0);
+  }
+}
+
+Result<NamePool> NamePool::open(const fs::path &path) {
+  NamePool pool;
+
+  if (auto ec = pool._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = pool._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad name pool - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad name pool - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  pool._count    = read_le<4>(data, 12);
+  pool._capacity = read_le<4>(data, 16);
+
+  const std::size_t offsets_size = 4 * (std::size_t(pool._count) + 1);
+  const std::size_t index_size   = 4 * std::size_t(pool._capacity);
+  const std::size_t heap_size    = read_le<8>(data, 24);
+
+  if (!std::has_single_bit(pool._capacity) || pool._capacity < 2 * pool._count
+      || HeaderSize + offsets_size + index_size + heap_size > data.size()) {
+    logger.error("bad name pool - {} names do not fit in {} bytes", pool._count, data.size());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  pool._offsets = data.subspan(HeaderSize, offsets_size);
+  pool._index   = data.subspan(HeaderSize + offsets_size, index_size);
+  pool._heap    = data.subspan(HeaderSize + offsets_size + index_size, heap_size);
+
+  // name() and find() trust the offsets and index, so check them once here
+  std::uint32_t prev = 0;
+  for (std::uint32_t id = 0; id <= pool._count; ++id) {
+    const auto offset = read_le<4>(pool._offsets, 4 * id);
+    if ((id == 0 && offset != 0) || offset < prev || offset > heap_size) {
+      logger.error("bad name pool - offset of name {} is out of order or outside the heap", id);
+      return std::unexpected(DbError::Corrupted);
+    }
+
+    prev = offset;
+  }
+
+  for (std::uint32_t i = 0; i < pool._capacity; ++i) {
+    if (read_le<4>(pool._index, 4 * i) > pool._count) {
+      logger.error("bad name pool - index slot {} refers to a missing name", i);
+      return std::unexpected(DbError::Corrupted);
+    }
+  }
+
+  return pool;
+}
+
+std::optional<std::uint32_t> NamePool::find(std::string_view name) const {
+  const auto mask = _capacity - 1;
+
+  for (auto i = hash(name) & mask; ; i = (i + 1) & mask) {
+    const auto slot = read_le<4>(_index, 4 * i);
+    if (slot == 0)
+      return std::nullopt;
+
+    if (this->name(slot - 1) == name)
+      return slot - 1;
+  }
+}
+
+std::error_code NamePoolBuilder::write(const fs::path &path) const {
+  const std::uint32_t count = _names.size();
+  const std::uint32_t capacity = std::bit_ceil(std::max(2 * count, 16u));
+
+  if (_heap_size > std::numeric_limits<std::uint32_t>::max()) {
+    logger.error("{} bytes of names do not fit in a name pool", _heap_size);
+    return DbError::OutOfMemory;
+  }
+
+  const std::size_t offsets_size = 4 * (std::size_t(count) + 1);
+  const std::size_t index_size   = 4 * std::size_t(capacity);
+  const std::size_t size = NamePool::HeaderSize + offsets_size + index_size + _heap_size;
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::copy(std::as_bytes(std::span {NamePool::Magic}), data.begin());
+  write_le<4>(data, NamePool::Version, 8);
+  write_le<4>(data, count, 12);
+  write_le<4>(data, capacity, 16);
+  write_le<4>(data, 0u, 20);
+  write_le<8>(data, _heap_size, 24);
+
+  auto offsets = data.subspan(NamePool::HeaderSize, offsets_size);
+  auto index   = data.subspan(NamePool::HeaderSize + offsets_size, index_size);
+  auto heap    = data.subspan(NamePool::HeaderSize + offsets_size + index_size);
+
+  std::ranges::fill(index, std::byte {0});
+
+  std::uint32_t offset = 0;
+  for (std::uint32_t id = 0; id < count; ++id) {
+    const auto name = _names[id];
+
+    write_le<4>(offsets, offset, 4 * id);
+    std::ranges::copy(std::as_bytes(std::span {name}), heap.begin() + offset);
+    offset += name.size();
+
+    auto i = hash(name) & (capacity - 1);
+    while (read_le<4>(index, 4 * i))
+      i = (i + 1) & (capacity - 1);
+
+    write_le<4>(index, id + 1, 4 * i);
+  }
+
+  write_le<4>(offsets, offset, 4 * count);
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote {} names ({} bytes) to '{}'", count, size, path.lexically_normal().string());
+  return {};
+}
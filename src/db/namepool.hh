@@ -0,0 +1,89 @@
+#pragma once
+
+#include "core/error.hh"
+#include "core/io.hh"
+#include "util/bits.hh"
+
+#include <cassert>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * Interned player, event and site names, stored in a file next to the
+ * database:
+ *
+ *  header (32 bytes)
+ *    magic "cdbnames", u32 version, u32 count, u32 index capacity,
+ *    u32 reserved, u64 heap size
+ *  u32 offsets[count + 1]   start of each name in the heap
+ *  u32 index[capacity]      open addressing hash index, id + 1 or 0 if empty
+ *  heap                     name bytes
+ */
+class NamePool {
+public:
+  static constexpr std::string_view Magic = "cdbnames";
+  static constexpr std::uint32_t Version = 0;
+  static constexpr std::size_t HeaderSize = 32;
+
+private:
+  io::mm_file _file;
+  std::uint32_t _count = 0, _capacity = 0;
+  std::span<const std::byte> _offsets, _index, _heap;
+
+public:
+  NamePool() = default;
+
+  static Result<NamePool> open(const fs::path &path);
+
+  bool is_open() const { return _file.is_open(); }
+  std::uint32_t size() const { return _count; }
+
+  std::string_view name(std::uint32_t id) const {
+    assert(id < _count);
+
+    const auto start = read_le<4>(_offsets, 4 * id);
+    const auto end   = read_le<4>(_offsets, 4 * id + 4);
+    return {reinterpret_cast<const char *>(_heap.data()) + start, end - start};
+  }
+
+  std::optional<std::uint32_t> find(std::string_view name) const;
+};
+
+class NamePoolBuilder {
+private:
+  // lets intern() look names up without building a string first
+  struct NameHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view name) const { return std::hash<std::string_view> {}(name); }
+  };
+
+  std::unordered_map<std::string, std::uint32_t, NameHash, std::equal_to<>> _ids;
+  std::vector<std::string_view> _names;
+  std::size_t _heap_size = 0;
+
+public:
+  // returns the id of the name, adding it to the pool if it is new
+  std::uint32_t intern(std::string_view name) {
+    if (const auto it = _ids.find(name); it != _ids.end())
+      return it->second;
+
+    const auto it = _ids.emplace(name, _names.size()).first;
+    _names.emplace_back(it->first);
+    _heap_size += name.size();
+
+    return it->second;
+  }
+
+  std::uint32_t size() const { return _names.size(); }
+
+  std::error_code write(const fs::path &path) const;
+};
+
+} // cdb::db
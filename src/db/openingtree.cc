@@ -0,0 +1,323 @@
+#include "chess/pgn.hh"
+#include "core/logger.hh"
+#include "db/codec.hh"
+#include "db/openingtree.hh"
+#include "db/positionindex.hh"
+#include "util/bytesize.hh"
+
+#include <algorithm>
+#include <concepts>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("openingtree");
+
+Result<OpeningTree> OpeningTree::open(const fs::path &path) {
+  OpeningTree tree;
+
+  if (auto ec = tree._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = tree._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad opening tree - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad opening tree - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  const std::uint32_t count = read_le<4>(data, 12);
+  const std::size_t table_size = read_le<8>(data, 16);
+  const std::size_t no_moves   = read_le<8>(data, 24);
+
+  if (HeaderSize + table_size + no_moves * MoveSize > data.size()) {
+    logger.error("bad opening tree - {} positions do not fit in {} bytes", count, data.size());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  auto table = Table::open(data.subspan(HeaderSize, table_size));
+  if (!table || table->size() != count) {
+    logger.error("bad opening tree - corrupted table");
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  tree._table = *table;
+  tree._moves = data.subspan(HeaderSize + table_size, no_moves * MoveSize);
+
+  return tree;
+}
+
+std::vector<MoveStats> OpeningTree::moves(std::uint64_t key) const {
+  const auto range = _table.find(key);
+  if (!range || std::size_t(range->first) + range->count > _moves.size() / MoveSize)
+    return {};
+
+  std::vector<MoveStats> moves;
+  moves.reserve(range->count);
+
+  for (std::size_t i = range->first; i < range->first + range->count; ++i) {
+    const auto data = _moves.subspan(MoveSize * i, MoveSize);
+    const std::uint32_t rated   = read_le<4>(data, 20);
+    const std::uint64_t elo_sum = read_le<8>(data, 24);
+
+    moves.push_back({
+      .move        = Token::decode(read_le<2>(data, 0)),
+      .games       = read_le<4>(data, 4),
+      .white_wins  = read_le<4>(data, 8),
+      .draws       = read_le<4>(data, 12),
+      .black_wins  = read_le<4>(data, 16),
+      .average_elo = static_cast<std::uint16_t>(rated ? elo_sum / rated : 0),
+      .last_year   = read_le<2>(data, 2),
+    });
+  }
+
+  return moves;
+}
+
+std::vector<MoveStats> OpeningTree::moves(const chess::Position &pos, bool black) const {
+  return moves(PositionIndex::key(pos, black));
+}
+
+OpeningTreeBuilder::Counts &OpeningTreeBuilder::Counts::operator+=(const Counts &other) {
+  games      += other.games;
+  white_wins += other.white_wins;
+  draws      += other.draws;
+  black_wins += other.black_wins;
+  rated      += other.rated;
+  last_year   = std::max(last_year, other.last_year);
+  elo_sum    += other.elo_sum;
+  return *this;
+}
+
+namespace {
+  using Key = OpeningTreeBuilder::Key;
+  using Counts = OpeningTreeBuilder::Counts;
+  using Entry = OpeningTreeBuilder::Entry;
+  constexpr auto RunEntrySize = OpeningTreeBuilder::RunEntrySize;
+
+  // a move as stored in the tree file, at offset in out
+  void write_move(std::span<std::byte> out, std::size_t offset, std::uint16_t move, const Counts &counts) {
+    write_le<2>(out, move,              offset);
+    write_le<2>(out, counts.last_year,  offset + 2);
+    write_le<4>(out, counts.games,      offset + 4);
+    write_le<4>(out, counts.white_wins, offset + 8);
+    write_le<4>(out, counts.draws,      offset + 12);
+    write_le<4>(out, counts.black_wins, offset + 16);
+    write_le<4>(out, counts.rated,      offset + 20);
+    write_le<8>(out, counts.elo_sum,    offset + 24);
+  }
+
+  Entry read_entry(std::span<const std::byte> run, std::size_t i) {
+    const auto offset = i * RunEntrySize;
+    const auto move = run.subspan(offset + 8, OpeningTree::MoveSize);
+
+    return {{read_le<8>(run, offset), read_le<2>(move, 0)}, {
+      .games      = read_le<4>(move, 4),
+      .white_wins = read_le<4>(move, 8),
+      .draws      = read_le<4>(move, 12),
+      .black_wins = read_le<4>(move, 16),
+      .rated      = read_le<4>(move, 20),
+      .last_year  = read_le<2>(move, 2),
+      .elo_sum    = read_le<8>(move, 24),
+    }};
+  }
+
+  // merges the spilled runs and the sorted in-memory tail, summing the
+  // counts of equal pairs, and calls fn with each position's moves
+  void merge_runs(std::span<const std::span<const std::byte>> runs, std::span<const Entry> tail,
+                  std::invocable<std::uint64_t, std::span<Entry>> auto fn) {
+    const auto count = [&] (std::size_t source) {
+      return source < runs.size() ? runs[source].size() / RunEntrySize : tail.size();
+    };
+
+    const auto at = [&] (std::size_t source, std::size_t i) {
+      return source < runs.size() ? read_entry(runs[source], i) : tail[i];
+    };
+
+    struct Cursor {
+      Entry entry;
+      std::size_t source, next;
+    };
+
+    const auto greater = [] (const Cursor &a, const Cursor &b) { return a.entry.first > b.entry.first; };
+
+    std::vector<Cursor> heap;
+    for (std::size_t source = 0; source <= runs.size(); ++source)
+      if (count(source))
+        heap.push_back({at(source, 0), source, 1});
+
+    std::ranges::make_heap(heap, greater);
+
+    std::vector<Entry> group;
+    while (!heap.empty()) {
+      std::ranges::pop_heap(heap, greater);
+      auto &cursor = heap.back();
+      const auto &[key, counts] = cursor.entry;
+
+      if (!group.empty() && group.back().first.position != key.position) {
+        fn(group.back().first.position, std::span {group});
+        group.clear();
+      }
+
+      if (!group.empty() && group.back().first == key)
+        group.back().second += counts;
+      else
+        group.push_back(cursor.entry);
+
+      if (cursor.next < count(cursor.source)) {
+        cursor.entry = at(cursor.source, cursor.next++);
+        std::ranges::push_heap(heap, greater);
+      } else
+        heap.pop_back();
+    }
+
+    if (!group.empty())
+      fn(group.back().first.position, std::span {group});
+  }
+}
+
+void OpeningTreeBuilder::add(const Key &key, const Counts &counts) {
+  _moves[key] += counts;
+
+  if (_moves.size() >= _run_size)
+    spill();
+}
+
+void OpeningTreeBuilder::add(const chess::Position &pos, bool black, chess::Move move,
+                             const GameMetadata &game) {
+  const auto result = static_cast<chess::GameResult>(game.result);
+  const auto elo = black ? game.black_elo : game.white_elo;
+
+  add({PositionIndex::key(pos, black), Token::encode(move)}, {
+    .games      = 1,
+    .white_wins = result == chess::GameResult::White,
+    .draws      = result == chess::GameResult::Draw,
+    .black_wins = result == chess::GameResult::Black,
+    .rated      = elo != 0,
+    .last_year  = static_cast<std::uint16_t>(game.date >> 9),
+    .elo_sum    = elo,
+  });
+}
+
+void OpeningTreeBuilder::spill() {
+  std::vector<Entry> moves {_moves.begin(), _moves.end()};
+  std::ranges::sort(moves, {}, &Entry::first);
+  _moves.clear();
+
+  std::error_code ec;
+  const auto dir = fs::temp_directory_path(ec);
+  const auto path = dir / std::format("cdb_moves_{}_{}.run", static_cast<const void *>(this), _runs.size());
+
+  io::mm_file run;
+  if (!ec)
+    ec = run.open(path, moves.size() * RunEntrySize, true);
+
+  if (ec) {
+    logger.error("failed to spill {} moves to '{}' ({})", moves.size(),
+                 path.lexically_normal().string(), ec.message());
+    _error = ec;
+    return;
+  }
+
+  auto data = run.mutable_span();
+  for (std::size_t i = 0; i < moves.size(); ++i) {
+    const auto &[key, counts] = moves[i];
+    write_le<8>(data, key.position, i * RunEntrySize);
+    write_move(data, i * RunEntrySize + 8, key.move, counts);
+  }
+
+  logger.debug("spilled run {} ({} moves)", _runs.size(), moves.size());
+  _runs.push_back(std::move(run));
+}
+
+void OpeningTreeBuilder::merge(OpeningTreeBuilder &&other) {
+  if (!_error)
+    _error = other._error;
+
+  std::ranges::move(other._runs, std::back_inserter(_runs));
+  other._runs.clear();
+
+  for (const auto &[key, counts] : other._moves)
+    add(key, counts);
+
+  other._moves = {};
+}
+
+std::error_code OpeningTreeBuilder::write(const fs::path &path) {
+  if (_error)
+    return _error;
+
+  std::vector<Entry> tail {_moves.begin(), _moves.end()};
+  std::ranges::sort(tail, {}, &Entry::first);
+  _moves = {};
+
+  std::vector<std::span<const std::byte>> runs;
+  for (const auto &run : _runs)
+    runs.push_back(run.span());
+
+  // the first merge finds each position's range of moves, the second writes
+  // them once the file has been allocated
+  std::vector<std::pair<std::uint64_t, OpeningTree::MoveRange>> ranges;
+  std::size_t no_moves = 0;
+
+  merge_runs(runs, tail, [&] (std::uint64_t position, std::span<Entry> moves) {
+    ranges.push_back({position, {static_cast<std::uint32_t>(no_moves), static_cast<std::uint32_t>(moves.size())}});
+    no_moves += moves.size();
+  });
+
+  if (no_moves > std::numeric_limits<std::uint32_t>::max()) {
+    logger.error("{} moves do not fit in an opening tree", no_moves);
+    return DbError::OutOfMemory;
+  }
+
+  const std::size_t table_size = OpeningTree::Table::bytes(ranges.size());
+  const std::size_t size = OpeningTree::HeaderSize + table_size + OpeningTree::MoveSize * no_moves;
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::copy(std::as_bytes(std::span {OpeningTree::Magic}), data.begin());
+  write_le<4>(data, OpeningTree::Version, 8);
+  write_le<4>(data, static_cast<std::uint32_t>(ranges.size()), 12);
+  write_le<8>(data, table_size, 16);
+  write_le<8>(data, std::uint64_t(no_moves), 24);
+
+  OpeningTree::Table::build(data.subspan(OpeningTree::HeaderSize, table_size), ranges);
+
+  // each position's moves form a run, most played first
+  auto out = data.subspan(OpeningTree::HeaderSize + table_size);
+  std::size_t i = 0;
+  merge_runs(runs, tail, [&] (std::uint64_t, std::span<Entry> moves) {
+    std::ranges::sort(moves, [] (const Entry &a, const Entry &b) {
+      return std::tie(b.second.games, a.first.move) < std::tie(a.second.games, b.first.move);
+    });
+
+    for (const auto &[key, counts] : moves)
+      write_move(out, OpeningTree::MoveSize * i++, key.move, counts);
+  });
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote {} moves from {} positions ({} runs) to '{}' ({})", no_moves, ranges.size(), _runs.size(),
+              path.lexically_normal().string(), best_size_unit {size});
+
+  _runs.clear();
+  return {};
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "chess/movegen.hh"
+#include "chess/position.hh"
+#include "core/error.hh"
+#include "core/io.hh"
+#include "db/hashtable.hh"
+#include "db/metadata.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cdb::db {
+
+// the games that played a move from a position
+struct MoveStats {
+  chess::Move move;
+  std::uint32_t games = 0;
+  std::uint32_t white_wins = 0, draws = 0, black_wins = 0;
+  std::uint16_t average_elo = 0;  // of the player making the move, zero if none are rated
+  std::uint16_t last_year = 0;    // zero if no game is dated
+};
+
+/**
+ * Precomputed statistics of every move played from every mainline position up
+ * to a maximum ply, stored in a file next to the database:
+ *
+ *  header (32 bytes)
+ *    magic "cdbmoves", u32 version, u32 position count, u64 table size,
+ *    u64 move count
+ *  table   HashTable from position key (as in PositionIndex::key) to the
+ *          first and number of the position's moves
+ *  moves   32 bytes each, sorted by number of games within a position:
+ *            u16 move token, u16 last year, u32 games, u32 white wins,
+ *            u32 draws, u32 black wins, u32 rated games, u64 Elo sum
+ *
+ * so a lookup is one probe followed by a read of one contiguous run.
+ */
+class OpeningTree {
+public:
+  static constexpr std::string_view Magic = "cdbmoves";
+  static constexpr std::uint32_t Version = 0;
+  static constexpr std::size_t HeaderSize = 32;
+  static constexpr std::size_t MoveSize = 32;
+
+  struct MoveRange {
+    std::uint32_t first, count;
+  };
+
+  using Table = HashTable<std::uint64_t, MoveRange, IdentityHash>;
+
+private:
+  io::mm_file _file;
+  Table _table;
+  std::span<const std::byte> _moves;
+
+public:
+  OpeningTree() = default;
+
+  static Result<OpeningTree> open(const fs::path &path);
+
+  bool is_open() const { return _file.is_open(); }
+
+  // number of distinct positions
+  std::uint32_t size() const { return _table.size(); }
+
+  // moves played from the position, most played first, with moves relative
+  // to the side to move as in chess::Position
+  std::vector<MoveStats> moves(std::uint64_t key) const;
+  std::vector<MoveStats> moves(const chess::Position &pos, bool black) const;
+};
+
+/**
+ * Accumulates move statistics into a hash table of at most run_size
+ * (position, move) pairs. When the table fills, it is sorted and spilled to
+ * a temporary file as a run of partial counts, so memory stays bounded no
+ * matter how many distinct positions the games reach. Builders filled from
+ * separate threads are merged before writing, and write() merges the runs,
+ * summing the counts of pairs that appear in several.
+ */
+class OpeningTreeBuilder {
+public:
+  struct Counts {
+    std::uint32_t games = 0, white_wins = 0, draws = 0, black_wins = 0, rated = 0;
+    std::uint16_t last_year = 0;
+    std::uint64_t elo_sum = 0;
+
+    Counts &operator+=(const Counts &other);
+  };
+
+  struct Key {
+    std::uint64_t position;
+    std::uint16_t move;
+
+    constexpr auto operator<=>(const Key &) const = default;
+  };
+
+  using Entry = std::pair<Key, Counts>;
+
+  // bytes per pair in a spilled run: u64 position, then a move as in
+  // OpeningTree's moves
+  static constexpr std::size_t RunEntrySize = 8 + OpeningTree::MoveSize;
+
+  // 1M pairs, about 80 MiB of hash table per builder
+  static constexpr std::size_t DefaultRunSize = std::size_t(1) << 20;
+
+private:
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      return key.position ^ (key.move * 0x9e3779b97f4a7c15);
+    }
+  };
+
+  std::size_t _run_size;
+  std::unordered_map<Key, Counts, KeyHash> _moves;
+  std::vector<io::mm_file> _runs;
+
+  // set if a run could not be spilled, and returned by write()
+  std::error_code _error;
+
+  void add(const Key &key, const Counts &counts);
+  void spill();
+
+public:
+  explicit OpeningTreeBuilder(std::size_t run_size = DefaultRunSize)
+    : _run_size(std::max<std::size_t>(run_size, 1))
+  {
+  }
+
+  // adds a move played from the position in a game with the given metadata
+  void add(const chess::Position &pos, bool black, chess::Move move, const GameMetadata &game);
+
+  void merge(OpeningTreeBuilder &&other);
+
+  // pairs held in memory, and runs spilled to disk
+  std::size_t size() const { return _moves.size(); }
+  std::size_t runs() const { return _runs.size(); }
+
+  std::error_code write(const fs::path &path);
+};
+
+} // cdb::db
@@ -5,6 +5,9 @@
 #include "util/iterator.hh"
 #include "util/komihash.hh"
 
+#include <concepts>
+#include <limits>
+
 namespace cdb::db {
 
 namespace detail {
@@ -19,18 +22,35 @@ namespace detail {
 using GameView = detail::GameSpan<true>;
 using GameSpan = detail::GameSpan<false>;
 
+constexpr std::size_t PageSize = 1 << 15;
+
 struct PageHeader {
-  static constexpr std::size_t Size = 8;
+  static constexpr std::size_t Size = 16;
 
   std::uint16_t size, cursor; // 2 bytes each
   std::uint32_t checksum;     // 4 bytes
+  std::uint32_t first_game;   // 4 bytes
+  std::uint16_t no_games;     // 2 bytes (+2 reserved)
 
   PageHeader(std::span<std::byte, PageHeader::Size> data)
-    : size(read_le<2>(data)), cursor(read_le<2>(data, 2)), checksum(read_le<4>(data, 4))
+    : size(read_le<2>(data)), cursor(read_le<2>(data, 2)), checksum(read_le<4>(data, 4)),
+      first_game(read_le<4>(data, 8)), no_games(read_le<2>(data, 12))
   {
   }
+
+  void write(std::span<std::byte, PageHeader::Size> data) const {
+    write_le<2>(data, size);
+    write_le<2>(data, cursor, 2);
+    write_le<4>(data, checksum, 4);
+    write_le<4>(data, first_game, 8);
+    write_le<2>(data, no_games, 12);
+    write_le<2>(data, 0u, 14);
+  }
 };
 
+// largest record that fits in an empty page
+constexpr std::size_t MaxRecordSize = PageSize - PageHeader::Size;
+
 class Page {
 private:
   std::span<std::byte> _data;
@@ -41,19 +61,24 @@ private:
 
 
 public:
-  Page(std::span<std::byte> data, bool init)
+  Page(std::span<std::byte> data, bool init, std::uint32_t first_game = 0)
     : _data(data), _hdr(data.first<PageHeader::Size>()), _idx(data.subspan(PageHeader::Size), init)
   {
     if (init) {
-      _hdr.size     = data.size();
-      _hdr.cursor   = 0;
-      _hdr.checksum = 0;
+      _hdr.size       = data.size();
+      _hdr.cursor     = 0;
+      _hdr.checksum   = 0;
+      _hdr.first_game = first_game;
+      _hdr.no_games   = 0;
+      _changed        = true;
     }
   }
 
   std::size_t size() const { return _hdr.size; }
   std::size_t cursor() const { return _hdr.cursor; }
   std::uint32_t checksum() const { return _hdr.checksum; }
+  std::uint32_t first_game() const { return _hdr.first_game; }
+  std::uint32_t no_games() const { return _hdr.no_games; }
   std::uint32_t actual_checksum() const {
     // todo: refactor this to use std::span::last
     return komihash(_data.subspan(PageHeader::Size,
@@ -63,6 +88,13 @@ public:
   bool changed() const { return _changed; }
   void mark_changed(bool b = true) { _changed = b; }
 
+  // points the page at the same bytes in a new place, such as the file
+  // mapped again after it grew
+  void move_to(std::span<std::byte> data) {
+    _idx.move_to(_data.subspan(PageHeader::Size), data.subspan(PageHeader::Size));
+    _data = data;
+  }
+
   /**
    * @brief Compute new checksum & write page header data to memory.
    * 
@@ -70,15 +102,50 @@ public:
    */
   std::uint32_t commit() {
     _hdr.checksum = actual_checksum();
-
-    write_le<2>(_data, _hdr.size);
-    write_le<2>(_data, _hdr.cursor);
-    write_le<4>(_data, _hdr.checksum);
+    _hdr.write(_data.first<PageHeader::Size>());
 
     mark_changed(false);
     return _hdr.checksum;
   }
 
+  /**
+   * @brief Append a game record to the end of the page.
+   *
+   * @return false if there is not enough space left in the page
+   */
+  bool append(std::span<const std::byte> record) {
+    if (_hdr.no_games == std::numeric_limits<decltype(_hdr.no_games)>::max())
+      return false;
+
+    const int i = _idx.find_space_and_split(record.size());
+    if (i == -1)
+      return false;
+
+    _idx.write(i, record);
+    _hdr.cursor += record.size();
+    _hdr.no_games += 1;
+
+    mark_changed();
+    return true;
+  }
+
+  // calls fn with the id and record of each game in the page, in order
+  void for_each_record(std::invocable<std::uint32_t, std::span<const std::byte>> auto fn) const {
+    std::uint32_t id = _hdr.first_game;
+
+    for (std::size_t i = 0; i < _idx.size(); ++i) {
+      // deleted games keep their ids, free space has none
+      const auto md = _idx.metadata(i);
+      if (md == Metadata::Empty)
+        continue;
+
+      if (md != Metadata::Deleted)
+        fn(id, _idx.record(i));
+
+      ++id;
+    }
+  }
+
 public:
   class GameIterator : public iterator_facade<GameIterator, GameSpan> {
   private:
@@ -0,0 +1,179 @@
+#include "core/logger.hh"
+#include "db/pagefilter.hh"
+#include "util/bits.hh"
+#include "util/bytesize.hh"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("pagefilter");
+
+namespace {
+  constexpr unsigned BlockBits = 64 * PageFilters::BlockWords;
+  constexpr unsigned MaxHashes = 7;
+
+  std::uint32_t block_of(std::uint64_t key, std::uint32_t no_blocks) {
+    return static_cast<std::uint32_t>(((key >> 32) * no_blocks) >> 32);
+  }
+
+  // calls fn with the bits of the key in its block, using 9 bits of a
+  // remixed key for each, since the block was chosen with the high bits
+  template <class F>
+  void for_each_bit(std::uint64_t key, unsigned hashes, F &&fn) {
+    const auto h = key * 0x9e3779b97f4a7c15;
+    for (unsigned i = 0; i < hashes; ++i)
+      fn(static_cast<unsigned>((h >> (9 * i)) % BlockBits));
+  }
+}
+
+PageFilters::PageFilters(unsigned bits_per_key)
+  : _bits_per_key(bits_per_key),
+    _hashes(std::clamp(static_cast<unsigned>(std::lround(0.69 * bits_per_key)), 1u, MaxHashes))
+{
+}
+
+PageFilters &PageFilters::operator=(PageFilters &&other) {
+  _bits_per_key    = other._bits_per_key;
+  _hashes          = other._hashes;
+  _pages           = std::move(other._pages);
+  _tested          = other._tested.load();
+  _skipped         = other._skipped.load();
+  _false_positives = other._false_positives.load();
+  return *this;
+}
+
+void PageFilters::build(std::uint32_t page_no, std::span<const std::uint64_t> keys) {
+  if (no_pages() <= page_no)
+    _pages.resize(page_no + 1);
+
+  std::vector<std::uint64_t> unique {keys.begin(), keys.end()};
+  std::ranges::sort(unique);
+  unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+  const auto no_blocks = static_cast<std::uint32_t>(
+    std::max<std::size_t>(1, (unique.size() * _bits_per_key + BlockBits - 1) / BlockBits));
+
+  auto &blocks = _pages[page_no];
+  blocks.assign(no_blocks, Block {});
+
+  for (const auto key : unique) {
+    auto &block = blocks[block_of(key, no_blocks)];
+    for_each_bit(key, _hashes, [&] (unsigned bit) { block[bit / 64] |= std::uint64_t(1) << (bit % 64); });
+  }
+}
+
+bool PageFilters::may_contain(std::uint32_t page_no, std::uint64_t key) const {
+  if (!enabled() || page_no >= no_pages() || _pages[page_no].empty())
+    return true;
+
+  ++_tested;
+
+  const auto &blocks = _pages[page_no];
+  const auto &block = blocks[block_of(key, blocks.size())];
+
+  bool found = true;
+  for_each_bit(key, _hashes, [&] (unsigned bit) { found &= (block[bit / 64] >> (bit % 64)) & 1; });
+
+  _skipped += !found;
+  return found;
+}
+
+Result<PageFilters> PageFilters::open(const fs::path &path) {
+  io::mm_file file;
+  if (auto ec = file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad page filters - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad page filters - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  const std::uint32_t bits_per_key = read_le<4>(data, 12);
+  const std::uint32_t no_pages     = read_le<4>(data, 16);
+  const std::uint64_t no_blocks    = read_le<8>(data, 24);
+
+  const auto blocks_offset = HeaderSize + 4 * (std::size_t(no_pages) + 1);
+  if (blocks_offset + no_blocks * sizeof(Block) > data.size()) {
+    logger.error("bad page filters - {} pages do not fit in {} bytes", no_pages, data.size());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  // blocks of page i are [first[i], first[i + 1])
+  std::vector<std::uint32_t> first(no_pages + 1);
+  for (std::size_t i = 0; i <= no_pages; ++i)
+    first[i] = read_le<4>(data, HeaderSize + 4 * i);
+
+  if (first.front() != 0 || first.back() != no_blocks || !std::ranges::is_sorted(first)) {
+    logger.error("bad page filters - corrupted page offsets");
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  PageFilters filters {bits_per_key};
+  filters._pages.resize(no_pages);
+  for (std::uint32_t page_no = 0; page_no < no_pages; ++page_no) {
+    auto &blocks = filters._pages[page_no];
+    blocks.resize(first[page_no + 1] - first[page_no]);
+
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+      for (std::size_t j = 0; j < BlockWords; ++j)
+        blocks[i][j] = read_le<8>(data, blocks_offset + sizeof(Block) * (first[page_no] + i) + 8 * j);
+  }
+
+  return filters;
+}
+
+std::error_code PageFilters::write(const fs::path &path) const {
+  std::size_t no_blocks = 0;
+  for (const auto &blocks : _pages)
+    no_blocks += blocks.size();
+
+  const auto blocks_offset = HeaderSize + 4 * (_pages.size() + 1);
+  const auto size = blocks_offset + sizeof(Block) * no_blocks;
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::fill(data.first(HeaderSize), std::byte {0});
+  std::ranges::copy(std::as_bytes(std::span {Magic}), data.begin());
+  write_le<4>(data, Version, 8);
+  write_le<4>(data, _bits_per_key, 12);
+  write_le<4>(data, no_pages(), 16);
+  write_le<8>(data, std::uint64_t(no_blocks), 24);
+
+  std::uint32_t first = 0;
+  for (std::uint32_t page_no = 0; page_no < no_pages(); ++page_no) {
+    write_le<4>(data, first, HeaderSize + 4 * page_no);
+
+    for (const auto &block : _pages[page_no]) {
+      for (std::size_t j = 0; j < BlockWords; ++j)
+        write_le<8>(data, block[j], blocks_offset + sizeof(Block) * first + 8 * j);
+
+      ++first;
+    }
+  }
+
+  write_le<4>(data, first, HeaderSize + 4 * no_pages());
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote filters for {} pages to '{}' ({})", no_pages(),
+              path.lexically_normal().string(), best_size_unit {size});
+  return {};
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "core/error.hh"
+#include "core/io.hh"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * A blocked Bloom filter per page over the position keys (as in
+ * PositionIndex::key) of its games' mainlines, so that a scan for a position
+ * can skip pages that cannot contain it. Each key sets bits in a single 512
+ * bit block, so a test touches one cache line. Stored in a file next to the
+ * database:
+ *
+ *  header (32 bytes)
+ *    magic "cdbbloom", u32 version, u32 bits per key, u32 page count,
+ *    u32 reserved, u64 block count
+ *  u32 first block of each page[page count + 1]
+ *  u64 blocks[block count][8]
+ *
+ * More bits per key lower the false positive rate, about 1% at 10 bits.
+ */
+class PageFilters {
+public:
+  static constexpr std::string_view Magic = "cdbbloom";
+  static constexpr std::uint32_t Version = 0;
+  static constexpr std::size_t HeaderSize = 32;
+  static constexpr std::size_t BlockWords = 8;
+
+  using Block = std::array<std::uint64_t, BlockWords>;
+
+  struct Stats {
+    std::uint64_t tested = 0, skipped = 0, false_positives = 0;
+  };
+
+private:
+  unsigned _bits_per_key = 0, _hashes = 0;
+
+  // blocks of each page, kept apart so rebuilding one page does not move
+  // the others. pages added before their first build have none.
+  std::vector<std::vector<Block>> _pages;
+
+  mutable std::atomic<std::uint64_t> _tested = 0, _skipped = 0, _false_positives = 0;
+
+public:
+  PageFilters() = default;
+
+  // zero bits per key disables the filters
+  explicit PageFilters(unsigned bits_per_key);
+
+  PageFilters(PageFilters &&other) { *this = std::move(other); }
+  PageFilters &operator=(PageFilters &&other);
+
+  static Result<PageFilters> open(const fs::path &path);
+  std::error_code write(const fs::path &path) const;
+
+  bool enabled() const { return _bits_per_key != 0; }
+  unsigned bits_per_key() const { return _bits_per_key; }
+  std::uint32_t no_pages() const { return _pages.size(); }
+
+  // replaces the filter of a page, adding empty filters for any pages before it
+  void build(std::uint32_t page_no, std::span<const std::uint64_t> keys);
+
+  // false if no game in the page reaches the key. pages without a filter
+  // may contain anything.
+  bool may_contain(std::uint32_t page_no, std::uint64_t key) const;
+
+  // counts a page that passed the filter but had no match
+  void false_positive() const { ++_false_positives; }
+
+  Stats stats() const { return {_tested, _skipped, _false_positives}; }
+};
+
+} // cdb::db
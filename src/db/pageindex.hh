@@ -1,39 +1,18 @@
 #pragma once
 
+#include "db/codec.hh"
+#include "db/hashtable.hh"
 #include "util/bits.hh"
 #include "util/komihash.hh"
 #include "util/vector.hh"
 
 #include <algorithm>
+#include <bit>
+#include <cassert>
 #include <ranges>
 
 namespace cdb::db {
 
-namespace GameFormat {
-  using Type = std::uint8_t;
-  constexpr Type Empty       = 0x0;
-  constexpr Type HasTagData  = 0x1;
-  constexpr Type HasComments = 0x2;
-  constexpr Type HasNAGs     = 0x4;
-}
-
-/**
- * Inspired by absl:
- * https://github.com/abseil/abseil-cpp/blob/master/absl/container/internal/raw_hash_set.h#L438 
- *
- * empty    = 0b10000000
- * deleted  = 0b11000000
- * sentinel = 0b11111111
- * hash     = 0b01111111
- */
-namespace Metadata {
-  using Type = std::uint8_t;
-  constexpr Type Hash     = 0b01111111;
-  constexpr Type Empty    = 0b10000000;
-  constexpr Type Deleted  = 0b11000000;
-  constexpr Type Sentinel = 0b11111111;
-}
-
 class PageIndex {
 private:
   std::vector<Metadata::Type> _metadata;
@@ -57,19 +36,29 @@ public:
 
   // returns index of game with given hash
   int find(std::uint64_t hash) {
-    for (auto &&[i, md, game] : std::views::zip(std::views::iota(0), _metadata, _games))
-      if (md == (hash & Metadata::Hash))
-        if (hash == komihash(game, 0))
-          return i;
+    const auto md = static_cast<Metadata::Type>(hash & Metadata::Hash);
+    const auto matches = [&] (std::size_t i) { return hash == komihash(_games[i], 0); };
+
+    // compare a group of metadata bytes at a time, then the rest one by one
+    std::size_t i = 0;
+    for (; i + Group::Width <= _metadata.size(); i += Group::Width)
+      for (auto bits = Group {_metadata.data() + i}.match(md); bits; bits &= bits - 1)
+        if (matches(i + std::countr_zero(bits)))
+          return i + std::countr_zero(bits);
+
+    for (; i < _metadata.size(); ++i)
+      if (_metadata[i] == md && matches(i))
+        return i;
 
     return -1;
   }
 
-  // returns index of first space that is at least min_size bytes long
+  // returns index of first space that is exactly min_size bytes long, or
+  // long enough to leave room for an empty record after min_size bytes
   int find_space(std::size_t min_size) {
     for (auto &&[i, md, game] : std::views::zip(std::views::iota(0), _metadata, _games))
       if (md & Metadata::Empty /* || (md & Metadata::Deleted) */)
-        if (game.size() >= min_size)
+        if (game.size() == min_size || game.size() >= min_size + 3)
           return i;
 
     return -1;
@@ -81,10 +70,16 @@ public:
     if (i == -1)
       return -1;
 
+    if (_games[i].size() == new_size)
+      return i;
+
     // split
     auto ss1 = _games[i].first(new_size);
     auto ss2 = _games[i].last(_games[i].size() - new_size);
 
+    write_le<1>(ss2, GameFormat::Empty);
+    write_le<2>(ss2, ss2.size() - 3, 1);
+
     // resize and append new chunk
     _games[i] = ss1;
     _games.emplace_back(ss2);
@@ -93,6 +88,19 @@ public:
     return i;
   }
 
+  // writes a record into the space at index i, which must be the same size
+  void write(int i, std::span<const std::byte> record) {
+    assert(_games[i].size() == record.size());
+
+    std::ranges::copy(record, _games[i].begin());
+    _metadata[i] = komihash(record, 0) & Metadata::Hash;
+  }
+
+  std::size_t size() const { return _games.size(); }
+
+  Metadata::Type metadata(std::size_t i) const { return _metadata[i]; }
+  std::span<std::byte> record(std::size_t i) const { return _games[i]; }
+
   // merge any adjacent empty or deleted chunks
   void coalesce() {
     constexpr std::byte zero {};
@@ -116,7 +124,7 @@ public:
 
         // overwrite ith game info
         write_le<1>(_games[i], GameFormat::Empty);
-        write_le<2>(_games[i], new_size - 2, 1);
+        write_le<2>(_games[i], new_size - 3, 1);
 
         // remove i+1th span and metadata
         // todo: optimise? removing from middle of vector is quite slow
@@ -128,6 +136,13 @@ public:
     }
   }
 
+  // points the index at the same bytes in a new place, such as the page
+  // mapped again after the file grew
+  void move_to(std::span<const std::byte> from, std::span<std::byte> to) {
+    for (auto &game : _games)
+      game = to.subspan(game.data() - from.data(), game.size());
+  }
+
   // recompute index
   void reindex(std::span<std::byte> data) {
     std::uint32_t pos = 0, next_pos = 0;
@@ -137,22 +152,7 @@ public:
 
     while (pos < data.size()) {
       auto format = static_cast<GameFormat::Type>(read_le<1>(data, pos));
-
-      if (format == GameFormat::Empty) {
-        auto skip = read_le<2>(data, 1 + pos);
-        next_pos = 1 + pos + skip;
-      } else {
-        const bool has_tags = bool(format & GameFormat::HasTagData);
-
-        // get length of tag data
-        auto tag_data_size  = has_tags ? read_le<2>(data, 1 + pos) : 0;
-
-        // move data starts after tag data
-        auto move_offset    = (has_tags ? 2 : 0) + tag_data_size; // todo: possible mistake here
-        auto move_data_size = read_le<2>(data, 1 + pos + move_offset);
-
-        next_pos = pos + move_offset + move_data_size;
-      }
+      next_pos = pos + record_size(data.subspan(pos));
 
       auto ss = data.subspan(pos, next_pos - pos);
       auto md = format == GameFormat::Empty ? Metadata::Empty
@@ -0,0 +1,144 @@
+#include "core/logger.hh"
+#include "db/pattern.hh"
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cctype>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+static const log::logger logger("pattern");
+
+constexpr std::string_view PieceChars = "/pnbr/qk";
+
+namespace {
+  // squares from which a pawn of the side to move (side 0, moving north) or
+  // of the other side (side 1, moving south) can reach each square
+  constexpr auto Cones = [] {
+    std::array<std::array<bitboard, 64>, 2> cones {};
+
+    for (int sq = 0; sq < 64; ++sq) {
+      for (int from = 0; from < 64; ++from) {
+        const int rank = sq / 8, file = sq % 8, from_rank = from / 8, from_file = from % 8;
+        const int distance = from_file > file ? from_file - file : file - from_file;
+
+        if (from_rank <= rank && distance <= rank - from_rank)
+          cones[0][sq] |= square_bb(static_cast<Square>(from));
+
+        if (from_rank >= rank && distance <= from_rank - rank)
+          cones[1][sq] |= square_bb(static_cast<Square>(from));
+      }
+    }
+
+    return cones;
+  } ();
+}
+
+std::size_t Pattern::index(PieceType piece_type) {
+  switch (piece_type) {
+  case PieceType::Pawn:   return 0;
+  case PieceType::Knight: return 1;
+  case PieceType::Bishop: return 2;
+  case PieceType::Rook:
+  case PieceType::Castle: return 3;
+  case PieceType::Queen:  return 4;
+  case PieceType::King:   return 5;
+  default:                break;
+  }
+
+  assert(false);
+  return 0;
+}
+
+void Pattern::require(bool black, PieceType piece_type, bitboard squares) {
+  // with black to move, black is the side to move and the board is flipped
+  _masks[0].required[NoPieceTypes * black + index(piece_type)] |= squares;
+  _masks[1].required[NoPieceTypes * !black + index(piece_type)] |= byteswap(squares);
+}
+
+void Pattern::forbid(bool black, PieceType piece_type, bitboard squares) {
+  _masks[0].forbidden[NoPieceTypes * black + index(piece_type)] |= squares;
+  _masks[1].forbidden[NoPieceTypes * !black + index(piece_type)] |= byteswap(squares);
+}
+
+bool Pattern::reachable(const Position &pos, bool black) const {
+  const auto &m = _masks[black];
+  const auto occ = pos.occupied();
+  const std::array<bitboard, 2> sides {pos.white & occ, occ & ~pos.white};
+  const auto pawns = pos.extract(PieceType::Pawn);
+
+  bool ok = true;
+  for (std::size_t side = 0; side < 2; ++side) {
+    const auto own_pawns = pawns & sides[side];
+    const auto required_pawns = m.required[NoPieceTypes * side];
+
+    bitboard required_men = 0;
+    for (std::size_t i = 0; i < NoPieceTypes; ++i)
+      required_men |= m.required[NoPieceTypes * side + i];
+
+    ok &= std::popcount(required_men) <= std::popcount(sides[side]);
+    ok &= std::popcount(required_pawns) <= std::popcount(own_pawns);
+
+    for (auto bb = required_pawns; bb; bb &= bb - 1)
+      ok &= (Cones[side][lsb(bb)] & own_pawns) != 0;
+  }
+
+  return ok;
+}
+
+std::uint16_t Pattern::moved_pawns() const {
+  // with white to move, the masks are in absolute colours and squares
+  const auto white = _masks[0].forbidden[index(PieceType::Pawn)];
+  const auto black = _masks[0].forbidden[NoPieceTypes + index(PieceType::Pawn)];
+
+  return static_cast<std::uint16_t>(((white >> 8) & 0xff) | ((black >> 40) & 0xff00));
+}
+
+Result<Pattern> Pattern::parse(std::string_view pattern) {
+  Pattern p;
+
+  for (std::size_t i = 0; i < pattern.size(); ) {
+    if (pattern[i] == ' ' || pattern[i] == ',') {
+      ++i;
+      continue;
+    }
+
+    const auto start = i;
+    const bool forbid = pattern[i] == '!';
+    i += forbid;
+
+    const auto c = i < pattern.size() ? pattern[i] : ' ';
+    const auto idx = PieceChars.find(std::tolower(c));
+    if (idx == std::string_view::npos || c == '/') {
+      logger.error(R"(expected piece at "{}")", pattern.substr(start));
+      return std::unexpected(ParseError::Invalid);
+    }
+
+    bitboard squares = 0;
+    for (++i; i + 1 < pattern.size() && 'a' <= pattern[i] && pattern[i] <= 'h'
+                                     && '1' <= pattern[i + 1] && pattern[i + 1] <= '8'; i += 2)
+      squares |= square_bb(static_cast<Square>(8 * (pattern[i + 1] - '1') + (pattern[i] - 'a')));
+
+    if (i < pattern.size() && pattern[i] != ' ' && pattern[i] != ',') {
+      logger.error(R"(invalid square at "{}")", pattern.substr(i));
+      return std::unexpected(ParseError::Invalid);
+    }
+
+    const bool black = std::islower(c);
+    const auto piece_type = static_cast<PieceType>(idx);
+
+    if (forbid) {
+      p.forbid(black, piece_type, squares ? squares : ~bitboard(0));
+    } else if (squares) {
+      p.require(black, piece_type, squares);
+    } else {
+      logger.error(R"(expected squares for "{}")", pattern.substr(start, i - start));
+      return std::unexpected(ParseError::Invalid);
+    }
+  }
+
+  return p;
+}
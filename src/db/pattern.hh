@@ -0,0 +1,96 @@
+#pragma once
+
+#include "chess/position.hh"
+#include "core/error.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace cdb::db {
+
+/**
+ * A partial position: squares that must hold, or must not hold, a piece of a
+ * given type and colour. Squares and colours are absolute, e.g. "white pawns
+ * on d4 and e4, a black knight on f6 and no white queen".
+ *
+ * Positions are stored relative to the side to move, so the pattern is kept
+ * in both orientations, and matching is a fixed sequence of mask tests over
+ * the pieces of both sides.
+ */
+class Pattern {
+public:
+  // pawn, knight, bishop, rook (including castling rooks), queen, king
+  static constexpr std::size_t NoPieceTypes = 6;
+
+private:
+  struct Masks {
+    // indexed by side (to move first) then piece type
+    std::array<chess::bitboard, 2 * NoPieceTypes> required {}, forbidden {};
+  };
+
+  // for white to move, then black to move
+  std::array<Masks, 2> _masks {};
+
+  static std::size_t index(chess::PieceType piece_type);
+
+public:
+  Pattern() = default;
+
+  // the piece must be on every one of the squares
+  void require(bool black, chess::PieceType piece_type, chess::bitboard squares);
+
+  // the piece must not be on any of the squares, by default anywhere
+  void forbid(bool black, chess::PieceType piece_type, chess::bitboard squares = ~chess::bitboard(0));
+
+  /**
+   * Parses a list of terms separated by spaces or commas, each a piece letter
+   * (upper case for white, as in FEN) followed by one or more squares, e.g.
+   * "Pd4e4 nf6". A term starting with '!' forbids the piece on the squares, or
+   * anywhere if none are given, e.g. "!Q".
+   */
+  static Result<Pattern> parse(std::string_view pattern);
+
+  /**
+   * False once no later position of the game can match, because pawns only
+   * move forward and men are never added: each required pawn needs a pawn
+   * of its side that can still advance or capture onto its square, and each
+   * side needs at least as many pawns and men as the pattern requires.
+   */
+  bool reachable(const chess::Position &pos, bool black) const;
+
+  // home pawns, as in db::home_pawns, that must have moved before a match
+  std::uint16_t moved_pawns() const;
+
+  // the masks as bytes, equal for patterns built from the same terms
+  std::span<const std::byte> bytes() const {
+    return std::as_bytes(std::span {_masks});
+  }
+
+  bool matches(const chess::Position &pos, bool black) const {
+    const auto &m = _masks[black];
+    const auto occ = pos.occupied();
+    const std::array<chess::bitboard, 2> sides {pos.white & occ, occ & ~pos.white};
+
+    constexpr std::array<chess::PieceType, NoPieceTypes> PieceTypes {
+      chess::PieceType::Pawn, chess::PieceType::Knight, chess::PieceType::Bishop,
+      chess::PieceType::Rook, chess::PieceType::Queen, chess::PieceType::King
+    };
+
+    // any square that fails a test leaves a bit set
+    chess::bitboard miss = 0;
+    for (std::size_t side = 0; side < 2; ++side) {
+      for (std::size_t i = 0; i < NoPieceTypes; ++i) {
+        const auto bb = pos.extract(PieceTypes[i]) & sides[side];
+        const auto j = NoPieceTypes * side + i;
+        miss |= (m.required[j] & ~bb) | (m.forbidden[j] & bb);
+      }
+    }
+
+    return miss == 0;
+  }
+};
+
+} // cdb::db
@@ -0,0 +1,257 @@
+#include "core/logger.hh"
+#include "db/positionindex.hh"
+#include "util/bytesize.hh"
+#include "util/komihash.hh"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <format>
+#include <limits>
+#include <utility>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("positions");
+
+std::uint64_t PositionIndex::key(const chess::Position &pos, bool black) {
+  // en passant squares are ignored, as they are only recorded after double
+  // pawn pushes and not only when a capture is possible
+  const auto occ = pos.x | pos.y | pos.z;
+
+  std::array<std::byte, 32> data;
+  write_le<8>(std::span {data}, pos.x, 0);
+  write_le<8>(std::span {data}, pos.y, 8);
+  write_le<8>(std::span {data}, pos.z, 16);
+  write_le<8>(std::span {data}, pos.white & occ, 24);
+
+  return komihash(std::span {data}, black);
+}
+
+Result<PositionIndex> PositionIndex::open(const fs::path &path) {
+  PositionIndex index;
+
+  if (auto ec = index._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = index._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad position index - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad position index - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  const std::uint32_t count = read_le<4>(data, 12);
+  const std::size_t table_size   = read_le<8>(data, 16);
+  const std::size_t postings_size = read_le<8>(data, 24);
+
+  if (HeaderSize + table_size + postings_size > data.size()) {
+    logger.error("bad position index - {} positions do not fit in {} bytes", count, data.size());
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  auto table = Table::open(data.subspan(HeaderSize, table_size));
+  if (!table || table->size() != count) {
+    logger.error("bad position index - corrupted table");
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  index._table    = *table;
+  index._postings = data.subspan(HeaderSize + table_size, postings_size);
+  index._no_games = read_le<4>(data, 32);
+
+  return index;
+}
+
+Postings PositionIndex::find(std::uint64_t key) const {
+  const auto list = _table.find(key);
+  if (!list)
+    return {};
+
+  return {_postings.subspan(list->offset), list->count};
+}
+
+Result<Postings> PositionIndex::find(std::string_view fen) const {
+  const auto pos = chess::Position::from_fen(fen);
+  if (!pos)
+    return std::unexpected(pos.error());
+
+  const auto side = fen.find(' ');
+  return find(*pos, side != std::string_view::npos && fen.substr(side + 1, 1) == "b");
+}
+
+namespace {
+  using Entry = PositionIndexBuilder::Entry;
+  constexpr auto RunEntrySize = PositionIndexBuilder::RunEntrySize;
+
+  Entry read_entry(std::span<const std::byte> run, std::size_t i) {
+    const auto pos = i * RunEntrySize;
+    return {read_le<8>(run, pos), {static_cast<std::uint32_t>(read_le<4>(run, pos + 8)),
+                                   static_cast<std::uint16_t>(read_le<2>(run, pos + 12))}};
+  }
+
+  // merges the spilled runs and the sorted in-memory tail, calling fn with
+  // each key and its entries, which are in game order
+  void merge_runs(std::span<const std::span<const std::byte>> runs, std::span<const Entry> tail,
+                  std::invocable<std::uint64_t, std::span<const PositionEntry>> auto fn) {
+    const auto count = [&] (std::size_t source) {
+      return source < runs.size() ? runs[source].size() / RunEntrySize : tail.size();
+    };
+
+    const auto at = [&] (std::size_t source, std::size_t i) {
+      return source < runs.size() ? read_entry(runs[source], i) : tail[i];
+    };
+
+    struct Cursor {
+      Entry entry;
+      std::size_t source, next;
+    };
+
+    const auto greater = [] (const Cursor &a, const Cursor &b) { return a.entry > b.entry; };
+
+    std::vector<Cursor> heap;
+    for (std::size_t source = 0; source <= runs.size(); ++source)
+      if (count(source))
+        heap.push_back({at(source, 0), source, 1});
+
+    std::ranges::make_heap(heap, greater);
+
+    std::vector<PositionEntry> group;
+    std::uint64_t key = 0;
+
+    while (!heap.empty()) {
+      std::ranges::pop_heap(heap, greater);
+      auto &cursor = heap.back();
+
+      if (!group.empty() && cursor.entry.key != key) {
+        fn(key, std::span<const PositionEntry> {group});
+        group.clear();
+      }
+
+      key = cursor.entry.key;
+      group.push_back(cursor.entry.value);
+
+      if (cursor.next < count(cursor.source)) {
+        cursor.entry = at(cursor.source, cursor.next++);
+        std::ranges::push_heap(heap, greater);
+      } else
+        heap.pop_back();
+    }
+
+    if (!group.empty())
+      fn(key, std::span<const PositionEntry> {group});
+  }
+
+  std::span<const PositionEntry> first_entries(std::span<const PositionEntry> group) {
+    return group.first(std::min<std::size_t>(group.size(), std::numeric_limits<std::uint32_t>::max()));
+  }
+}
+
+void PositionIndexBuilder::spill() {
+  std::ranges::sort(_entries);
+
+  std::error_code ec;
+  const auto dir = fs::temp_directory_path(ec);
+  const auto path = dir / std::format("cdb_positions_{}_{}.run", static_cast<const void *>(this), _runs.size());
+
+  io::mm_file run;
+  if (!ec)
+    ec = run.open(path, _entries.size() * RunEntrySize, true);
+
+  if (ec) {
+    logger.error("failed to spill {} positions to '{}' ({})", _entries.size(),
+                 path.lexically_normal().string(), ec.message());
+    _error = ec;
+    _entries.clear();
+    return;
+  }
+
+  auto data = run.mutable_span();
+  for (std::size_t i = 0; i < _entries.size(); ++i) {
+    const auto &[key, value] = _entries[i];
+    write_le<8>(data, key, i * RunEntrySize);
+    write_le<4>(data, value.game, i * RunEntrySize + 8);
+    write_le<2>(data, value.ply, i * RunEntrySize + 12);
+  }
+
+  logger.debug("spilled run {} ({} positions)", _runs.size(), _entries.size());
+
+  _runs.push_back(std::move(run));
+  _entries.clear();
+}
+
+std::error_code PositionIndexBuilder::write(const fs::path &path, std::uint32_t no_games) {
+  if (_error)
+    return _error;
+
+  std::ranges::sort(_entries);
+
+  std::vector<std::span<const std::byte>> runs;
+  for (const auto &run : _runs)
+    runs.push_back(run.span());
+
+  // the first merge sizes each position's posting list, the second encodes
+  // them once the file has been allocated
+  std::vector<std::pair<std::uint64_t, PositionIndex::PostingList>> lists;
+  std::size_t postings_size = 0;
+
+  merge_runs(runs, _entries, [&] (std::uint64_t key, std::span<const PositionEntry> group) {
+    const auto entries = first_entries(group);
+    lists.push_back({key, {postings_size, static_cast<std::uint32_t>(entries.size())}});
+    postings_size += Postings::encoded_size(entries);
+  });
+
+  const auto count = lists.size();
+  if (count > std::numeric_limits<std::uint32_t>::max()) {
+    logger.error("{} positions do not fit in a position index", count);
+    return DbError::OutOfMemory;
+  }
+
+  const std::size_t table_size = PositionIndex::Table::bytes(count);
+  const std::size_t size = PositionIndex::HeaderSize + table_size + postings_size;
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::copy(std::as_bytes(std::span {PositionIndex::Magic}), data.begin());
+  write_le<4>(data, PositionIndex::Version, 8);
+  write_le<4>(data, static_cast<std::uint32_t>(count), 12);
+  write_le<8>(data, table_size, 16);
+  write_le<8>(data, postings_size, 24);
+  write_le<4>(data, no_games, 32);
+  write_le<4>(data, 0u, 36);
+  write_le<8>(data, std::uint64_t(0), 40);
+
+  PositionIndex::Table::build(data.subspan(PositionIndex::HeaderSize, table_size), lists);
+
+  auto postings = data.subspan(PositionIndex::HeaderSize + table_size);
+  std::size_t i = 0;
+  merge_runs(runs, _entries, [&] (std::uint64_t, std::span<const PositionEntry> group) {
+    Postings::encode(first_entries(group), postings.subspan(lists[i++].second.offset));
+  });
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote {} positions ({} occurrences, {} runs) to '{}' ({})", count, _total, _runs.size(),
+              path.lexically_normal().string(), best_size_unit {size});
+
+  _entries.clear();
+  _entries.shrink_to_fit();
+  _runs.clear();
+  _total = 0;
+  return {};
+}
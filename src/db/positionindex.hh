@@ -0,0 +1,130 @@
+#pragma once
+
+#include "chess/position.hh"
+#include "core/error.hh"
+#include "core/io.hh"
+#include "db/hashtable.hh"
+#include "db/postings.hh"
+#include "util/bits.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * Maps mainline positions to the games that reach them, stored in a file next
+ * to the database:
+ *
+ *  header (48 bytes)
+ *    magic "cdbposix", u32 version, u32 position count, u64 table size,
+ *    u64 posting data size, u32 game count, u32 reserved, u64 reserved
+ *  table          HashTable from key to the offset and length of the
+ *                 position's posting list
+ *  posting data   posting lists, encoded as described in Postings
+ *
+ * Keys are hashes of the position and side to move, so a lookup is a probe
+ * into the table followed by a read of one contiguous posting list. The
+ * starting position (ply 0) is not indexed, since every game reaches it.
+ * Games from the game count on were appended after the index was built and
+ * are not in it.
+ */
+class PositionIndex {
+public:
+  static constexpr std::string_view Magic = "cdbposix";
+  static constexpr std::uint32_t Version = 3;
+  static constexpr std::size_t HeaderSize = 48;
+
+  struct PostingList {
+    std::uint64_t offset; // in bytes from the start of the posting data
+    std::uint32_t count, reserved = 0;
+  };
+
+  using Table = HashTable<std::uint64_t, PostingList, IdentityHash>;
+
+private:
+  io::mm_file _file;
+  Table _table;
+  std::span<const std::byte> _postings;
+  std::uint32_t _no_games = 0;
+
+public:
+  PositionIndex() = default;
+
+  static Result<PositionIndex> open(const fs::path &path);
+
+  static std::uint64_t key(const chess::Position &pos, bool black);
+
+  bool is_open() const { return _file.is_open(); }
+
+  // number of distinct positions
+  std::uint32_t size() const { return _table.size(); }
+
+  // games [0, no_games()) are indexed
+  std::uint32_t no_games() const { return _no_games; }
+
+  Postings find(std::uint64_t key) const;
+  Postings find(const chess::Position &pos, bool black) const { return find(key(pos, black)); }
+
+  // the side to move is taken from the FEN, since positions do not store it
+  Result<Postings> find(std::string_view fen) const;
+};
+
+/**
+ * Collects (key, game, ply) entries and writes them out as a PositionIndex.
+ * At most run_size entries are held in memory: when the buffer fills, it is
+ * sorted and spilled to a temporary file as a run, and write() merges the
+ * runs. Only the table of distinct keys is ever held in full.
+ */
+class PositionIndexBuilder {
+public:
+  struct Entry {
+    std::uint64_t key;
+    PositionEntry value;
+
+    constexpr auto operator<=>(const Entry &) const = default;
+  };
+
+  // bytes per entry in a spilled run: u64 key, u32 game, u16 ply
+  static constexpr std::size_t RunEntrySize = 14;
+
+  // 16M entries, 256 MiB of buffer
+  static constexpr std::size_t DefaultRunSize = std::size_t(1) << 24;
+
+private:
+  std::size_t _run_size;
+  std::vector<Entry> _entries;
+  std::vector<io::mm_file> _runs;
+  std::uint64_t _total = 0;
+
+  // set if a run could not be spilled, and returned by write()
+  std::error_code _error;
+
+  void spill();
+
+public:
+  explicit PositionIndexBuilder(std::size_t run_size = DefaultRunSize)
+    : _run_size(std::max<std::size_t>(run_size, 1))
+  {
+  }
+
+  void add(const chess::Position &pos, bool black, std::uint32_t game, std::uint16_t ply) {
+    _entries.push_back({PositionIndex::key(pos, black), {game, ply}});
+    ++_total;
+
+    if (_entries.size() >= _run_size)
+      spill();
+  }
+
+  // number of runs spilled to disk so far
+  std::size_t runs() const { return _runs.size(); }
+
+  // no_games is the number of games the entries were collected from
+  std::error_code write(const fs::path &path, std::uint32_t no_games);
+};
+
+} // cdb::db
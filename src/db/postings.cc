@@ -0,0 +1,340 @@
+#include "db/postings.hh"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace cdb;
+using namespace cdb::db;
+
+namespace {
+  constexpr std::size_t Lanes = 4;
+  constexpr std::size_t Rows = Postings::BlockSize / Lanes;
+
+  using Block = std::array<std::uint32_t, Postings::BlockSize>;
+
+  // bytes taken by a block of values packed to the given width
+  constexpr std::size_t packed_size(unsigned width) {
+    return 4 * Lanes * width;
+  }
+
+  // value i goes in lane i % 4, and each lane's values are packed one after
+  // the other into every fourth word
+  void pack(const Block &in, unsigned width, std::span<std::byte> out) {
+    std::ranges::fill(out.first(packed_size(width)), std::byte {0});
+
+    const auto put = [&] (std::size_t word, std::uint32_t bits) {
+      write_le<4>(out, read_le<4>(out, 4 * word) | bits, 4 * word);
+    };
+
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      for (unsigned row = 0, bit = 0; row < Rows && width; ++row, bit += width) {
+        const auto value = in[Lanes * row + lane];
+        const auto word = bit / 32, offset = bit % 32;
+
+        put(Lanes * word + lane, value << offset);
+        if (offset + width > 32)
+          put(Lanes * (word + 1) + lane, value >> (32 - offset));
+      }
+    }
+  }
+
+  void unpack(std::span<const std::byte> in, unsigned width, Block &out) {
+    if (width == 0) {
+      out.fill(0);
+      return;
+    }
+
+#ifdef __SSE2__
+    const auto mask = _mm_set1_epi32(static_cast<int>((std::uint64_t(1) << width) - 1));
+    const auto *p = reinterpret_cast<const __m128i *>(in.data());
+    auto word = _mm_loadu_si128(p);
+
+    for (unsigned row = 0, offset = 0; row < Rows; ++row) {
+      auto v = _mm_srl_epi32(word, _mm_cvtsi32_si128(offset));
+
+      if (offset + width > 32) {
+        word = _mm_loadu_si128(++p);
+        v = _mm_or_si128(v, _mm_sll_epi32(word, _mm_cvtsi32_si128(32 - offset)));
+        offset += width - 32;
+      } else if (offset + width == 32) {
+        if (row + 1 < Rows)
+          word = _mm_loadu_si128(++p);
+
+        offset = 0;
+      } else {
+        offset += width;
+      }
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out.data() + Lanes * row), _mm_and_si128(v, mask));
+    }
+#else
+    const auto mask = width == 32 ? ~std::uint32_t(0) : (std::uint32_t(1) << width) - 1;
+
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      for (unsigned row = 0, bit = 0; row < Rows; ++row, bit += width) {
+        const auto word = bit / 32, offset = bit % 32;
+
+        std::uint64_t v = read_le<4>(in, 4 * (Lanes * word + lane));
+        if (offset + width > 32)
+          v |= std::uint64_t(read_le<4>(in, 4 * (Lanes * (word + 1) + lane))) << 32;
+
+        out[Lanes * row + lane] = (v >> offset) & mask;
+      }
+    }
+#endif
+  }
+
+  // reverses the deltas from the value four entries before, four at a time
+  void prefix_sum(Block &values, std::uint32_t first) {
+#ifdef __SSE2__
+    auto prev = _mm_set1_epi32(first);
+    for (std::size_t row = 0; row < Rows; ++row) {
+      auto *p = reinterpret_cast<__m128i *>(values.data() + Lanes * row);
+      prev = _mm_add_epi32(prev, _mm_loadu_si128(p));
+      _mm_storeu_si128(p, prev);
+    }
+#else
+    for (std::size_t i = 0; i < Postings::BlockSize; ++i)
+      values[i] += i < Lanes ? first : values[i - Lanes];
+#endif
+  }
+
+  std::size_t block_count(std::size_t count, std::size_t block) {
+    return std::min(Postings::BlockSize, count - Postings::BlockSize * block);
+  }
+
+  struct Widths {
+    unsigned game, ply;
+  };
+
+  // fills a block with game deltas and plies, padding partial blocks with
+  // the last game, and returns the bit widths they need
+  Widths prepare(std::span<const PositionEntry> block, Block &games, Block &plies) {
+    for (std::size_t i = 0; i < Postings::BlockSize; ++i) {
+      const auto &e = block[std::min(i, block.size() - 1)];
+      games[i] = e.game;
+      plies[i] = i < block.size() ? e.ply : 0;
+    }
+
+    // backwards, so that the values being subtracted are not deltas yet
+    std::uint32_t max_delta = 0, max_ply = 0;
+    for (std::size_t i = Postings::BlockSize; i-- > 0; ) {
+      games[i] -= i < Lanes ? games[0] : games[i - Lanes];
+      max_delta = std::max(max_delta, games[i]);
+      max_ply = std::max(max_ply, plies[i]);
+    }
+
+    return {static_cast<unsigned>(std::bit_width(max_delta)),
+            static_cast<unsigned>(std::bit_width(max_ply))};
+  }
+
+  // moves over the blocks of a list, decoding them as they are needed
+  struct Cursor {
+    const Postings &list;
+    std::size_t block = 0, i = 0, n = 0;
+    bool loaded = false;
+    std::array<PositionEntry, Postings::BlockSize> entries;
+
+    Cursor(const Postings &list) : list(list) {}
+
+    bool done() const { return block >= list.no_blocks(); }
+
+    std::uint32_t first() const { return loaded ? entries[i].game : list.first_game(block); }
+    std::uint32_t last() const  { return list.last_game(block); }
+
+    void load() {
+      if (!loaded) {
+        n = list.decode_block(block, entries);
+        i = 0;
+        loaded = true;
+      }
+    }
+
+    void next_block() {
+      ++block;
+      loaded = false;
+    }
+
+    // moves to the first block that could hold the game, galloping over the
+    // skip headers
+    void seek(std::uint32_t game) {
+      const auto no_blocks = list.no_blocks();
+
+      std::size_t lo = block, hi = block + 1;
+      for (std::size_t step = 1; hi < no_blocks && list.last_game(hi) < game; step *= 2)
+        lo = hi, hi = std::min(no_blocks, hi + step);
+
+      // the block is in (lo, hi]
+      for (hi = std::min(hi, no_blocks); lo + 1 < hi; ) {
+        const auto mid = lo + (hi - lo) / 2;
+        (list.last_game(mid) < game ? lo : hi) = mid;
+      }
+
+      block = hi;
+      loaded = false;
+    }
+  };
+}
+
+std::uint32_t Postings::first_game(std::size_t block) const {
+  return read_le<4>(_data, blocked() ? SkipSize * block : 0);
+}
+
+std::uint32_t Postings::last_game(std::size_t block) const {
+  return read_le<4>(_data, blocked() ? SkipSize * block + 4 : EntrySize * (_count - 1));
+}
+
+std::size_t Postings::decode_block(std::size_t block, std::span<PositionEntry, BlockSize> out) const {
+  if (!blocked()) {
+    for (std::size_t i = 0; i < _count; ++i)
+      out[i] = {read_le<4>(_data, EntrySize * i), read_le<2>(_data, EntrySize * i + 4)};
+
+    return _count;
+  }
+
+  const auto skip = _data.subspan(SkipSize * block, SkipSize);
+  const auto first      = read_le<4>(skip);
+  const auto offset     = read_le<4>(skip, 8);
+  const auto game_width = read_le<1>(skip, 12);
+  const auto ply_width  = read_le<1>(skip, 13);
+  const auto n          = read_le<2>(skip, 14);
+
+  Block games, plies;
+  unpack(_data.subspan(offset), game_width, games);
+  unpack(_data.subspan(offset + packed_size(game_width)), ply_width, plies);
+  prefix_sum(games, first);
+
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = {games[i], static_cast<std::uint16_t>(plies[i])};
+
+  return n;
+}
+
+void Postings::decode(std::vector<PositionEntry> &out) const {
+  if (empty())
+    return;
+
+  std::array<PositionEntry, BlockSize> block;
+  for (std::size_t i = 0; i < no_blocks(); ++i) {
+    const auto n = decode_block(i, block);
+    out.insert(out.end(), block.begin(), block.begin() + n);
+  }
+}
+
+std::size_t Postings::encoded_size(std::span<const PositionEntry> entries) {
+  if (entries.size() < BlockSize)
+    return EntrySize * entries.size();
+
+  std::size_t size = 0;
+  Block games, plies;
+
+  for (std::size_t first = 0; first < entries.size(); first += BlockSize) {
+    const auto block = entries.subspan(first, block_count(entries.size(), first / BlockSize));
+    const auto widths = prepare(block, games, plies);
+
+    size += SkipSize + packed_size(widths.game) + packed_size(widths.ply);
+  }
+
+  return size;
+}
+
+void Postings::encode(std::span<const PositionEntry> entries, std::span<std::byte> out) {
+  assert(out.size() >= encoded_size(entries));
+
+  if (entries.size() < BlockSize) {
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      write_le<4>(out, entries[i].game, EntrySize * i);
+      write_le<2>(out, entries[i].ply,  EntrySize * i + 4);
+    }
+
+    return;
+  }
+
+  const auto no_blocks = (entries.size() + BlockSize - 1) / BlockSize;
+  std::size_t offset = SkipSize * no_blocks;
+
+  for (std::size_t b = 0; b < no_blocks; ++b) {
+    const auto block = entries.subspan(BlockSize * b, block_count(entries.size(), b));
+
+    Block games, plies;
+    const auto [game_width, ply_width] = prepare(block, games, plies);
+
+    auto skip = out.subspan(SkipSize * b, SkipSize);
+    write_le<4>(skip, block.front().game);
+    write_le<4>(skip, block.back().game, 4);
+    write_le<4>(skip, offset, 8);
+    write_le<1>(skip, game_width, 12);
+    write_le<1>(skip, ply_width, 13);
+    write_le<2>(skip, block.size(), 14);
+
+    pack(games, game_width, out.subspan(offset));
+    offset += packed_size(game_width);
+
+    pack(plies, ply_width, out.subspan(offset));
+    offset += packed_size(ply_width);
+  }
+}
+
+roaring_bitmap Postings::games() const {
+  std::vector<std::uint32_t> games;
+  games.reserve(_count);
+
+  std::array<PositionEntry, BlockSize> block;
+  for (std::size_t i = 0; i < no_blocks() && !empty(); ++i) {
+    const auto n = decode_block(i, block);
+    for (std::size_t j = 0; j < n; ++j)
+      games.push_back(block[j].game);
+  }
+
+  return roaring_bitmap::from_sorted(games);
+}
+
+roaring_bitmap db::intersect(const Postings &a, const Postings &b) {
+  std::vector<std::uint32_t> games;
+  if (a.empty() || b.empty())
+    return {};
+
+  Cursor x {a}, y {b};
+
+  while (!x.done() && !y.done()) {
+    // skip blocks that cannot hold a common game without decoding them
+    if (x.last() < y.first()) {
+      x.seek(y.first());
+      continue;
+    }
+
+    if (y.last() < x.first()) {
+      y.seek(x.first());
+      continue;
+    }
+
+    x.load();
+    y.load();
+
+    while (x.i < x.n && y.i < y.n) {
+      const auto gx = x.entries[x.i].game, gy = y.entries[y.i].game;
+
+      if (gx < gy) {
+        ++x.i;
+      } else if (gy < gx) {
+        ++y.i;
+      } else {
+        if (games.empty() || games.back() != gx)
+          games.push_back(gx);
+
+        ++x.i, ++y.i;
+      }
+    }
+
+    if (x.i == x.n) x.next_block();
+    if (y.i == y.n) y.next_block();
+  }
+
+  return roaring_bitmap::from_sorted(games);
+}
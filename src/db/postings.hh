@@ -0,0 +1,84 @@
+#pragma once
+
+#include "util/bits.hh"
+#include "util/roaring.hh"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace cdb::db {
+
+struct PositionEntry {
+  std::uint32_t game;
+  std::uint16_t ply;
+
+  constexpr auto operator<=>(const PositionEntry &) const = default;
+};
+
+/**
+ * The games and plies at which a position occurs, sorted by game id.
+ *
+ * Lists shorter than a block are stored as is, u32 game id then u16 ply per
+ * entry. Longer lists are split into blocks of 128 entries, stored as:
+ *
+ *  skip headers, one per block
+ *    u32 first game, u32 last game, u32 data offset from the start of the
+ *    list, u8 game bit width, u8 ply bit width, u16 entry count
+ *  block data
+ *    game ids as deltas from the id four entries before (the first four from
+ *    the first game), then plies, each bit-packed to their block's width
+ *
+ * Packed values are interleaved over four 32 bit lanes, so a block is unpacked
+ * four values at a time with SSE2. The skip headers let intersections step
+ * over blocks without decoding them.
+ */
+class Postings {
+public:
+  static constexpr std::size_t EntrySize = 6;
+  static constexpr std::size_t BlockSize = 128;
+  static constexpr std::size_t SkipSize  = 16;
+
+private:
+  std::span<const std::byte> _data;
+  std::uint32_t _count = 0;
+
+public:
+  Postings() = default;
+  Postings(std::span<const std::byte> data, std::uint32_t count) : _data(data), _count(count) {}
+
+  std::size_t size() const { return _count; }
+  bool empty() const { return _count == 0; }
+
+  bool blocked() const { return _count >= BlockSize; }
+  std::size_t no_blocks() const { return blocked() ? (_count + BlockSize - 1) / BlockSize : 1; }
+
+  // first and last game id in a block
+  std::uint32_t first_game(std::size_t block) const;
+  std::uint32_t last_game(std::size_t block) const;
+
+  // decodes a block into out, which must hold BlockSize entries, and returns
+  // the number of entries in it
+  std::size_t decode_block(std::size_t block, std::span<PositionEntry, BlockSize> out) const;
+
+  // appends every entry to out
+  void decode(std::vector<PositionEntry> &out) const;
+
+  std::vector<PositionEntry> entries() const {
+    std::vector<PositionEntry> out;
+    decode(out);
+    return out;
+  }
+
+  // the set of games in the list
+  roaring_bitmap games() const;
+
+  // entries must be sorted by game id
+  static std::size_t encoded_size(std::span<const PositionEntry> entries);
+  static void encode(std::span<const PositionEntry> entries, std::span<std::byte> out);
+};
+
+// the games that are in both lists
+roaring_bitmap intersect(const Postings &a, const Postings &b);
+
+} // cdb::db
@@ -0,0 +1,407 @@
+#include "core/logger.hh"
+#include "db/db.hh"
+#include "db/query.hh"
+
+#include <algorithm>
+#include <format>
+#include <limits>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("query");
+
+namespace {
+  // costs relative to looking up one game's metadata
+  constexpr double ColumnCost  = 1.0 / 16; // per game, the kernels test many at once
+  constexpr double CheckCost   = 1;
+  constexpr double PostingCost = 0.25;     // per game of an index lookup
+  constexpr double TagsCost    = 20;       // decoding a game's tags
+  constexpr double ReplayCost  = 200;      // replaying a game's mainline
+
+  // guesses at the fraction of games matching predicates that only a scan
+  // can tell, after what they imply about the metadata
+  constexpr double TagGuess      = 0.05;
+  constexpr double MaterialGuess = 0.25;
+  constexpr double PositionGuess = 0.01;
+  constexpr double PatternGuess  = 0.1;
+  constexpr double LineGuess     = 0.5;   // candidates of an inexact line trie match
+
+  constexpr std::uint32_t MetadataSamples = 1024;
+
+  std::string_view field_name(TagField::Type fields) {
+    switch (fields) {
+    case TagField::Players: return "player";
+    case TagField::White:   return "white";
+    case TagField::Black:   return "black";
+    case TagField::Event:   return "event";
+    case TagField::Site:    return "site";
+    default:                return "tag";
+    }
+  }
+
+  std::string_view match_name(TagMatch match) {
+    switch (match) {
+    case TagMatch::Exact:    return "exact";
+    case TagMatch::Prefix:   return "prefix";
+    case TagMatch::Contains: return "contains";
+    case TagMatch::Similar:  return "similar";
+    }
+
+    return "";
+  }
+
+  std::string_view kind_name(PlanStage::Kind kind) {
+    switch (kind) {
+    case PlanStage::Tag:      return "tag";
+    case PlanStage::Metadata: return "metadata";
+    case PlanStage::Position: return "position";
+    case PlanStage::Line:     return "line";
+    case PlanStage::Record:   return "record";
+    }
+
+    return "";
+  }
+
+  std::string_view access_name(Access access) {
+    switch (access) {
+    case Access::Index: return "index";
+    case Access::Check: return "check";
+    case Access::Scan:  return "scan";
+    }
+
+    return "";
+  }
+
+  std::string describe(const TagPredicate &tag) {
+    return std::format(R"({} {} "{}")", field_name(tag.fields), match_name(tag.match),
+                       TagIndex::normalise(tag.text));
+  }
+
+  std::string describe(const MetadataFilter &filter) {
+    std::string s = "metadata";
+
+    const auto range = [&] (std::string_view name, const auto &r) {
+      if (!r.all())
+        s += std::format(" {} {}-{}", name, r.min, r.max);
+    };
+
+    range("date", filter.date);
+    range("white_elo", filter.white_elo);
+    range("black_elo", filter.black_elo);
+    range("eco", filter.eco);
+    range("ply_count", filter.ply_count);
+
+    if (filter.results != 0xff)
+      s += std::format(" results {:#x}", filter.results);
+    if (filter.material)
+      s += std::format(" material {:#x}", filter.material);
+    if (filter.moved_pawns)
+      s += std::format(" moved_pawns {:#x}", filter.moved_pawns);
+
+    return s;
+  }
+
+  std::string json_string(std::string_view s) {
+    std::string out = "\"";
+    for (const char c : s) {
+      if (c == '"' || c == '\\')
+        out += {'\\', c};
+      else if (static_cast<unsigned char>(c) < 0x20)
+        out += std::format("\\u{:04x}", int(c));
+      else
+        out += c;
+    }
+
+    return out + '"';
+  }
+
+  std::string json_stage(const PlanStage &stage) {
+    return std::format(R"({{"kind":{},"access":{},"description":{},"rows":{:.1f},"cost":{:.1f}}})",
+                       json_string(kind_name(stage.kind)), json_string(access_name(stage.access)),
+                       json_string(stage.description), stage.rows, stage.cost);
+  }
+
+  std::string json_stats(const StageStats &s) {
+    return std::format(R"({{"rows_in":{},"rows_out":{},"probes":{},"pages":{},"bytes":{},"plies":{},)"
+                       R"("wall_ms":{:.3f},"cpu_ms":{:.3f}}})",
+                       s.rows_in, s.rows_out, s.probes, s.pages, s.bytes, s.plies, s.wall_ms, s.cpu_ms);
+  }
+
+  std::string text_stats(const StageStats &s) {
+    return std::format("{} -> {} games, {} probes, {} pages, {} bytes, {} plies, {:.3f} ms ({:.3f} ms cpu)",
+                       s.rows_in, s.rows_out, s.probes, s.pages, s.bytes, s.plies, s.wall_ms, s.cpu_ms);
+  }
+
+  roaring_bitmap lookup(const TagIndex &index, const TagPredicate &tag) {
+    switch (tag.match) {
+    case TagMatch::Exact:    return index.exact(tag.text, tag.fields);
+    case TagMatch::Prefix:   return index.prefix(tag.text, tag.fields);
+    case TagMatch::Contains: return index.contains(tag.text, tag.fields);
+    case TagMatch::Similar:  return index.similar(tag.text, 0.5, tag.fields);
+    }
+
+    return {};
+  }
+
+  // fraction of evenly spaced games that match the filter, never quite zero
+  double sample(const MetadataStore &store, const MetadataFilter &filter) {
+    const auto n = std::min(store.size(), MetadataSamples);
+    if (n == 0)
+      return 0;
+
+    std::uint32_t hits = 0;
+    for (std::uint32_t i = 0; i < n; ++i)
+      hits += filter.matches(store[std::uint64_t(i) * store.size() / n]);
+
+    return std::max(hits, 1u) / double(n + 1);
+  }
+}
+
+bool TagPredicate::matches(std::string_view value) const {
+  const auto name = TagIndex::normalise(value), s = TagIndex::normalise(text);
+
+  switch (match) {
+  case TagMatch::Exact:
+    return name == s;
+  case TagMatch::Prefix:
+    return !s.empty() && (name.starts_with(s) || name.find(" " + s) != std::string::npos);
+  case TagMatch::Contains:
+  case TagMatch::Similar:
+    return !s.empty() && name.find(s) != std::string::npos;
+  }
+
+  return false;
+}
+
+std::string Query::key() const {
+  // every predicate must hold, so their order and repeats do not matter
+  std::vector<std::string> parts;
+
+  for (const auto &tag : tags) {
+    const auto text = TagIndex::normalise(tag.text);
+    parts.push_back(std::format("t{}:{}:{}:{}", int(tag.fields), int(tag.match), text.size(), text));
+  }
+
+  for (const auto &material : materials)
+    parts.push_back(std::format("m{:x}", material.key()));
+
+  for (const auto &[pos, black] : positions)
+    parts.push_back(std::format("p{:x}:{}", PositionIndex::key(pos, black), int(black)));
+
+  for (const auto &pattern : patterns) {
+    std::string s = "q";
+    for (const auto b : pattern.bytes())
+      s += std::format("{:02x}", std::to_integer<unsigned>(b));
+
+    parts.push_back(std::move(s));
+  }
+
+  std::ranges::sort(parts);
+  const auto [first, last] = std::ranges::unique(parts);
+  parts.erase(first, last);
+
+  std::string key = std::format("d{}-{} w{}-{} b{}-{} e{}-{} n{}-{} r{:x} s{:x} h{:x}",
+                                metadata.date.min, metadata.date.max,
+                                metadata.white_elo.min, metadata.white_elo.max,
+                                metadata.black_elo.min, metadata.black_elo.max,
+                                metadata.eco.min, metadata.eco.max,
+                                metadata.ply_count.min, metadata.ply_count.max,
+                                metadata.results, metadata.material, metadata.moved_pawns);
+
+  key += " l";
+  for (const auto &move : line)
+    key += std::format("{:04x}", Token::encode(move));
+
+  for (const auto &part : parts) {
+    key += ' ';
+    key += part;
+  }
+
+  return key;
+}
+
+QueryPlan QueryPlan::make(const Query &query, const Db &db) {
+  QueryPlan plan;
+  const double no_games = db.no_games();
+
+  // what records imply about the metadata rules games out before their scan
+  plan.metadata = query.metadata;
+  for (const auto &m : query.materials)
+    plan.metadata.reaches(m);
+  for (const auto &pattern : query.patterns)
+    plan.metadata.moved_pawns |= pattern.moved_pawns();
+  for (const auto &[pos, black] : query.positions)
+    plan.metadata.moved_pawns |= static_cast<std::uint16_t>(~home_pawns(pos, black));
+  if (!query.line.empty())
+    plan.metadata.ply_count.min = std::max<std::uint16_t>(plan.metadata.ply_count.min, query.line.size());
+
+  auto &stages = plan.stages;
+
+  for (std::size_t i = 0; i < query.tags.size(); ++i) {
+    if (!db.covers(db.tags())) {
+      plan.scan_tags.push_back(i);
+      continue;
+    }
+
+    auto games = lookup(db.tags(), query.tags[i]);
+    ++plan.probes;
+    const double rows = games.cardinality();
+    stages.push_back({PlanStage::Tag, Access::Index, i, describe(query.tags[i]), rows, 0, std::move(games)});
+  }
+
+  for (std::size_t i = 0; i < query.positions.size(); ++i) {
+    const auto &[pos, black] = query.positions[i];
+    if (!db.covers(db.positions())) {
+      plan.scan_positions.push_back(i);
+      continue;
+    }
+
+    // a game may reach a position more than once, so this is an upper bound
+    const double rows = db.positions().find(pos, black).size();
+    ++plan.probes;
+    stages.push_back({PlanStage::Position, Access::Index, i, "position " + pos.to_fen(black), rows, 0, {}});
+  }
+
+  if (!query.line.empty()) {
+    if (db.covers(db.lines())) {
+      const auto match = db.lines().find(query.line);
+      ++plan.probes;
+
+      std::vector<std::uint32_t> ids;
+      for (std::size_t i = 0; i < match.size(); ++i)
+        ids.push_back(match[i]);
+      std::ranges::sort(ids);
+
+      stages.push_back({PlanStage::Line, Access::Index, 0, std::format("line of {} plies", query.line.size()),
+                        double(ids.size()), 0, roaring_bitmap::from_sorted(ids)});
+      plan.scan_line = !match.exact;
+    } else
+      plan.scan_line = true;
+  }
+
+  // games appended since the metadata store was written are left to the
+  // record scan, and pass the metadata stage
+  const std::uint32_t stored = db.metadata().is_open() ? std::min<std::uint64_t>(db.metadata().size(), db.no_games()) : 0;
+  plan.metadata_games = stored;
+  const double unstored = plan.metadata.all() ? 0 : no_games - stored;
+
+  if (!plan.metadata.all() && stored) {
+    const double rows = stored * sample(db.metadata(), plan.metadata) + unstored;
+    plan.probes += std::min(stored, MetadataSamples);
+    stages.push_back({PlanStage::Metadata, Access::Index, 0, describe(plan.metadata), rows, 0, {}});
+  }
+
+  // the most selective first, then each chooses how to narrow what is left
+  std::ranges::stable_sort(stages, {}, &PlanStage::rows);
+
+  double left = no_games;
+  for (auto &stage : stages) {
+    if (stage.kind == PlanStage::Metadata) {
+      const auto scan = no_games * ColumnCost, check = left * CheckCost;
+      stage.access = check < scan ? Access::Check : Access::Index;
+      stage.cost = std::min(scan, check);
+    } else
+      stage.cost = stage.rows * PostingCost;
+
+    plan.cost += stage.cost;
+    left *= no_games ? std::min(1.0, stage.rows / no_games) : 0;
+  }
+
+  const bool replay = !query.materials.empty() || !query.patterns.empty()
+                      || !plan.scan_positions.empty() || plan.scan_line;
+
+  if (replay || !plan.scan_tags.empty() || unstored) {
+    std::string description = "record";
+    double rows = no_games;
+
+    const auto add = [&] (std::size_t count, std::string_view name, double guess) {
+      for (std::size_t i = 0; i < count; ++i)
+        rows *= guess;
+      if (count)
+        description += std::format(" {} {}", count, name);
+    };
+
+    add(plan.scan_tags.size(), "tags", TagGuess);
+    add(query.materials.size(), "materials", MaterialGuess);
+    add(plan.scan_positions.size(), "positions", PositionGuess);
+    add(query.patterns.size(), "patterns", PatternGuess);
+    add(plan.scan_line, "line", LineGuess);
+    if (unstored)
+      description += std::format(" metadata of {:.0f} games", unstored);
+
+    // the games lacking metadata are replayed for it
+    const double cost = left * (replay ? ReplayCost : TagsCost) + unstored * ReplayCost;
+    stages.push_back({PlanStage::Record, Access::Scan, 0, description, rows, cost, {}});
+
+    plan.cost += cost;
+    left *= no_games ? rows / no_games : 0;
+  }
+
+  plan.rows = left;
+
+  logger.debug("planned {} stages, ~{:.0f} games at a cost of {:.0f}", stages.size(), plan.rows, plan.cost);
+  return plan;
+}
+
+std::string QueryPlan::to_string() const {
+  std::string s;
+
+  for (std::size_t i = 0; i < stages.size(); ++i) {
+    const auto &stage = stages[i];
+    s += std::format("{}. {:<5} {}  (~{:.0f} games, cost {:.0f})\n", i + 1, access_name(stage.access),
+                     stage.description, stage.rows, stage.cost);
+  }
+
+  s += std::format("~{:.0f} games, cost {:.0f}\n", rows, cost);
+  return s;
+}
+
+std::string QueryPlan::to_json() const {
+  std::string s = "[";
+  for (std::size_t i = 0; i < stages.size(); ++i)
+    s += (i ? "," : "") + json_stage(stages[i]);
+
+  return std::format(R"({{"stages":{}],"rows":{:.1f},"cost":{:.1f},"probes":{}}})", s, rows, cost, probes);
+}
+
+StageStats &StageStats::operator+=(const StageStats &other) {
+  rows_in  += other.rows_in;
+  rows_out += other.rows_out;
+  probes   += other.probes;
+  pages    += other.pages;
+  bytes    += other.bytes;
+  plies    += other.plies;
+  wall_ms  += other.wall_ms;
+  cpu_ms   += other.cpu_ms;
+  return *this;
+}
+
+std::string QueryProfile::to_string() const {
+  std::string s = std::format("planning: {} probes, {:.3f} ms ({:.3f} ms cpu)\n",
+                              planning.probes, planning.wall_ms, planning.cpu_ms);
+
+  for (std::size_t i = 0; i < plan.stages.size(); ++i) {
+    const auto &stage = plan.stages[i];
+    s += std::format("{}. {:<5} {}  (~{:.0f} games, cost {:.0f})\n", i + 1, access_name(stage.access),
+                     stage.description, stage.rows, stage.cost);
+    s += "   " + (i < stages.size() ? text_stats(stages[i]) : std::string("not run")) + '\n';
+  }
+
+  s += std::format("{} games (~{:.0f} estimated) in {:.3f} ms ({:.3f} ms cpu)\n",
+                   total.rows_out, plan.rows, total.wall_ms, total.cpu_ms);
+  return s;
+}
+
+std::string QueryProfile::to_json() const {
+  std::string s = "[";
+  for (std::size_t i = 0; i < plan.stages.size(); ++i) {
+    auto stage = json_stage(plan.stages[i]);
+    stage.pop_back();
+    s += std::format(R"({}{},"actual":{}}})", i ? "," : "", stage,
+                     i < stages.size() ? json_stats(stages[i]) : "null");
+  }
+
+  return std::format(R"({{"stages":{}],"rows":{:.1f},"cost":{:.1f},"planning":{},"total":{}}})",
+                     s, plan.rows, plan.cost, json_stats(planning), json_stats(total));
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "chess/movegen.hh"
+#include "chess/position.hh"
+#include "db/material.hh"
+#include "db/metadata.hh"
+#include "db/pattern.hh"
+#include "db/tagindex.hh"
+#include "util/roaring.hh"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cdb::db {
+
+class Db;
+
+enum class TagMatch : std::uint8_t {
+  Exact,
+  Prefix,   // a word of the name starts with the text
+  Contains,
+  Similar,  // shares most trigrams, as in TagIndex::similar
+};
+
+struct TagPredicate {
+  std::string text;
+  TagMatch match = TagMatch::Exact;
+  TagField::Type fields = TagField::All;
+
+  // checks a tag value without the tag index, where similar names can only
+  // be found by containing the text
+  bool matches(std::string_view value) const;
+};
+
+struct PositionPredicate {
+  chess::Position position;
+  bool black = false; // side to move
+};
+
+/**
+ * Games matching every one of a set of predicates, e.g. games of a player
+ * since 2010 that reach a rook ending from a line of the Catalan:
+ *
+ *   Query q;
+ *   q.player("Carlsen, Magnus").begins_with(catalan).reaches(*Material::parse("KR v KR"));
+ *   q.metadata.years(2010, 2024);
+ *
+ * How the predicates are evaluated is up to QueryPlan.
+ */
+struct Query {
+  std::vector<TagPredicate> tags;
+  MetadataFilter metadata;
+
+  // reached at some point of the mainline
+  std::vector<Material> materials;
+  std::vector<PositionPredicate> positions;
+  std::vector<Pattern> patterns;
+
+  // moves the mainline begins with
+  std::vector<chess::Move> line;
+
+  Query &player(std::string_view name, TagMatch match = TagMatch::Exact) {
+    tags.push_back({std::string(name), match, TagField::Players});
+    return *this;
+  }
+
+  Query &event(std::string_view name, TagMatch match = TagMatch::Exact) {
+    tags.push_back({std::string(name), match, TagField::Event});
+    return *this;
+  }
+
+  Query &site(std::string_view name, TagMatch match = TagMatch::Exact) {
+    tags.push_back({std::string(name), match, TagField::Site});
+    return *this;
+  }
+
+  Query &reaches(const Material &m) {
+    materials.push_back(m);
+    return *this;
+  }
+
+  Query &reaches(const chess::Position &pos, bool black) {
+    positions.push_back({pos, black});
+    return *this;
+  }
+
+  Query &matches(const Pattern &pattern) {
+    patterns.push_back(pattern);
+    return *this;
+  }
+
+  Query &begins_with(std::span<const chess::Move> moves) {
+    line.assign(moves.begin(), moves.end());
+    return *this;
+  }
+
+  // the same text for queries with the same predicates in any order, with
+  // tags compared as normalised names, e.g. to cache results by
+  std::string key() const;
+};
+
+// how a stage narrows down the candidate games
+enum class Access : std::uint8_t {
+  Index, // intersects the candidates with the games of an index lookup
+  Check, // looks up each candidate's metadata
+  Scan,  // decodes each candidate's record in a pass over the pages
+};
+
+struct PlanStage {
+  enum Kind : std::uint8_t { Tag, Metadata, Position, Line, Record };
+
+  Kind kind;
+  Access access;
+  std::size_t predicate = 0; // in the query's list of that kind
+  std::string description;
+
+  double rows = 0; // estimated games matching the predicate alone
+  double cost = 0; // estimated cost, given the candidates left before it
+
+  // games of an index lookup the planner ran for its size, which it does
+  // for names and lines as they are cheap to look up
+  roaring_bitmap games;
+};
+
+/**
+ * The order in which a query's predicates are evaluated. Predicates that an
+ * index can answer become stages with an estimate of the games they match,
+ * from the sizes of index lookups or a sample of the metadata, and run from
+ * the most selective. Each stage either intersects the candidates with an
+ * index lookup or checks the candidates one by one, whichever costs less for
+ * the candidates estimated to be left. Predicates that need the games'
+ * records run last, in one pass over the pages left, and push what they imply
+ * about the metadata (material signatures, moved home pawns and ply counts)
+ * into the metadata stage.
+ *
+ * An index missing games appended since it was built is not used, and its
+ * predicates are left to the record scan. The metadata store still filters
+ * the games it holds, and the metadata of those appended since is read from
+ * their records by the record scan.
+ *
+ * Estimates assume predicates are independent.
+ */
+struct QueryPlan {
+  std::vector<PlanStage> stages;
+
+  // the query's filter with the conditions pushed down into it
+  MetadataFilter metadata;
+
+  // parts of the query left to the record scan
+  std::vector<std::size_t> scan_tags, scan_positions;
+  bool scan_line = false;
+
+  // games whose metadata the store holds, counted from the first; the
+  // record scan checks the metadata filter of the rest from their records
+  std::uint32_t metadata_games = 0;
+
+  double rows = 0; // estimated games returned
+  double cost = 0;
+
+  // index lookups and metadata samples made while planning
+  std::uint64_t probes = 0;
+
+  static QueryPlan make(const Query &query, const Db &db);
+
+  // the plan as EXPLAIN would show it, as text or as a JSON object
+  std::string to_string() const;
+  std::string to_json() const;
+};
+
+// what a stage did, measured while running it
+struct StageStats {
+  std::uint64_t rows_in = 0, rows_out = 0;
+  std::uint64_t probes = 0; // index lookups, or candidates looked up one by one
+  std::uint64_t pages = 0;  // pages whose records were read
+  std::uint64_t bytes = 0;  // bytes of records decoded
+  std::uint64_t plies = 0;  // moves replayed, including variations
+  double wall_ms = 0, cpu_ms = 0;
+
+  StageStats &operator+=(const StageStats &other);
+};
+
+/**
+ * A query's plan with what each stage did, as EXPLAIN ANALYZE would show it.
+ * Stages after the candidates run out do not run and have no stats. CPU time
+ * is that of the whole process, so it includes every thread of a scan.
+ */
+struct QueryProfile {
+  QueryPlan plan;
+  StageStats planning;
+  std::vector<StageStats> stages;
+  StageStats total;
+
+  std::string to_string() const;
+  std::string to_json() const;
+};
+
+} // cdb::db
@@ -0,0 +1,82 @@
+#include "db/querycache.hh"
+
+using namespace cdb;
+using namespace cdb::db;
+
+namespace {
+  // a list node, a hash table node and the entry itself, roughly
+  constexpr std::size_t EntryOverhead = 96;
+}
+
+bool QueryCache::advance(std::uint64_t generation) {
+  if (generation < _generation)
+    return false;
+
+  if (generation > _generation) {
+    _stats.invalidations += _entries.size();
+    _index.clear();
+    _entries.clear();
+    _stats.bytes = 0;
+    _generation = generation;
+  }
+
+  return true;
+}
+
+void QueryCache::erase(std::list<Entry>::iterator it) {
+  _stats.bytes -= it->bytes;
+  _index.erase(it->key);
+  _entries.erase(it);
+}
+
+std::optional<roaring_bitmap> QueryCache::find(std::string_view key, std::uint64_t generation) {
+  std::lock_guard lock {_mutex};
+
+  const auto it = advance(generation) ? _index.find(key) : _index.end();
+  if (it == _index.end()) {
+    ++_stats.misses;
+    return std::nullopt;
+  }
+
+  ++_stats.hits;
+  _entries.splice(_entries.begin(), _entries, it->second);
+  return it->second->games;
+}
+
+void QueryCache::insert(std::string key, std::uint64_t generation, roaring_bitmap games) {
+  games.optimize();
+  const auto bytes = key.size() + games.size_in_bytes() + EntryOverhead;
+
+  std::lock_guard lock {_mutex};
+  if (!advance(generation))
+    return;
+
+  if (const auto it = _index.find(key); it != _index.end())
+    erase(it->second);
+
+  if (bytes > _max_bytes)
+    return;
+
+  while (_stats.bytes + bytes > _max_bytes) {
+    erase(std::prev(_entries.end()));
+    ++_stats.evictions;
+  }
+
+  _entries.push_front({std::move(key), std::move(games), bytes});
+  _index.emplace(_entries.front().key, _entries.begin());
+  _stats.bytes += bytes;
+}
+
+void QueryCache::clear() {
+  std::lock_guard lock {_mutex};
+  _index.clear();
+  _entries.clear();
+  _stats.bytes = 0;
+}
+
+QueryCacheStats QueryCache::stats() const {
+  std::lock_guard lock {_mutex};
+  auto stats = _stats;
+  stats.entries = _entries.size();
+  return stats;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "util/roaring.hh"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace cdb::db {
+
+struct QueryCacheStats {
+  std::uint64_t hits = 0, misses = 0;
+  std::uint64_t evictions = 0;     // entries dropped to keep within the budget
+  std::uint64_t invalidations = 0; // entries dropped because the games changed
+  std::size_t entries = 0, bytes = 0;
+};
+
+/**
+ * Games of recent queries, keyed by Query::key, so the same query with its
+ * predicates in another order shares an entry. Entries are compressed and
+ * kept within a budget of bytes, dropping the least recently used first.
+ *
+ * Results are for a generation of the database, see Db::generation, and
+ * the first lookup or insert for a newer generation drops every entry, while
+ * results of older generations are not kept. Lookups and inserts may come
+ * from several threads at once.
+ */
+class QueryCache {
+private:
+  struct Entry {
+    std::string key;
+    roaring_bitmap games;
+    std::size_t bytes;
+  };
+
+  mutable std::mutex _mutex;
+  std::size_t _max_bytes;
+  std::uint64_t _generation = 0;
+
+  // most recently used first, with the index pointing into the list's keys
+  std::list<Entry> _entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> _index;
+  QueryCacheStats _stats;
+
+  // drops every entry if the generation is newer, or returns false if it is
+  // older. must be called locked.
+  bool advance(std::uint64_t generation);
+
+  void erase(std::list<Entry>::iterator it);
+
+public:
+  explicit QueryCache(std::size_t max_bytes) : _max_bytes(max_bytes) {}
+
+  std::size_t max_bytes() const { return _max_bytes; }
+
+  std::optional<roaring_bitmap> find(std::string_view key, std::uint64_t generation);
+
+  // keeps the games unless they alone are over the budget, dropping the least
+  // recently used entries to make room
+  void insert(std::string key, std::uint64_t generation, roaring_bitmap games);
+
+  void clear();
+
+  QueryCacheStats stats() const;
+};
+
+} // cdb::db
@@ -0,0 +1,62 @@
+#include "db/sample.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+using namespace cdb;
+using namespace cdb::db;
+
+std::vector<std::uint32_t> PageSample::order(std::uint32_t no_pages, std::uint64_t seed) {
+  std::vector<std::uint32_t> pages(no_pages);
+  std::iota(pages.begin(), pages.end(), 0);
+
+  std::mt19937_64 rng {seed};
+  std::ranges::shuffle(pages, rng);
+  return pages;
+}
+
+void PageSample::add(std::uint64_t games, std::uint64_t hits) {
+  ++_pages;
+  _games += games;
+  _hits += hits;
+
+  const auto g = static_cast<double>(games), h = static_cast<double>(hits);
+  _games_sq += g * g;
+  _cross += g * h;
+  _hits_sq += h * h;
+}
+
+CountEstimate PageSample::estimate(double z) const {
+  // the games found so far, and at most every game left besides
+  const std::uint64_t low = _hits, high = _hits + (_no_games - std::min(_games, _no_games));
+  CountEstimate estimate {low, low, high, _pages, _no_pages};
+
+  if (_pages >= _no_pages || high == low)
+    return {low, low, low, _pages, _no_pages};
+
+  if (_games == 0) {
+    estimate.count = low;
+    return estimate;
+  }
+
+  const double share = static_cast<double>(_hits) / static_cast<double>(_games);
+  const double count = share * static_cast<double>(_no_games);
+  estimate.count = std::clamp(static_cast<std::uint64_t>(std::llround(count)), low, high);
+
+  // one page says nothing of how pages vary
+  if (_pages < 2)
+    return estimate;
+
+  // the variance between pages of hits - share × games, with the correction
+  // for sampling pages without replacement
+  const double n = _pages, pages = _no_pages;
+  const double residuals = _hits_sq - 2 * share * _cross + share * share * _games_sq;
+  const double variance = pages * pages * (1 - n / pages) / n * std::max(0.0, residuals) / (n - 1);
+  const double margin = z * std::sqrt(variance);
+
+  estimate.low = std::clamp(static_cast<std::uint64_t>(std::max(0.0, std::floor(count - margin))), low, high);
+  estimate.high = std::clamp(static_cast<std::uint64_t>(std::ceil(count + margin)), low, high);
+  return estimate;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "db/scan.hh"
+
+#include <cstdint>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * A count of matching games from some of the pages, with an interval that
+ * holds the true count with the confidence the estimate was made for. The
+ * interval never goes below the games already found or above those plus the
+ * games not yet checked, so once every page is counted it is exact.
+ */
+struct CountEstimate {
+  std::uint64_t count = 0, low = 0, high = 0;
+  std::uint32_t pages = 0, no_pages = 0; // pages counted, of all of them
+
+  bool exact() const { return pages == no_pages; }
+};
+
+/**
+ * Counts of the games checked and found on pages taken in a random order,
+ * which make an estimate of the count over every page. Pages are the unit of
+ * the sample, so the count is a ratio estimate: the share of checked games
+ * found so far, times the games to check, with a standard error from how
+ * much that share varies between pages and shrinking as the pages left run
+ * out.
+ */
+class PageSample {
+private:
+  std::uint32_t _no_pages;
+  std::uint64_t _no_games;
+
+  std::uint32_t _pages = 0;
+  std::uint64_t _games = 0, _hits = 0;
+
+  // sums over pages of games², games × hits and hits², for the variance
+  double _games_sq = 0, _cross = 0, _hits_sq = 0;
+
+public:
+  // games to check on all the pages together
+  PageSample(std::uint32_t no_pages, std::uint64_t no_games) : _no_pages(no_pages), _no_games(no_games) {}
+
+  // page numbers in a random order fixed by the seed
+  static std::vector<std::uint32_t> order(std::uint32_t no_pages, std::uint64_t seed);
+
+  void add(std::uint64_t games, std::uint64_t hits);
+
+  // the interval is the estimate plus or minus z standard errors, so 1.96 for
+  // about 95% confidence
+  CountEstimate estimate(double z = 1.96) const;
+};
+
+struct SampleOptions {
+  // the scan of the sampled pages, which ends the estimates early if stopped
+  ScanOptions scan {.morsel_pages = 1};
+
+  // seed of the order pages are sampled in, so estimates repeat
+  std::uint64_t seed = 0;
+
+  // pages counted between estimates
+  std::uint32_t step_pages = 16;
+
+  // standard errors either side of the estimate, see PageSample::estimate
+  double z = 1.96;
+};
+
+} // cdb::db
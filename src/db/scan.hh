@@ -0,0 +1,388 @@
+#pragma once
+
+#include "core/error.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cdb::db {
+
+/**
+ * When to give up on work: once a stop is requested on the token, or once the
+ * deadline has passed. Scans check it before each page, so they stop within a
+ * page of either and their threads are free soon after.
+ */
+struct StopCondition {
+  using clock = std::chrono::steady_clock;
+
+  std::stop_token token;
+  clock::time_point deadline = clock::time_point::max();
+
+  // stops after a timeout from now, or on a stop request if there is a token
+  static StopCondition after(clock::duration timeout, std::stop_token token = {}) {
+    return {std::move(token), clock::now() + timeout};
+  }
+
+  bool stop_possible() const {
+    return token.stop_possible() || deadline != clock::time_point::max();
+  }
+
+  bool stopped() const {
+    return token.stop_requested() || (deadline != clock::time_point::max() && clock::now() >= deadline);
+  }
+};
+
+struct ScanOptions {
+  // workers, or all hardware threads if zero
+  unsigned threads = 0;
+
+  // consecutive pages a worker takes at a time
+  std::uint32_t morsel_pages = 8;
+
+  // results in page order, at the cost of a buffer per morsel
+  bool ordered = true;
+
+  // morsels a stream may scan ahead of its reader, or twice the workers if
+  // zero
+  std::uint32_t window = 0;
+
+  // stops the scan early, which then fails with DbError::Cancelled
+  StopCondition stop {};
+};
+
+/**
+ * Splits pages into morsels of a few consecutive pages and hands them out to
+ * a number of workers. Each worker starts with an even share of the morsels
+ * as a contiguous range, which it takes from the front of, so workers read
+ * separate parts of the file. A worker whose range runs out steals from the
+ * back of the range with the most morsels left, which evens out pages that
+ * take longer, such as those with long games or those a filter lets through.
+ *
+ * A range is a front and back packed into one atomic word, so taking from
+ * either end is one compare and swap.
+ */
+class MorselScan {
+private:
+  std::uint32_t _no_pages, _morsel_pages, _no_morsels;
+  std::vector<std::atomic<std::uint64_t>> _ranges;
+
+  StopCondition _stop;
+  std::atomic<bool> _stopped = false, _cancelled = false;
+
+  static constexpr std::uint64_t pack(std::uint32_t front, std::uint32_t back) {
+    return std::uint64_t(back) << 32 | front;
+  }
+
+  // takes the front morsel of a worker's range
+  std::optional<std::uint32_t> pop(unsigned worker) {
+    auto range = _ranges[worker].load(std::memory_order_relaxed);
+    for (;;) {
+      const std::uint32_t front = range, back = range >> 32;
+      if (front >= back)
+        return std::nullopt;
+
+      if (_ranges[worker].compare_exchange_weak(range, pack(front + 1, back), std::memory_order_relaxed))
+        return front;
+    }
+  }
+
+  // takes the back morsel of the range with the most left
+  std::optional<std::uint32_t> steal() {
+    for (;;) {
+      unsigned victim = 0;
+      std::uint32_t most = 0;
+      for (unsigned i = 0; i < _ranges.size(); ++i) {
+        const auto range = _ranges[i].load(std::memory_order_relaxed);
+        const std::uint32_t front = range, back = range >> 32;
+        if (back > front && back - front > most) {
+          victim = i;
+          most = back - front;
+        }
+      }
+
+      if (most == 0)
+        return std::nullopt;
+
+      auto range = _ranges[victim].load(std::memory_order_relaxed);
+      const std::uint32_t front = range, back = range >> 32;
+      if (front < back && _ranges[victim].compare_exchange_strong(range, pack(front, back - 1),
+                                                                  std::memory_order_relaxed))
+        return back - 1;
+    }
+  }
+
+public:
+  MorselScan(std::uint32_t no_pages, const ScanOptions &options)
+    : _no_pages(no_pages), _morsel_pages(std::max(1u, options.morsel_pages)),
+      _no_morsels((no_pages + _morsel_pages - 1) / _morsel_pages), _stop(options.stop)
+  {
+    const auto threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    const auto workers = std::max(1u, std::min(threads, _no_morsels));
+
+    _ranges = std::vector<std::atomic<std::uint64_t>>(workers);
+    for (unsigned i = 0; i < workers; ++i)
+      _ranges[i] = pack(static_cast<std::uint32_t>(std::uint64_t(_no_morsels) * i / workers),
+                        static_cast<std::uint32_t>(std::uint64_t(_no_morsels) * (i + 1) / workers));
+  }
+
+  unsigned workers() const { return _ranges.size(); }
+  std::uint32_t no_morsels() const { return _no_morsels; }
+
+  // pages first to last, exclusive, of a morsel
+  std::pair<std::uint32_t, std::uint32_t> pages(std::uint32_t morsel) const {
+    const auto first = morsel * _morsel_pages;
+    return {first, std::min(first + _morsel_pages, _no_pages)};
+  }
+
+  // whether the scan was stopped, which once seen by one worker is seen by all
+  bool stopped() {
+    if (_stopped.load(std::memory_order_relaxed))
+      return true;
+
+    if (!_stop.stopped())
+      return false;
+
+    _stopped.store(true, std::memory_order_relaxed);
+    return true;
+  }
+
+  // whether a stop left any page unscanned, which a stop after the last page
+  // does not
+  bool cancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+  // calls fn with a worker index and each morsel, once each, and returns once
+  // every morsel is done or the scan is stopped. may only be run once.
+  template <class F>
+  void run(F &&fn) {
+    const auto work = [&] (unsigned worker) {
+      for (;;) {
+        auto morsel = pop(worker);
+        if (!morsel && !(morsel = steal()))
+          break;
+
+        if (stopped()) {
+          _cancelled.store(true, std::memory_order_relaxed);
+          break;
+        }
+
+        fn(worker, *morsel);
+      }
+    };
+
+    std::vector<std::jthread> threads;
+    for (unsigned i = 1; i < workers(); ++i)
+      threads.emplace_back(work, i);
+
+    work(0);
+  }
+
+  // calls fn with each page of a morsel until the scan is stopped
+  template <class F>
+  void for_each_page(std::uint32_t morsel, F &&fn) {
+    const auto [first, last] = pages(morsel);
+    for (auto page_no = first; page_no < last; ++page_no) {
+      if (stopped()) {
+        _cancelled.store(true, std::memory_order_relaxed);
+        return;
+      }
+
+      fn(page_no);
+    }
+  }
+};
+
+// calls visit with a worker index and each page number, or fails with
+// DbError::Cancelled if stopped before the last page
+template <class F>
+std::error_code scan_pages(std::uint32_t no_pages, const ScanOptions &options, F &&visit) {
+  MorselScan scan {no_pages, options};
+
+  scan.run([&] (unsigned worker, std::uint32_t morsel) {
+    scan.for_each_page(morsel, [&] (std::uint32_t page_no) { visit(worker, page_no); });
+  });
+
+  if (scan.cancelled())
+    return DbError::Cancelled;
+
+  return {};
+}
+
+/**
+ * Calls visit with each page number and a list to append its results to,
+ * then joins the lists. Lists are kept per morsel and joined in page order if
+ * the options ask for it, or else kept per worker and joined in any order, so
+ * results that must be sorted need ordered options. Fails with
+ * DbError::Cancelled if stopped before the last page.
+ */
+template <class T, class F>
+Result<std::vector<T>> collect_pages(std::uint32_t no_pages, const ScanOptions &options, F &&visit) {
+  MorselScan scan {no_pages, options};
+  std::vector<std::vector<T>> lists(options.ordered ? scan.no_morsels() : scan.workers());
+
+  scan.run([&] (unsigned worker, std::uint32_t morsel) {
+    auto &list = lists[options.ordered ? morsel : worker];
+    scan.for_each_page(morsel, [&] (std::uint32_t page_no) { visit(page_no, list); });
+  });
+
+  if (scan.cancelled())
+    return std::unexpected(DbError::Cancelled);
+
+  std::size_t size = 0;
+  for (const auto &list : lists)
+    size += list.size();
+
+  std::vector<T> results;
+  results.reserve(size);
+  for (auto &list : lists)
+    results.insert(results.end(), std::make_move_iterator(list.begin()), std::make_move_iterator(list.end()));
+
+  return results;
+}
+
+/**
+ * Scans pages on a number of workers while a reader takes the results of
+ * each morsel in page order. Workers take morsels in order, so the first
+ * results are ready after one morsel, and never more than the window's
+ * morsels past the one the reader is waiting for, so a reader that stops
+ * reading stops the scan, with no more than the window's results buffered.
+ * Destroying the stream, or stopping it through the options, stops the
+ * workers within a page.
+ */
+template <class T>
+class MorselStream {
+public:
+  using Visit = std::function<void (std::uint32_t page_no, std::vector<T> &results)>;
+
+private:
+  struct Slot {
+    std::vector<T> results;
+    bool ready = false;
+  };
+
+  std::uint32_t _no_pages, _morsel_pages, _no_morsels;
+  Visit _visit;
+  StopCondition _stop;
+
+  std::mutex _mutex;
+  std::condition_variable _scanned, _read;
+  std::vector<Slot> _slots; // by morsel modulo the window
+  std::uint32_t _next = 0, _front = 0;
+  bool _closed = false;
+  std::atomic<bool> _stopping = false;
+
+  std::vector<std::jthread> _threads;
+
+  void work() {
+    std::unique_lock lock {_mutex};
+    for (;;) {
+      _read.wait(lock, [&] { return _closed || _next >= _no_morsels || _next < _front + _slots.size(); });
+      if (_closed || _next >= _no_morsels)
+        return;
+
+      const auto morsel = _next++;
+      lock.unlock();
+
+      std::vector<T> results;
+      const auto first = morsel * _morsel_pages, last = std::min(first + _morsel_pages, _no_pages);
+      for (auto page_no = first; page_no < last && !closed(); ++page_no)
+        _visit(page_no, results);
+
+      lock.lock();
+      if (_closed)
+        return;
+
+      _slots[morsel % _slots.size()] = {std::move(results), true};
+      _scanned.notify_all();
+    }
+  }
+
+public:
+  MorselStream(std::uint32_t no_pages, const ScanOptions &options, Visit visit)
+    : _no_pages(no_pages), _morsel_pages(std::max(1u, options.morsel_pages)),
+      _no_morsels((no_pages + _morsel_pages - 1) / _morsel_pages), _visit(std::move(visit)), _stop(options.stop)
+  {
+    const auto threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    const auto workers = std::max(1u, std::min(threads, _no_morsels));
+
+    _slots.resize(std::max(1u, options.window ? options.window : 2 * workers));
+    for (unsigned i = 0; i < workers && _no_morsels; ++i)
+      _threads.emplace_back([this] { work(); });
+  }
+
+  ~MorselStream() {
+    close();
+  }
+
+  MorselStream(const MorselStream &) = delete;
+  MorselStream &operator=(const MorselStream &) = delete;
+
+  std::uint32_t no_morsels() const { return _no_morsels; }
+
+  // whether the stream ended, once next has returned nothing, with morsels
+  // left unread because it was closed or stopped
+  bool cancelled() {
+    std::lock_guard lock {_mutex};
+    return _front < _no_morsels;
+  }
+
+  // closed by the reader, or stopped through the options
+  bool closed() {
+    if (_stopping.load(std::memory_order_relaxed))
+      return true;
+
+    if (!_stop.stopped())
+      return false;
+
+    // the reader may be waiting for a morsel that will never come
+    std::lock_guard lock {_mutex};
+    _closed = true;
+    _stopping.store(true, std::memory_order_relaxed);
+    _read.notify_all();
+    _scanned.notify_all();
+    return true;
+  }
+
+  // results of the next morsel, possibly none, or nothing once every morsel
+  // has been read or the stream is closed
+  std::optional<std::vector<T>> next() {
+    if (closed())
+      return std::nullopt;
+
+    std::unique_lock lock {_mutex};
+
+    auto &slot = _slots[_front % _slots.size()];
+    _scanned.wait(lock, [&] { return _closed || _front >= _no_morsels || slot.ready; });
+    if (_closed || _front >= _no_morsels)
+      return std::nullopt;
+
+    auto results = std::exchange(slot, {}).results;
+    ++_front;
+    _read.notify_all();
+    return results;
+  }
+
+  // stops the workers and waits for them
+  void close() {
+    {
+      std::lock_guard lock {_mutex};
+      _closed = true;
+      _stopping.store(true, std::memory_order_relaxed);
+      _read.notify_all();
+      _scanned.notify_all();
+    }
+
+    _threads.clear();
+  }
+};
+
+} // cdb::db
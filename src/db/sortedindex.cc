@@ -0,0 +1,138 @@
+#include "core/logger.hh"
+#include "db/sortedindex.hh"
+#include "util/bytesize.hh"
+
+#include <algorithm>
+#include <thread>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("sorted");
+
+Result<SortedIndex> SortedIndex::open(const fs::path &path) {
+  SortedIndex index;
+
+  if (auto ec = index._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = index._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad sorted index - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad sorted index - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  index._no_games = read_le<4>(data, 12);
+
+  std::size_t offset = HeaderSize;
+  for (std::size_t key = 0; key < NoSortKeys; ++key) {
+    const std::size_t size = EntrySize * read_le<4>(data, 16 + 4 * key);
+    if (offset + size > data.size()) {
+      logger.error("bad sorted index - entries do not fit in {} bytes", data.size());
+      return std::unexpected(DbError::Corrupted);
+    }
+
+    index._entries[key] = data.subspan(offset, size);
+    offset += size;
+  }
+
+  return index;
+}
+
+std::uint32_t SortedIndex::value(SortKey key, const GameMetadata &game) {
+  switch (key) {
+  case SortKey::Date:     return game.date;
+  case SortKey::WhiteElo: return game.white_elo;
+  case SortKey::BlackElo: return game.black_elo;
+  case SortKey::Elo:
+    return game.white_elo && game.black_elo ? (game.white_elo + game.black_elo) / 2 : 0;
+  }
+
+  return 0;
+}
+
+SortedIndex::Scan SortedIndex::scan(SortKey key, Range<std::uint32_t> values, bool descending) const {
+  const auto entries = _entries[static_cast<std::size_t>(key)];
+  const auto value = [&] (std::size_t i) -> std::uint32_t { return read_le<4>(entries, EntrySize * i); };
+
+  // first entry whose value is not below x
+  const auto lower_bound = [&] (std::uint64_t x) {
+    std::size_t lo = 0, hi = entries.size() / EntrySize;
+    while (lo < hi) {
+      const auto mid = lo + (hi - lo) / 2;
+      if (value(mid) < x)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    return lo;
+  };
+
+  if (values.min > values.max)
+    return {};
+
+  const auto first = lower_bound(values.min), last = lower_bound(std::uint64_t(values.max) + 1);
+  return {entries.subspan(EntrySize * first, EntrySize * (last - first)), descending};
+}
+
+void SortedIndexBuilder::push(const GameMetadata &game) {
+  for (std::size_t key = 0; key < NoSortKeys; ++key)
+    if (const auto value = SortedIndex::value(static_cast<SortKey>(key), game))
+      _entries[key].push_back({value, _no_games});
+
+  ++_no_games;
+}
+
+std::error_code SortedIndexBuilder::write(const fs::path &path) {
+  {
+    // each key is sorted on its own thread
+    std::vector<std::jthread> threads;
+    for (auto &entries : _entries)
+      threads.emplace_back([&entries] { std::ranges::sort(entries); });
+  }
+
+  std::size_t size = SortedIndex::HeaderSize;
+  for (const auto &entries : _entries)
+    size += SortedIndex::EntrySize * entries.size();
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::fill(data.first(SortedIndex::HeaderSize), std::byte {0});
+  std::ranges::copy(std::as_bytes(std::span {SortedIndex::Magic}), data.begin());
+  write_le<4>(data, SortedIndex::Version, 8);
+  write_le<4>(data, _no_games, 12);
+
+  std::size_t offset = SortedIndex::HeaderSize;
+  for (std::size_t key = 0; key < NoSortKeys; ++key) {
+    write_le<4>(data, static_cast<std::uint32_t>(_entries[key].size()), 16 + 4 * key);
+
+    for (const auto &[value, game] : _entries[key]) {
+      write_le<4>(data, value, offset);
+      write_le<4>(data, game, offset + 4);
+      offset += SortedIndex::EntrySize;
+    }
+  }
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote sorted orders of {} games to '{}' ({})", _no_games,
+              path.lexically_normal().string(), best_size_unit {size});
+
+  *this = SortedIndexBuilder {};
+  return {};
+}
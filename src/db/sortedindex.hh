@@ -0,0 +1,128 @@
+#pragma once
+
+#include "core/error.hh"
+#include "core/io.hh"
+#include "db/codec.hh"
+#include "db/metadata.hh"
+#include "util/iterator.hh"
+
+#include <array>
+#include <compare>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace cdb::db {
+
+// the orders games can be sorted in by a SortedIndex
+enum class SortKey : std::uint8_t {
+  Date,
+  WhiteElo,
+  BlackElo,
+  Elo, // average of both players, if both are rated
+};
+
+constexpr std::size_t NoSortKeys = 4;
+
+/**
+ * Game ids sorted by date and by Elo, so that the most recent or highest
+ * rated games are read in order instead of sorting every game. Stored in a
+ * file next to the database:
+ *
+ *  header (32 bytes)
+ *    magic "cdbsorts", u32 version, u32 game count, u32 entry count per key
+ *  entries  8 bytes each: u32 value, u32 game id, sorted by value and then
+ *           game id, for each key in turn
+ *
+ * Games whose value is unknown have no entry for that key.
+ */
+class SortedIndex {
+public:
+  static constexpr std::string_view Magic = "cdbsorts";
+  static constexpr std::uint32_t Version = 0;
+  static constexpr std::size_t HeaderSize = 32;
+  static constexpr std::size_t EntrySize = 8;
+
+  struct Entry {
+    std::uint32_t value = 0, game = 0;
+
+    auto operator<=>(const Entry &) const = default;
+  };
+
+  // a range of one key's entries, read in either direction
+  class Scan {
+  private:
+    std::span<const std::byte> _entries;
+    bool _descending = false;
+
+  public:
+    class iterator : public iterator_facade<iterator, const Entry> {
+    private:
+      const Scan *scan = nullptr;
+      std::size_t i = 0;
+      mutable Entry entry {};
+
+    public:
+      using difference_type = std::ptrdiff_t;
+
+      iterator() = default;
+      iterator(const Scan *scan, std::size_t i) : scan(scan), i(i) {}
+
+      const Entry &value() const { return entry = (*scan)[i]; }
+      void increment() { ++i; }
+      bool equal(const iterator &other) const { return i == other.i; }
+    };
+
+    Scan() = default;
+    Scan(std::span<const std::byte> entries, bool descending)
+      : _entries(entries), _descending(descending) {}
+
+    std::size_t size() const { return _entries.size() / EntrySize; }
+    bool empty() const { return _entries.empty(); }
+
+    Entry operator[](std::size_t i) const {
+      const auto offset = EntrySize * (_descending ? size() - 1 - i : i);
+      return {static_cast<std::uint32_t>(read_le<4>(_entries, offset)),
+              static_cast<std::uint32_t>(read_le<4>(_entries, offset + 4))};
+    }
+
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, size()}; }
+  };
+
+private:
+  io::mm_file _file;
+  std::uint32_t _no_games = 0;
+  std::array<std::span<const std::byte>, NoSortKeys> _entries;
+
+public:
+  SortedIndex() = default;
+
+  static Result<SortedIndex> open(const fs::path &path);
+
+  // the value a game is sorted by, or zero if unknown
+  static std::uint32_t value(SortKey key, const GameMetadata &game);
+
+  bool is_open() const { return _file.is_open(); }
+
+  // number of games the index was built over
+  std::uint32_t size() const { return _no_games; }
+
+  // entries with values in the range, from the lowest value or the highest
+  Scan scan(SortKey key, Range<std::uint32_t> values = {}, bool descending = false) const;
+};
+
+class SortedIndexBuilder {
+private:
+  std::uint32_t _no_games = 0;
+  std::array<std::vector<SortedIndex::Entry>, NoSortKeys> _entries;
+
+public:
+  // games are added in order of their ids
+  void push(const GameMetadata &game);
+
+  std::error_code write(const fs::path &path);
+};
+
+} // cdb::db
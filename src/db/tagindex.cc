@@ -0,0 +1,411 @@
+#include "core/logger.hh"
+#include "db/tagindex.hh"
+#include "util/bytesize.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+static const log::logger logger("tags");
+
+namespace {
+  // distinct trigrams of the text, sorted
+  std::vector<std::uint32_t> trigrams(std::string_view text) {
+    std::vector<std::uint32_t> out;
+    for (std::size_t i = 0; i + 3 <= text.size(); ++i)
+      out.push_back(std::uint32_t(std::uint8_t(text[i])) << 16 | std::uint32_t(std::uint8_t(text[i + 1])) << 8
+                    | std::uint8_t(text[i + 2]));
+
+    std::ranges::sort(out);
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+  }
+
+  // index of the first of count sorted entries not less than the key
+  template <class F>
+  std::uint32_t lower_bound(std::uint32_t count, F &&less) {
+    std::uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+      const auto mid = lo + (hi - lo) / 2;
+      if (less(mid))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    return lo;
+  }
+}
+
+Result<TagIndex> TagIndex::open(const fs::path &path) {
+  TagIndex index;
+
+  if (auto ec = index._file.open(path)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return std::unexpected(ec);
+  }
+
+  const auto data = index._file.span();
+  const auto MagicBytes = std::as_bytes(std::span {Magic.data(), Magic.size()});
+  if (data.size() < HeaderSize || !std::ranges::equal(data.first(Magic.size()), MagicBytes)) {
+    logger.error("bad tag index - magic does not match");
+    return std::unexpected(DbError::BadMagic);
+  }
+
+  if (const std::uint32_t version = read_le<4>(data, 8); version != Version) {
+    logger.error("bad tag index - unsupported version {}", version);
+    return std::unexpected(DbError::Corrupted);
+  }
+
+  index._no_names    = read_le<4>(data, 12);
+  index._no_words    = read_le<4>(data, 16);
+  index._no_trigrams = read_le<4>(data, 20);
+  const std::size_t no_name_ids   = read_le<8>(data, 24);
+  const std::size_t heap_size     = read_le<8>(data, 32);
+  const std::size_t postings_size = read_le<8>(data, 40);
+  index._no_games = read_le<4>(data, 48);
+
+  const std::array<std::size_t, 6> sizes {
+    NameSize * index._no_names, WordSize * index._no_words, TrigramSize * index._no_trigrams,
+    4 * no_name_ids, heap_size, postings_size
+  };
+
+  std::size_t offset = HeaderSize;
+  std::array<std::span<const std::byte>, 6> sections;
+  for (std::size_t i = 0; i < sizes.size(); ++i) {
+    if (sizes[i] > data.size() - offset) {
+      logger.error("bad tag index - {} names do not fit in {} bytes", index._no_names, data.size());
+      return std::unexpected(DbError::Corrupted);
+    }
+
+    sections[i] = data.subspan(offset, sizes[i]);
+    offset += sizes[i];
+  }
+
+  index._names    = sections[0];
+  index._words    = sections[1];
+  index._trigrams = sections[2];
+  index._name_ids = sections[3];
+  index._heap     = sections[4];
+  index._postings = sections[5];
+
+  return index;
+}
+
+std::string TagIndex::normalise(std::string_view value) {
+  std::string s;
+  s.reserve(value.size());
+
+  for (const char c : value) {
+    const auto u = static_cast<unsigned char>(c);
+
+    if (u >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+      s += c;
+    else if (c >= 'A' && c <= 'Z')
+      s += static_cast<char>(c - 'A' + 'a');
+    else if ((c == ' ' || c == ',' || c == '-' || c == '.' || c == '_' || c == '/') && !s.empty() && s.back() != ' ')
+      s += ' ';
+  }
+
+  if (!s.empty() && s.back() == ' ')
+    s.pop_back();
+
+  return s;
+}
+
+std::vector<std::uint32_t> TagIndex::trigram_names(std::uint32_t trigram) const {
+  const auto i = lower_bound(_no_trigrams, [&] (std::uint32_t j) {
+    return read_le<4>(_trigrams, TrigramSize * j) < trigram;
+  });
+
+  if (i == _no_trigrams || read_le<4>(_trigrams, TrigramSize * i) != trigram)
+    return {};
+
+  const std::size_t first = read_le<4>(_trigrams, TrigramSize * i + 4);
+  const std::size_t count = read_le<4>(_trigrams, TrigramSize * i + 8);
+
+  std::vector<std::uint32_t> names(count);
+  for (std::size_t j = 0; j < count; ++j)
+    names[j] = read_le<4>(_name_ids, 4 * (first + j));
+
+  return names;
+}
+
+roaring_bitmap TagIndex::games(std::span<const std::uint32_t> names, TagField::Type fields) const {
+  std::vector<PositionEntry> entries;
+  std::vector<std::uint32_t> ids;
+
+  for (const auto i : names) {
+    const auto entry = _names.subspan(NameSize * i, NameSize);
+    const Postings postings {_postings.subspan(read_le<8>(entry, 8)), read_le<4>(entry, 16)};
+
+    entries.clear();
+    postings.decode(entries);
+
+    for (const auto &[game, field] : entries)
+      if (field & fields)
+        ids.push_back(game);
+  }
+
+  std::ranges::sort(ids);
+  return roaring_bitmap::from_sorted(ids);
+}
+
+roaring_bitmap TagIndex::exact(std::string_view value, TagField::Type fields) const {
+  const auto s = normalise(value);
+  const auto i = lower_bound(_no_names, [&] (std::uint32_t j) { return name(j) < s; });
+
+  if (i == _no_names || name(i) != s)
+    return {};
+
+  return games(std::span {&i, 1}, fields);
+}
+
+roaring_bitmap TagIndex::prefix(std::string_view text, TagField::Type fields) const {
+  const auto s = normalise(text);
+  if (s.empty())
+    return {};
+
+  // names with a word starting with the first word of the text, which are
+  // then checked for the rest of it
+  const auto first_word = std::string_view {s}.substr(0, s.find(' '));
+  const auto begin = lower_bound(_no_words, [&] (std::uint32_t j) { return word(j) < first_word; });
+
+  std::vector<std::uint32_t> candidates;
+  for (auto i = begin; i < _no_words && word(i).starts_with(first_word); ++i) {
+    const auto entry = _words.subspan(WordSize * i, WordSize);
+    const std::size_t first = read_le<4>(entry, 8), count = read_le<4>(entry, 12);
+
+    for (std::size_t j = 0; j < count; ++j)
+      candidates.push_back(read_le<4>(_name_ids, 4 * (first + j)));
+  }
+
+  std::ranges::sort(candidates);
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+  const auto at_word = " " + s;
+  std::erase_if(candidates, [&] (std::uint32_t i) {
+    const auto n = name(i);
+    return !n.starts_with(s) && n.find(at_word) == std::string_view::npos;
+  });
+
+  return games(candidates, fields);
+}
+
+roaring_bitmap TagIndex::contains(std::string_view text, TagField::Type fields) const {
+  const auto s = normalise(text);
+  if (s.empty())
+    return {};
+
+  std::vector<std::uint32_t> candidates;
+
+  if (s.size() < 3) {
+    // too short for a trigram, so every name is checked
+    for (std::uint32_t i = 0; i < _no_names; ++i)
+      candidates.push_back(i);
+  } else {
+    // names with every trigram of the text, starting from the rarest
+    std::vector<std::vector<std::uint32_t>> lists;
+    for (const auto trigram : trigrams(s))
+      lists.push_back(trigram_names(trigram));
+
+    std::ranges::sort(lists, {}, [] (const auto &list) { return list.size(); });
+    candidates = std::move(lists.front());
+
+    for (std::size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+      std::vector<std::uint32_t> both;
+      std::ranges::set_intersection(candidates, lists[i], std::back_inserter(both));
+      candidates = std::move(both);
+    }
+  }
+
+  std::erase_if(candidates, [&] (std::uint32_t i) { return name(i).find(s) == std::string_view::npos; });
+  return games(candidates, fields);
+}
+
+roaring_bitmap TagIndex::similar(std::string_view text, double min_shared, TagField::Type fields) const {
+  const auto s = normalise(text);
+  const auto query = trigrams(s);
+  if (query.empty())
+    return contains(text, fields);
+
+  // counts the trigrams each name shares with the text
+  std::map<std::uint32_t, std::size_t> shared;
+  for (const auto trigram : query)
+    for (const auto i : trigram_names(trigram))
+      ++shared[i];
+
+  const auto min_count = std::max<std::size_t>(1, std::ceil(min_shared * query.size()));
+
+  std::vector<std::uint32_t> names;
+  for (const auto &[i, count] : shared)
+    if (count >= min_count)
+      names.push_back(i);
+
+  return games(names, fields);
+}
+
+void TagIndexBuilder::add(std::uint32_t game, TagId::Type tag, std::string_view value) {
+  const auto field = TagField::of(tag);
+  if (!field)
+    return;
+
+  auto [it, inserted] = _values.try_emplace(value, nullptr);
+  if (inserted) {
+    const auto name = TagIndex::normalise(value);
+    it->second = name.empty() ? nullptr : &_names[name];
+  }
+
+  if (it->second)
+    it->second->push_back({game, field});
+}
+
+void TagIndexBuilder::merge(TagIndexBuilder &&other) {
+  for (auto &[name, entries] : other._names) {
+    auto &to = _names[name];
+    to.insert(to.end(), entries.begin(), entries.end());
+  }
+
+  other = {};
+
+  // the pointers into the other builder's names are gone
+  _values.clear();
+}
+
+std::error_code TagIndexBuilder::write(const fs::path &path, std::uint32_t no_games) {
+  using Name = std::pair<std::string_view, std::vector<PositionEntry> *>;
+
+  std::vector<Name> names;
+  names.reserve(_names.size());
+  for (auto &[name, entries] : _names)
+    names.push_back({name, &entries});
+
+  std::ranges::sort(names, {}, &Name::first);
+
+  // name ids of each word and trigram, in the order of the names
+  std::map<std::string_view, std::vector<std::uint32_t>> words;
+  std::map<std::uint32_t, std::vector<std::uint32_t>> trigram_lists;
+  std::size_t heap_size = 0, postings_size = 0, no_name_ids = 0;
+
+  for (std::uint32_t i = 0; i < names.size(); ++i) {
+    auto &[name, entries] = names[i];
+
+    std::ranges::sort(*entries);
+    entries->erase(std::unique(entries->begin(), entries->end()), entries->end());
+    postings_size += Postings::encoded_size(*entries);
+    heap_size += name.size();
+
+    for (std::size_t start = 0; start < name.size(); ) {
+      const auto end = std::min(name.find(' ', start), name.size());
+      auto &list = words[name.substr(start, end - start)];
+      if (list.empty() || list.back() != i)
+        list.push_back(i);
+
+      start = end + 1;
+    }
+
+    for (const auto trigram : trigrams(name))
+      trigram_lists[trigram].push_back(i);
+  }
+
+  for (const auto &[word, list] : words) {
+    heap_size += word.size();
+    no_name_ids += list.size();
+  }
+
+  for (const auto &[trigram, list] : trigram_lists)
+    no_name_ids += list.size();
+
+  if (heap_size > std::numeric_limits<std::uint32_t>::max()
+      || no_name_ids > std::numeric_limits<std::uint32_t>::max()) {
+    logger.error("{} names do not fit in a tag index", names.size());
+    return DbError::OutOfMemory;
+  }
+
+  const auto names_offset    = TagIndex::HeaderSize;
+  const auto words_offset    = names_offset + TagIndex::NameSize * names.size();
+  const auto trigrams_offset = words_offset + TagIndex::WordSize * words.size();
+  const auto ids_offset      = trigrams_offset + TagIndex::TrigramSize * trigram_lists.size();
+  const auto heap_offset     = ids_offset + 4 * no_name_ids;
+  const auto postings_offset = heap_offset + heap_size;
+  const auto size            = postings_offset + postings_size;
+
+  io::mm_file file;
+  if (auto ec = file.open(path, size)) {
+    logger.error("failed to open file '{}' ({})", path.lexically_normal().string(), ec.message());
+    return ec;
+  }
+
+  auto data = file.mutable_span();
+  std::ranges::copy(std::as_bytes(std::span {TagIndex::Magic}), data.begin());
+  write_le<4>(data, TagIndex::Version, 8);
+  write_le<4>(data, static_cast<std::uint32_t>(names.size()), 12);
+  write_le<4>(data, static_cast<std::uint32_t>(words.size()), 16);
+  write_le<4>(data, static_cast<std::uint32_t>(trigram_lists.size()), 20);
+  write_le<8>(data, std::uint64_t(no_name_ids), 24);
+  write_le<8>(data, std::uint64_t(heap_size), 32);
+  write_le<8>(data, std::uint64_t(postings_size), 40);
+  write_le<4>(data, no_games, 48);
+  write_le<4>(data, 0u, 52);
+  write_le<8>(data, std::uint64_t(0), 56);
+
+  std::size_t heap = 0, postings = 0, ids = 0;
+
+  const auto put_text = [&] (std::string_view text, std::size_t offset) {
+    write_le<4>(data, static_cast<std::uint32_t>(heap), offset);
+    write_le<4>(data, static_cast<std::uint32_t>(text.size()), offset + 4);
+    std::ranges::copy(std::as_bytes(std::span {text}), data.begin() + heap_offset + heap);
+    heap += text.size();
+  };
+
+  const auto put_ids = [&] (const std::vector<std::uint32_t> &list, std::size_t offset) {
+    write_le<4>(data, static_cast<std::uint32_t>(ids), offset);
+    write_le<4>(data, static_cast<std::uint32_t>(list.size()), offset + 4);
+    for (const auto id : list)
+      write_le<4>(data, id, ids_offset + 4 * ids++);
+  };
+
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    const auto &[name, entries] = names[i];
+    const auto offset = names_offset + TagIndex::NameSize * i;
+
+    put_text(name, offset);
+    write_le<8>(data, std::uint64_t(postings), offset + 8);
+    write_le<4>(data, static_cast<std::uint32_t>(entries->size()), offset + 16);
+    write_le<4>(data, 0u, offset + 20);
+
+    Postings::encode(*entries, data.subspan(postings_offset + postings));
+    postings += Postings::encoded_size(*entries);
+  }
+
+  std::size_t i = 0;
+  for (const auto &[word, list] : words) {
+    const auto offset = words_offset + TagIndex::WordSize * i++;
+    put_text(word, offset);
+    put_ids(list, offset + 8);
+  }
+
+  i = 0;
+  for (const auto &[trigram, list] : trigram_lists) {
+    const auto offset = trigrams_offset + TagIndex::TrigramSize * i++;
+    write_le<4>(data, trigram, offset);
+    put_ids(list, offset + 4);
+  }
+
+  file.sync();
+  file.close();
+
+  logger.info("wrote {} names ({} words, {} trigrams) to '{}' ({})", names.size(), words.size(),
+              trigram_lists.size(), path.lexically_normal().string(), best_size_unit {size});
+
+  *this = {};
+  return {};
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "core/error.hh"
+#include "core/io.hh"
+#include "db/codec.hh"
+#include "db/postings.hh"
+#include "util/roaring.hh"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cdb::db {
+
+// the tags that are indexed by name, as bits of a mask
+namespace TagField {
+  using Type = std::uint8_t;
+  constexpr Type White   = 0x1;
+  constexpr Type Black   = 0x2;
+  constexpr Type Event   = 0x4;
+  constexpr Type Site    = 0x8;
+  constexpr Type Players = White | Black;
+  constexpr Type All     = 0xf;
+
+  // zero for tags that are not indexed
+  constexpr Type of(TagId::Type id) {
+    switch (id) {
+    case TagId::White: return White;
+    case TagId::Black: return Black;
+    case TagId::Event: return Event;
+    case TagId::Site:  return Site;
+    default:           return 0;
+    }
+  }
+}
+
+/**
+ * Maps player, event and site names to the games they appear in, stored in a
+ * file next to the database:
+ *
+ *  header (64 bytes)
+ *    magic "cdbtagix", u32 version, u32 name count, u32 word count,
+ *    u32 trigram count, u64 name id count, u64 heap size, u64 posting data
+ *    size, u32 game count, u32 reserved, u64 reserved
+ *  names      24 bytes each, sorted by text: u32 heap offset, u32 length,
+ *             u64 posting list offset, u32 posting list count, u32 reserved
+ *  words      16 bytes each, sorted by text: u32 heap offset, u32 length,
+ *             u32 first name id, u32 name id count
+ *  trigrams   12 bytes each, sorted: u32 trigram, u32 first name id,
+ *             u32 name id count
+ *  name ids   u32 sorted lists of the names containing each word and trigram
+ *  heap       text of names and words
+ *  postings   a posting list per name, as in Postings, with the TagField the
+ *             name was found in as the ply
+ *
+ * Names are normalised first (see normalise), and the same name in different
+ * tags is one entry. Words give exact and prefix matches, and trigrams give
+ * substring and fuzzy matches, on the names rather than the games, which are
+ * far fewer. Matching names are checked against the query and their posting
+ * lists are merged into a set of games. Games from the game count on were
+ * appended after the index was built and are not in it.
+ */
+class TagIndex {
+public:
+  static constexpr std::string_view Magic = "cdbtagix";
+  static constexpr std::uint32_t Version = 1;
+  static constexpr std::size_t HeaderSize  = 64;
+  static constexpr std::size_t NameSize    = 24;
+  static constexpr std::size_t WordSize    = 16;
+  static constexpr std::size_t TrigramSize = 12;
+
+private:
+  io::mm_file _file;
+  std::uint32_t _no_names = 0, _no_words = 0, _no_trigrams = 0, _no_games = 0;
+  std::span<const std::byte> _names, _words, _trigrams, _name_ids, _heap, _postings;
+
+  std::string_view text(std::span<const std::byte> entry) const {
+    const auto offset = read_le<4>(entry), length = read_le<4>(entry, 4);
+    return {reinterpret_cast<const char *>(_heap.data()) + offset, length};
+  }
+
+  std::string_view name(std::uint32_t i) const { return text(_names.subspan(NameSize * i, NameSize)); }
+  std::string_view word(std::uint32_t i) const { return text(_words.subspan(WordSize * i, WordSize)); }
+
+  // the names containing a trigram
+  std::vector<std::uint32_t> trigram_names(std::uint32_t trigram) const;
+
+  // the games of the names, in any of the fields
+  roaring_bitmap games(std::span<const std::uint32_t> names, TagField::Type fields) const;
+
+public:
+  TagIndex() = default;
+
+  static Result<TagIndex> open(const fs::path &path);
+
+  bool is_open() const { return _file.is_open(); }
+
+  // number of distinct names
+  std::uint32_t size() const { return _no_names; }
+
+  // games [0, no_games()) are indexed
+  std::uint32_t no_games() const { return _no_games; }
+
+  /**
+   * Lower case ASCII words separated by single spaces, so that
+   * "Carlsen,  Magnus" becomes "carlsen magnus". Other punctuation is dropped
+   * and bytes outside ASCII are kept as they are.
+   */
+  static std::string normalise(std::string_view value);
+
+  // names equal to the value
+  roaring_bitmap exact(std::string_view value, TagField::Type fields = TagField::All) const;
+
+  // names with a word starting with the text, e.g. "carls" or "wijk aan"
+  roaring_bitmap prefix(std::string_view text, TagField::Type fields = TagField::All) const;
+
+  // names containing the text anywhere
+  roaring_bitmap contains(std::string_view text, TagField::Type fields = TagField::All) const;
+
+  // names sharing at least a fraction of the text's trigrams, which allows
+  // for misspellings such as "carlson"
+  roaring_bitmap similar(std::string_view text, double min_shared = 0.5,
+                         TagField::Type fields = TagField::All) const;
+};
+
+/**
+ * Collects the names of games' tags. Builders filled from separate threads
+ * are merged before writing.
+ */
+class TagIndexBuilder {
+private:
+  // entries of each normalised name, with the field as the ply
+  std::unordered_map<std::string, std::vector<PositionEntry>> _names;
+
+  // the same raw values recur in many games, so their normalised entries are
+  // looked up by the value, which must outlive the builder
+  std::unordered_map<std::string_view, std::vector<PositionEntry> *> _values;
+
+public:
+  // values of tags that are not indexed are ignored
+  void add(std::uint32_t game, TagId::Type tag, std::string_view value);
+
+  void merge(TagIndexBuilder &&other);
+
+  // no_games is the number of games the tags were collected from
+  std::error_code write(const fs::path &path, std::uint32_t no_games);
+};
+
+} // cdb::db
@@ -0,0 +1,106 @@
+#include "db/db.hh"
+#include "db/import.hh"
+#include "tests/fixture.hh"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+// enough copies of the games to fill several pages past the imported one
+constexpr unsigned NoCopies = 400;
+
+int main(int, char *[]) {
+  // a small import leaves little room, so appends grow the file
+  auto db = test::import("append");
+  if (!db || db->no_games() != 5) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+
+  ImportOptions inline_names;
+  inline_names.intern_names = false;
+
+  // the page of an appended game keeps its old filter until the next
+  // commit, and is searched all the same
+  const auto flank = test::after("1. h4 h5 2. a4");
+  if (Importer(*db, inline_names).import_pgn("1. h4 h5 2. a4 *\n")
+      || db->find(flank, true) != std::vector<PositionEntry> {{5, 3}}) {
+    std::cerr << "bad hits in an appended game before a commit\n";
+    return -1;
+  }
+
+  db->commit();
+  if (db->find(flank, true) != std::vector<PositionEntry> {{5, 3}}) {
+    std::cerr << "bad hits in an appended game after a commit\n";
+    return -1;
+  }
+
+  std::string games;
+  for (unsigned i = 0; i < NoCopies; ++i)
+    games.append(test::Pgn).append("\n");
+
+  if (auto ec = Importer(*db, inline_names).import_pgn(games); ec || db->no_games() != 5 * (NoCopies + 1) + 1) {
+    std::cerr << "failed to append games (" << ec.message() << ")\n";
+    return -1;
+  }
+
+  const auto carlsen = Query {}.player("Carlsen, Magnus");
+  if (db->select(carlsen)->cardinality() != 4 * (NoCopies + 1)) {
+    std::cerr << "bad games after appending\n";
+    return -1;
+  }
+
+  // the metadata store lacks the appended games, whose metadata is read from
+  // their records instead
+  Query short_games, recent;
+  short_games.metadata.ply_count.max = 3;
+  recent.metadata.years(2015, 2018);
+
+  std::error_code stream_status, estimate_status;
+  std::uint64_t streamed = 0;
+  for (auto ids = db->stream(recent, {}, &stream_status); ids; ids())
+    ++streamed;
+
+  CountEstimate estimate;
+  for (auto it = db->estimate(recent, {}, &estimate_status); it; )
+    estimate = it();
+
+  if (db->select(short_games)->to_vector() != std::vector<std::uint32_t> {5}
+      || db->select(recent)->cardinality() != 2 * (NoCopies + 1) || streamed != 2 * (NoCopies + 1)
+      || !estimate.exact() || estimate.count != 2 * (NoCopies + 1) || stream_status || estimate_status) {
+    std::cerr << "bad games by the metadata of appended games\n";
+    return -1;
+  }
+
+  // the latest games are copies of game 4, appended from id 6 on, and the
+  // earliest are game 1 and its first copy. the index and the metadata hold
+  // the imported games, and a few candidates are looked up in the metadata.
+  const auto last_copy = [] (unsigned game, unsigned k) { return 6 + 5 * (NoCopies - 1 - k) + game; };
+  const auto few = roaring_bitmap::from_sorted(std::vector<std::uint32_t> {1, 7, last_copy(4, 0)});
+  if (db->top(SortKey::Date, 3) != std::vector<std::uint32_t> {last_copy(4, 0), last_copy(4, 1), last_copy(4, 2)}
+      || db->top(SortKey::Date, 2, false) != std::vector<std::uint32_t> {1, 7}
+      || db->top(SortKey::Date, 2, false, &few) != std::vector<std::uint32_t> {1, 7}) {
+    std::cerr << "bad top games after appending\n";
+    return -1;
+  }
+
+  // the file is cut to the pages in use on close, and grows again on the
+  // next append
+  db->close();
+
+  auto reopened = Db::open(test::db_path("append"));
+  if (!reopened || reopened->no_games() != 5 * (NoCopies + 1) + 1
+      || Importer(*reopened, inline_names).import_pgn(games)
+      || reopened->select(carlsen)->cardinality() != 4 * (2 * NoCopies + 1)) {
+    std::cerr << "bad games after reopening\n";
+    return -1;
+  }
+
+  reopened->close();
+  test::remove("append");
+  return 0;
+}
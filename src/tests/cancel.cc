@@ -0,0 +1,165 @@
+#include "db/db.hh"
+#include "db/scan.hh"
+#include "tests/fixture.hh"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stop_token>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+template <class T>
+bool cancelled(const Result<T> &result) {
+  return !result && result.error() == DbError::Cancelled;
+}
+
+int main(int, char *[]) {
+  using namespace std::chrono_literals;
+
+  // a stop requested part way through leaves the remaining pages unscanned
+  for (const unsigned threads : {1u, 4u}) {
+    std::stop_source source;
+    std::atomic<unsigned> visited = 0;
+    const auto pages = collect_pages<std::uint32_t>(1000, {threads, 1, true, 0, {source.get_token()}},
+                                                    [&] (std::uint32_t page_no, auto &out) {
+      if (++visited == 10)
+        source.request_stop();
+
+      out.push_back(page_no);
+    });
+
+    if (!cancelled(pages) || visited >= 10 + threads) {
+      std::cerr << "scanned " << visited << " pages after a stop on " << threads << " threads\n";
+      return -1;
+    }
+  }
+
+  // nothing is scanned past a deadline
+  std::atomic<unsigned> visited = 0;
+  const auto expired = StopCondition::after(-1s);
+  if (!expired.stopped() || !expired.stop_possible() || StopCondition {}.stop_possible()
+      || scan_pages(1000, {4, 1, true, 0, expired}, [&] (unsigned, std::uint32_t) { ++visited; }) != DbError::Cancelled
+      || visited != 0) {
+    std::cerr << "bad scan past a deadline\n";
+    return -1;
+  }
+
+  // a stream ends early once stopped
+  {
+    std::stop_source source;
+    MorselStream<std::uint32_t> stream {1000, {4, 1, true, 4, {source.get_token()}}, [] (std::uint32_t page_no, auto &out) {
+      out.push_back(page_no);
+    }};
+
+    unsigned morsels = 0;
+    while (stream.next()) {
+      if (++morsels == 3)
+        source.request_stop();
+    }
+
+    if (morsels >= 1000 || !stream.cancelled()) {
+      std::cerr << "stream ran to the end after a stop\n";
+      return -1;
+    }
+  }
+
+  // a stop after the last page leaves nothing unscanned
+  {
+    std::stop_source source;
+    const auto pages = collect_pages<std::uint32_t>(10, {1, 1, true, 0, {source.get_token()}},
+                                                    [&] (std::uint32_t page_no, auto &out) {
+      if (page_no == 9)
+        source.request_stop();
+
+      out.push_back(page_no);
+    });
+
+    if (!pages || pages->size() != 10) {
+      std::cerr << "scan cancelled after its last page\n";
+      return -1;
+    }
+  }
+
+  // an import stopped before it starts
+  ImportOptions stopped_import;
+  stopped_import.stop = expired;
+  if (const auto db = test::import("cancel", test::Pgn, test::PageCopies, stopped_import); !cancelled(db)) {
+    std::cerr << "import ran past a deadline\n";
+    return -1;
+  }
+
+  test::remove("cancel");
+
+  // queries and scans of a database, stopped by a deadline or from a scan
+  auto db = test::import("cancel", test::Pgn, test::PageCopies);
+  const auto pattern = Pattern::parse("Bg2");
+  if (!db || db->no_games() != 5 * test::PageCopies || !pattern) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+  const ScanOptions past_deadline {.stop = expired};
+  if (!cancelled(db->select(Query {}.matches(*pattern), past_deadline)) || !cancelled(db->find(*pattern, past_deadline))
+      || !cancelled(db->filter([] (std::uint32_t, auto) { return true; }, past_deadline))
+      || db->build_tag_index(past_deadline) != DbError::Cancelled) {
+    std::cerr << "bad queries past a deadline\n";
+    return -1;
+  }
+
+  std::stop_source source;
+  std::atomic<unsigned> checked = 0;
+  const auto games = db->filter([&] (std::uint32_t, auto) {
+    if (++checked == 1)
+      source.request_stop();
+
+    return true;
+  }, {2, 1, true, 0, {source.get_token()}});
+
+  if (!cancelled(games) || checked >= db->no_games()) {
+    std::cerr << "checked " << checked << " games after a stop\n";
+    return -1;
+  }
+
+  // streams and estimates tell a stop from the end of the games
+  std::error_code status;
+  unsigned streamed = 0;
+  for (auto games = db->stream(Query {}.matches(*pattern), past_deadline, &status); games; games())
+    ++streamed;
+
+  if (status != DbError::Cancelled || streamed != 0) {
+    std::cerr << "bad stream past a deadline\n";
+    return -1;
+  }
+
+  for (auto games = db->stream(Query {}.matches(*pattern), {}, &status); games; games())
+    ++streamed;
+
+  if (status || streamed != 2 * test::PageCopies) {
+    std::cerr << "bad status of a finished stream\n";
+    return -1;
+  }
+
+  std::vector<CountEstimate> estimates;
+  for (auto it = db->estimate(Query {}.matches(*pattern), {.scan = past_deadline}, &status); it; )
+    estimates.push_back(it());
+
+  if (status != DbError::Cancelled || estimates.empty() || estimates.back().exact()) {
+    std::cerr << "bad estimates past a deadline\n";
+    return -1;
+  }
+
+  // a stopped query is not cached, and the same query then runs in full
+  db->enable_cache(1 << 20);
+  const auto query = Query {}.matches(*pattern);
+  if (!cancelled(db->select(query, past_deadline)) || db->select(query)->cardinality() != 2 * test::PageCopies) {
+    std::cerr << "bad query after a stopped one\n";
+    return -1;
+  }
+
+  db->close();
+  test::remove("cancel");
+  return 0;
+}
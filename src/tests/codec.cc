@@ -0,0 +1,261 @@
+#include "chess/movegen.hh"
+#include "chess/notation.hh"
+#include "db/codec.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+struct Expected {
+  Move move;
+  Position next;
+  unsigned depth;
+  std::string_view comment;
+};
+
+struct Line {
+  GameEncoder &enc;
+  std::vector<Expected> &expected;
+  Position pos;
+  bool black;
+  unsigned depth;
+
+  bool play(std::string_view san, std::string_view comment = {}) {
+    const auto move = parse_san(san, pos, black);
+    if (!move) {
+      std::cerr << "failed to parse " << san << " in " << pos.to_fen(black) << '\n';
+      return false;
+    }
+
+    enc.move(*move);
+    if (!comment.empty())
+      (void)enc.comment(comment);
+
+    pos = make_move(pos, *move);
+    black ^= 1;
+    expected.push_back({*move, pos, depth, comment});
+    return true;
+  }
+};
+
+bool check(std::span<const std::byte> data, const std::vector<Expected> &expected,
+           DecodeMode::Type mode) {
+  std::size_t i = 0;
+  auto it = GameDecoder(data, mode);
+
+  for (; it != GameDecoder(); ++it, ++i) {
+    if (i >= expected.size()) {
+      std::cerr << "mode " << int(mode) << ": decoded too many moves\n";
+      return false;
+    }
+
+    const auto &step = *it;
+    const auto &e = expected[i];
+
+    if (Token::encode(step.move()) != Token::encode(e.move)) {
+      std::cerr << "mode " << int(mode) << ": expected " << e.move << ", got " << step.move() << '\n';
+      return false;
+    }
+
+    if (step.variation_depth() != e.depth) {
+      std::cerr << "mode " << int(mode) << ": bad variation depth at step " << i << '\n';
+      return false;
+    }
+
+    const auto comment = (mode & DecodeMode::SkipAnnotations) ? std::string_view {} : e.comment;
+    if (step.comment() != comment) {
+      std::cerr << "mode " << int(mode) << ": bad comment at step " << i << '\n';
+      return false;
+    }
+
+    // lazy modes only materialise some positions, so the rest must be replayed
+    if ((mode & DecodeMode::LazyPositions) && i % 3 != 2)
+      continue;
+
+    if (step.next() != e.next) {
+      std::cerr << "mode " << int(mode) << ": bad position after " << e.move << '\n';
+      return false;
+    }
+  }
+
+  if (it.error()) {
+    std::cerr << "mode " << int(mode) << ": " << it.error().message() << '\n';
+    return false;
+  }
+
+  if (i != expected.size()) {
+    std::cerr << "mode " << int(mode) << ": decoded " << i << " of " << expected.size() << " moves\n";
+    return false;
+  }
+
+  return true;
+}
+
+struct Decoded {
+  Token::Type move;
+  Position next;
+  unsigned ply, depth;
+};
+
+std::vector<Decoded> decode(GameDecoder it) {
+  std::vector<Decoded> steps;
+  for (; it != GameDecoder(); ++it)
+    steps.push_back({Token::encode(it->move()), it->next(), it->ply(), it->variation_depth()});
+
+  return steps;
+}
+
+bool check_checkpoints(std::span<const std::byte> data, std::span<const std::byte> checkpoints) {
+  const auto all = decode(GameDecoder(data));
+  if (checkpoints.empty()) {
+    std::cerr << "no checkpoints written\n";
+    return false;
+  }
+
+  for (unsigned ply = 0; ply <= all.back().ply; ++ply) {
+    const auto checkpoint = find_checkpoint(checkpoints, ply);
+    if (!checkpoint)
+      continue;
+
+    if (checkpoint->ply > ply) {
+      std::cerr << "checkpoint at ply " << checkpoint->ply << " is after ply " << ply << '\n';
+      return false;
+    }
+
+    // decoding from the checkpoint must give the tail of the full decode
+    const auto tail = decode(GameDecoder(data, *checkpoint, DecodeMode::LazyPositions));
+    const auto start = std::ranges::find_if(all, [&] (const Decoded &d) {
+      return d.depth == 0 && d.ply == checkpoint->ply + 1u;
+    });
+
+    if (tail.size() != std::size_t(all.end() - start)) {
+      std::cerr << "decoded " << tail.size() << " steps from checkpoint at ply "
+                << checkpoint->ply << '\n';
+      return false;
+    }
+
+    for (std::size_t i = 0; i < tail.size(); ++i) {
+      const auto &a = start[i], &b = tail[i];
+      if (a.move != b.move || a.next != b.next || a.ply != b.ply || a.depth != b.depth) {
+        std::cerr << "mismatch at step " << i << " from checkpoint at ply " << checkpoint->ply << '\n';
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool check_tags() {
+  using TagList = std::array<std::pair<std::string_view, std::string_view>, 14>;
+  constexpr TagList tags {{
+    {"Event", "001.Praga"}, {"Site", "?"}, {"Date", "1929.??.??"}, {"Round", "?"},
+    {"White", "Opocensky, Karel"}, {"Black", "Flohr, Salo"}, {"Result", "0-1"},
+    {"ECO", "D30"}, {"WhiteElo", "2455"}, {"Annotator", "Franco Pezzi"},
+    {"EventDate", "sometime in 1929"}, {"Board", "3"}, {"PlyCount", "0123"},
+    {"Date", "1929.00.??"}
+  }};
+
+  TagEncoder enc;
+  for (const auto &[name, value] : tags)
+    enc.add(name, value);
+
+  std::size_t i = 0;
+  auto it = TagDecoder(enc.data());
+  for (; it != TagDecoder(); ++it, ++i) {
+    const auto &[name, value] = tags[i];
+
+    if (it->name != name || it->to_string() != value) {
+      std::cerr << "expected tag " << name << " " << value << ", got "
+                << it->name << " " << it->to_string() << '\n';
+      return false;
+    }
+
+    // values that could not be packed fall back to custom tags
+    const bool packed = TagKind::of(TagId::from_name(name)) != TagKind::String;
+    if (packed && it->kind == TagKind::String && it->id != TagId::Custom) {
+      std::cerr << "expected tag " << name << " to be packed\n";
+      return false;
+    }
+  }
+
+  if (it.error() || i != tags.size()) {
+    std::cerr << "decoded " << i << " of " << tags.size() << " tags\n";
+    return false;
+  }
+
+  const auto date = TagValue::pack_date("2015.06.21");
+  if (!date || TagValue::year(*date) != 2015 || TagValue::month(*date) != 6
+            || TagValue::day(*date) != 21 || *date <= *TagValue::pack_date("2015.05.31")) {
+    std::cerr << "bad packed date\n";
+    return false;
+  }
+
+  // zero fields and leading zeros would not survive a round trip
+  if (TagValue::pack_integer("0123") || TagValue::pack_integer("0") != 0u
+      || TagValue::pack_date("2015.06.00") || TagValue::pack_date("0000.??.??")
+      || TagValue::pack_eco("A00") != 1u) {
+    std::cerr << "bad packed value\n";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int, char *[]) {
+  GameEncoder enc {4};
+  std::vector<Expected> expected;
+  Line main {enc, expected, startpos, false, 0};
+
+  bool ok = main.play("e4") && main.play("e5") && main.play("Nf3");
+
+  Line var {enc, expected, main.pos, main.black, 1};
+  ok = ok && main.play("Nc6", "the main line");
+  ok = ok && enc.begin_variation().has_value();
+  ok = ok && var.play("Nf6") && var.play("Nxe5", "Petroff");
+  ok = ok && enc.end_variation().has_value();
+  ok = ok && main.play("Bb5", "the Spanish") && main.play("a6");
+
+  constexpr std::array<std::uint8_t, 2> nags {1, 14};
+  ok = ok && enc.nags(nags).has_value();
+  ok = ok && main.play("Ba4") && main.play("Nf6") && main.play("O-O") && main.play("Be7");
+  ok = ok && main.play("Re1") && main.play("b5") && main.play("Bb3");
+
+  Line var2 {enc, expected, main.pos, main.black, 1};
+  ok = ok && main.play("d6");
+  ok = ok && enc.begin_variation().has_value() && var2.play("O-O") && enc.end_variation().has_value();
+  ok = ok && main.play("c3") && main.play("O-O") && main.play("h3") && main.play("Bb7");
+
+  if (!ok) {
+    std::cerr << "failed to encode game\n";
+    return -1;
+  }
+
+  using namespace DecodeMode;
+  for (auto mode : {Eager, LazyPositions, SkipAnnotations, MovesOnly})
+    if (!check(enc.data(), expected, mode))
+      return -1;
+
+  if (!check_checkpoints(enc.data(), enc.checkpoints()))
+    return -1;
+
+  if (!check_tags())
+    return -1;
+
+  // nags are attached to the move before them
+  for (auto it = GameDecoder(enc.data()); it != GameDecoder(); ++it) {
+    if (!it->nags().empty() && it->nags().size() != nags.size()) {
+      std::cerr << "bad nags\n";
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "db/db.hh"
+#include "db/expr.hh"
+#include "tests/fixture.hh"
+
+#include <array>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+// a game of six plies
+constexpr std::string_view WrongPlyCount = R"([PlyCount "3"]
+
+1. d4 Nf6 2. c4 e6 3. g3 d5 1-0
+)";
+
+// the games an expression selects, with and without the metadata store
+template <expr::Expression E>
+bool check(const Db &db, std::string_view name, const E &e, const std::vector<std::uint32_t> &expected) {
+  const auto games = *db.filter(e, {2, 1});
+  const auto from_tags = *db.filter(expr::compile(e, nullptr, &db.names()), {2, 1});
+
+  if (games != expected || from_tags != expected) {
+    std::cerr << "bad games for " << name << " (" << games.size() << " and " << from_tags.size() << ")\n";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int, char *[]) {
+  using namespace expr;
+
+  auto db = test::import("expr");
+  if (!db || db->no_games() != 5 || db->metadata().size() != 5) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+  const auto pattern = Pattern::parse("Bg2");
+  const auto material = Material::parse("QRRBBNNPPPPPPP v QRRBBNNPPPPPPP");
+  if (!pattern || !material) {
+    std::cerr << "failed to parse predicates\n";
+    return -1;
+  }
+
+  const auto scandinavian = test::after("1. e4 d5 2. exd5");
+
+  // predicates on the moves are numbered left to right at compile time
+  const auto strong_catalan = white_elo >= 2800 && matches(*pattern) && !reaches(*material);
+  static_assert(decltype(strong_catalan)::Terminals == 2);
+  static_assert(decltype(white_elo >= 2800 || date < year(2010))::Terminals == 0);
+
+  // metadata settles the columns and rules out what the signatures cannot reach
+  GameMetadata game;
+  game.white_elo = 2500;
+  game.material = Material::of(chess::startpos, false).signature();
+  if (strong_catalan.check(game, true) != Truth::False || (white_elo < 2600).check(game, true) != Truth::True
+      || reaches(*material).check(game, true) != (game.material & material->signature() ? Truth::Unknown : Truth::False)
+      || reaches(*material).check(game, false) != Truth::Unknown) {
+    std::cerr << "bad checks against metadata\n";
+    return -1;
+  }
+
+  const bool ok = check(*db, "rating", white_elo >= 2800, {0, 2, 4})
+    && check(*db, "unrated", white_elo == 0, {3})
+    && check(*db, "result", result == chess::GameResult::White, {0, 4})
+    && check(*db, "years", date >= year(2016) && date < year(2020), {2, 3})
+    && check(*db, "rating or year", black_elo > 2800 || date < year(2010), {1, 2})
+    && check(*db, "material", reaches(*material), {4})
+    && check(*db, "position", reaches(scandinavian, true), {4})
+    && check(*db, "pattern", matches(*pattern), {0, 2})
+    && check(*db, "not pattern", !matches(*pattern), {1, 3, 4})
+    && check(*db, "rated pattern", white_elo >= 2850 && matches(*pattern), {0})
+    && check(*db, "pattern or material", matches(*pattern) || reaches(*material), {0, 2, 4})
+    && check(*db, "everything", strong_catalan || (result == chess::GameResult::Draw && !(white_elo > 0)), {0, 2, 3})
+    && check(*db, "plies", ply_count >= 8, {0, 2});
+
+  db->close();
+  test::remove("expr");
+
+  // ply counts come from the moves, whatever the PlyCount tag says
+  auto tagged = test::import("expr_plies", WrongPlyCount);
+  const auto line = LineTrie::parse("1. d4 Nf6 2. c4 e6 3. g3 d5");
+  if (!tagged || !line || tagged->metadata()[0].ply_count != 6 || !check(*tagged, "tagged plies", ply_count == 6, {0})
+      || tagged->select(Query {}.begins_with(*line))->to_vector() != std::vector<std::uint32_t> {0}) {
+    std::cerr << "bad ply count of a game with a wrong PlyCount tag\n";
+    return -1;
+  }
+
+  tagged->close();
+  test::remove("expr_plies");
+  return ok ? 0 : -1;
+}
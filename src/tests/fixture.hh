@@ -0,0 +1,105 @@
+#pragma once
+
+#include "chess/pgn.hh"
+#include "db/db.hh"
+
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string_view>
+
+// games and databases shared by the tests of queries
+namespace cdb::test {
+
+namespace fs = std::filesystem;
+
+// five games between four players, rated but for the fourth. Catalans are
+// games 0 and 2, which alone have Bg2, and game 4 is a Scandinavian.
+constexpr std::string_view Pgn = R"([Event "Tata Steel"]
+[Date "2015.01.20"]
+[White "Carlsen, Magnus"]
+[Black "Anand, Viswanathan"]
+[Result "1-0"]
+[WhiteElo "2862"]
+[BlackElo "2797"]
+
+1. d4 Nf6 2. c4 e6 3. g3 d5 4. Bg2 Be7 5. Nf3 O-O 1-0
+
+[Event "Corus"]
+[Date "2008.01.15"]
+[White "Anand, Viswanathan"]
+[Black "Carlsen, Magnus"]
+[Result "1/2-1/2"]
+[WhiteElo "2799"]
+[BlackElo "2733"]
+
+1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 1/2-1/2
+
+[Event "Norway Chess"]
+[Date "2018.05.28"]
+[White "Caruana, Fabiano"]
+[Black "Carlsen, Magnus"]
+[Result "0-1"]
+[WhiteElo "2822"]
+[BlackElo "2843"]
+
+1. d4 Nf6 2. c4 e6 3. g3 d5 4. Bg2 dxc4 0-1
+
+[Event "Sinquefield Cup"]
+[Date "2019.08.20"]
+[White "Nakamura, Hikaru"]
+[Black "Caruana, Fabiano"]
+[Result "1/2-1/2"]
+
+1. d4 Nf6 2. c4 e6 3. g3 d5 1/2-1/2
+
+[Event "Speed Chess"]
+[Date "2020.11.03"]
+[White "Carlsen, Magnus"]
+[Black "Nakamura, Hikaru"]
+[Result "1-0"]
+[WhiteElo "2863"]
+[BlackElo "2736"]
+
+1. e4 d5 2. exd5 Qxd5 3. Nc3 Qa5 1-0
+)";
+
+// copies of Pgn that fill several pages
+constexpr unsigned PageCopies = 800;
+
+inline chess::Position after(std::string_view line) {
+  chess::Position pos = chess::startpos;
+  chess::parse_movetext(line, [&] (const chess::ParseStep &step) { pos = step.next; });
+  return pos;
+}
+
+// files of a test in the temporary directory, e.g. cdb_query_test.cdb
+inline fs::path pgn_path(std::string_view name) {
+  return fs::temp_directory_path() / std::format("cdb_{}_test.pgn", name);
+}
+
+inline fs::path db_path(std::string_view name) {
+  return fs::temp_directory_path() / std::format("cdb_{}_test.cdb", name);
+}
+
+// a database of the games repeated a number of times
+inline Result<db::Db> import(std::string_view name, std::string_view pgn = Pgn, unsigned copies = 1,
+                             const db::ImportOptions &options = {}) {
+  {
+    std::ofstream out {pgn_path(name), std::ios::binary};
+    for (unsigned i = 0; i < copies; ++i)
+      out << pgn << '\n';
+  }
+
+  return db::Db::from_pgn(db_path(name), pgn_path(name), options);
+}
+
+// removes the files of an import, once its database is closed
+inline void remove(std::string_view name) {
+  for (const auto ext : {".cdb", ".names", ".meta", ".positions", ".bloom", ".tree", ".lines", ".tags", ".sorted"})
+    fs::remove(db::Db::sidecar_path(db_path(name), ext));
+
+  fs::remove(pgn_path(name));
+}
+
+} // cdb::test
@@ -0,0 +1,70 @@
+#include "db/hashtable.hh"
+
+#include <array>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+struct Key {
+  std::array<std::uint32_t, 3> words;
+};
+
+template <class K, class V>
+bool check(std::size_t count, auto make_key) {
+  std::vector<std::pair<K, V>> items;
+  for (std::size_t i = 0; i < count; ++i)
+    items.push_back({make_key(i), static_cast<V>(3 * i + 1)});
+
+  using Table = HashTable<K, V>;
+  const auto size = Table::bytes(count);
+  auto mem = std::make_unique<std::byte []>(size);
+  const auto table = Table::build(std::span {mem.get(), size}, items);
+
+  if (table.size() != count || table.capacity() * 7 < count * 8) {
+    std::cerr << "bad table size for " << count << " items\n";
+    return false;
+  }
+
+  for (const auto &[key, value] : items) {
+    const auto found = table.find(key);
+    if (!found || *found != value) {
+      std::cerr << "failed to find item " << (value - 1) / 3 << " of " << count << '\n';
+      return false;
+    }
+  }
+
+  // keys past count were never inserted
+  for (std::size_t i = count; i < 2 * count + 100; ++i) {
+    if (table.find(make_key(i))) {
+      std::cerr << "found missing item " << i << '\n';
+      return false;
+    }
+  }
+
+  // the table must be usable from a read only copy of its memory
+  const auto copy = Table::open(std::span<const std::byte> {mem.get(), size});
+  return copy && copy->find(items.front().first) == items.front().second;
+}
+
+int main(int, char *[]) {
+  std::mt19937_64 rng {42};
+  std::vector<std::uint64_t> random(100'000 * 2 + 100);
+  for (auto &x : random) x = rng();
+
+  const auto u64 = [&] (std::size_t i) { return random[i]; };
+  const auto sequential = [] (std::size_t i) { return std::uint64_t(i); };
+  const auto key = [] (std::size_t i) { return Key {{std::uint32_t(i), std::uint32_t(i >> 32), 7}}; };
+
+  for (std::size_t count : {1, 15, 16, 17, 1000, 100'000})
+    if (!check<std::uint64_t, std::uint32_t>(count, u64)
+        || !check<std::uint64_t, std::uint64_t>(count, sequential)
+        || !check<Key, std::uint16_t>(count, key))
+      return -1;
+
+  return 0;
+}
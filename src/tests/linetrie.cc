@@ -0,0 +1,120 @@
+#include "chess/movegen.hh"
+#include "chess/notation.hh"
+#include "db/linetrie.hh"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+constexpr std::array<std::string_view, 6> Games {
+  "1. d4 Nf6 2. c4 e6 3. Nc3 Bb4",
+  "1. e4 e5 2. Nf3 Nc6",
+  "1. d4 Nf6 2. c4 e6 3. Nf3 b6",
+  "1. d4 Nf6 2. c4 g6",
+  "1. d4 Nf6",
+  "1. d4 Nf6 2. c4 e6 3. Nc3 Bb4 4. e3 O-O",
+};
+
+// only the first four plies are kept, so longer lines end at candidates
+constexpr std::uint32_t MaxPlies = 4;
+
+std::vector<std::uint32_t> ids(const LineTrie::Match &match) {
+  std::vector<std::uint32_t> games;
+  for (std::size_t i = 0; i < match.size(); ++i)
+    games.push_back(match[i]);
+
+  std::ranges::sort(games);
+  return games;
+}
+
+int main(int, char *[]) {
+  // one builder per half of the games, as threads would, merged before writing
+  std::array<LineTrieBuilder, 2> builders {LineTrieBuilder {MaxPlies}, LineTrieBuilder {MaxPlies}};
+
+  for (std::uint32_t game = 0; game < Games.size(); ++game) {
+    const auto moves = LineTrie::parse(Games[game]);
+    if (!moves) {
+      std::cerr << "failed to parse " << Games[game] << '\n';
+      return -1;
+    }
+
+    std::vector<Token::Type> tokens;
+    for (const auto &move : *moves)
+      tokens.push_back(Token::encode(move));
+
+    builders[game % 2].add(game, tokens);
+  }
+
+  builders[0].merge(std::move(builders[1]));
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_linetrie_test.lines";
+  if (auto ec = builders[0].write(path)) {
+    std::cerr << "failed to write trie: " << ec.message() << '\n';
+    return -1;
+  }
+
+  auto trie = LineTrie::open(path);
+  if (!trie) {
+    std::cerr << "failed to open trie\n";
+    return -1;
+  }
+
+  struct Query {
+    std::string_view line;
+    std::vector<std::uint32_t> expected;
+    bool exact;
+  };
+
+  const std::array<Query, 7> queries {{
+    {"", {0, 1, 2, 3, 4, 5}, true},
+    {"1. d4 Nf6", {0, 2, 3, 4, 5}, true},
+    {"1. d4 Nf6 2. c4 e6", {0, 2, 5}, true},
+    {"1. d4 Nf6 2. c4 e6 3. Nc3", {0, 2, 5}, false}, // past the maximum plies
+    {"1. e4 e5 2. Nf3 Nc6 3. Bb5", {1}, false},      // past a single game
+    {"1. e4 c5", {1}, false},                        // left for the caller to check
+    {"1. d4 Nf6 2. Nf3", {}, true},
+  }};
+
+  for (const auto &[line, expected, exact] : queries) {
+    const auto moves = LineTrie::parse(line);
+    if (!moves) {
+      std::cerr << "failed to parse " << line << '\n';
+      return -1;
+    }
+
+    const auto match = trie->find(*moves);
+    if (ids(match) != expected || (!expected.empty() && match.exact != exact)) {
+      std::cerr << "bad games for \"" << line << "\" (" << match.size() << " games)\n";
+      return -1;
+    }
+  }
+
+  // games sharing an opening are next to each other, shorter lines first
+  const auto all = trie->games();
+  std::vector<std::uint32_t> order;
+  for (std::size_t i = 0; i < all.size(); ++i)
+    order.push_back(all[i]);
+
+  const auto d4 = std::ranges::find(order, 4u) - order.begin();
+  if (order.size() != Games.size() || d4 + 5 > static_cast<std::ptrdiff_t>(order.size())
+      || !std::is_permutation(order.begin() + d4, order.begin() + d4 + 5, std::array {0u, 2u, 3u, 4u, 5u}.begin())) {
+    std::cerr << "games are not ordered by their moves\n";
+    return -1;
+  }
+
+  if (LineTrie::parse("1. d4 Zz9")) {
+    std::cerr << "parsed an invalid line\n";
+    return -1;
+  }
+
+  *trie = LineTrie {};
+  std::filesystem::remove(path);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include "db/metadata.hh"
+
+#include <array>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+bool matches(const GameMetadata &g, const MetadataFilter &f) {
+  return f.date.contains(g.date) && f.white_elo.contains(g.white_elo)
+      && f.black_elo.contains(g.black_elo) && f.eco.contains(g.eco)
+      && f.ply_count.contains(g.ply_count) && ((f.results >> g.result) & 1)
+      && (g.material & f.material) == f.material;
+}
+
+const std::array<Material, 3> Endings {
+  *Material::parse("KRP vs KR"), *Material::parse("KQ vs KR"), *Material::parse("K vs K")
+};
+
+int main(int, char *[]) {
+  if (Material::of(chess::startpos, false) != *Material::parse("KQRRBBNNPPPPPPPP vs KQRRBBNNPPPPPPPP")
+      || Material::of(chess::startpos.rotated(), true) != Material::of(chess::startpos, false)) {
+    std::cerr << "bad material for the starting position\n";
+    return -1;
+  }
+
+  const auto ending = Material::parse("R+P v R");
+  if (!ending || ending->count(false, chess::PieceType::Pawn) != 1
+      || ending->count(true, chess::PieceType::Rook) != 1 || ending->flipped() != *Material::parse("KR vs KRP")
+      || ending->to_string() != "KRP vs KR" || Material::parse("KRP") || Material::parse("KRX vs K")) {
+    std::cerr << "bad material parsing\n";
+    return -1;
+  }
+
+  // not a multiple of 64, so the scalar tail is tested too
+  constexpr std::uint32_t Count = 10'000 + 37;
+
+  std::mt19937 rng {12345};
+  const auto rand = [&] (unsigned lo, unsigned hi) {
+    return std::uniform_int_distribution<unsigned> {lo, hi}(rng);
+  };
+
+  MetadataBuilder builder;
+  std::vector<GameMetadata> games;
+  for (std::uint32_t i = 0; i < Count; ++i) {
+    GameMetadata g;
+    g.add_tag("Date", std::format("{}.{:02}.{:02}", rand(1990, 2024), rand(1, 12), rand(1, 28)));
+    g.add_tag("WhiteElo", std::to_string(rand(2000, 2900)));
+    g.add_tag("BlackElo", std::to_string(rand(2000, 2900)));
+    g.add_tag("Result", std::array {"1-0", "0-1", "1/2-1/2", "*"}[rand(0, 3)]);
+    g.add_tag("ECO", std::format("{}{:02}", char('A' + rand(0, 4)), rand(0, 99)));
+    g.ply_count = rand(0, 300);
+
+    // a handful of other configurations, and sometimes one of the endings
+    for (unsigned j = rand(0, 8); j--; )
+      g.material |= std::uint64_t(1) << rand(0, 63);
+
+    if (rand(0, 3) == 0)
+      g.material |= Endings[rand(0, 2)].signature();
+
+    builder.push(g);
+    games.push_back(g);
+  }
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_metadata_test.meta";
+  if (auto ec = builder.write(path)) {
+    std::cerr << "failed to write metadata: " << ec.message() << '\n';
+    return -1;
+  }
+
+  auto store = MetadataStore::open(path);
+  if (!store || store->size() != Count) {
+    std::cerr << "failed to open metadata\n";
+    return -1;
+  }
+
+  MetadataFilter elite;
+  elite.white_elo.min = elite.black_elo.min = 2600;
+  elite.years(2015, 2020).decisive();
+
+  MetadataFilter sicilian;
+  sicilian.eco = {*TagValue::pack_eco("B20"), *TagValue::pack_eco("B99")};
+  sicilian.ply_count.max = 80;
+
+  MetadataFilter rook_endings;
+  rook_endings.reaches(Endings[0]).reaches(Endings[0].flipped());
+
+  MetadataFilter queen_vs_rook;
+  queen_vs_rook.reaches(Endings[1]).years(2000, 2024);
+
+  for (const auto &filter : {MetadataFilter {}, elite, sicilian, rook_endings, queen_vs_rook}) {
+    const auto s = store->select(filter);
+
+    std::size_t expected = 0;
+    for (std::uint32_t i = 0; i < Count; ++i) {
+      expected += matches(games[i], filter);
+      if (s.contains(i) != matches(games[i], filter)) {
+        std::cerr << "game " << i << " selected incorrectly\n";
+        return -1;
+      }
+    }
+
+    if (s.cardinality() != expected) {
+      std::cerr << "selected " << s.cardinality() << " games, expected " << expected << '\n';
+      return -1;
+    }
+  }
+
+  store = MetadataStore {};
+  std::filesystem::remove(path);
+  return 0;
+}
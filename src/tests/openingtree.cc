@@ -0,0 +1,201 @@
+#include "chess/movegen.hh"
+#include "chess/notation.hh"
+#include "chess/pgn.hh"
+#include "db/codec.hh"
+#include "db/db.hh"
+#include "db/metadata.hh"
+#include "db/openingtree.hh"
+#include "tests/fixture.hh"
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+constexpr std::array<std::array<std::string_view, 6>, 4> Games {{
+  {"e4", "e5", "Nf3", "Nc6", "Bb5", "a6"},
+  {"Nf3", "Nc6", "e4", "e5", "Bb5", "Nf6"}, // transposes at ply 4
+  {"d4", "d5", "c4", "e6", "Nc3", "Nf6"},
+  {"e4", "e5", "Nf3", "Nc6", "Bb5", "Nf6"},
+}};
+
+// Games, with the metadata given to the builders below
+constexpr std::string_view Pgn = R"([Date "1990.??.??"]
+[WhiteElo "2500"]
+[BlackElo "2400"]
+[Result "1-0"]
+
+1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 1-0
+
+[Date "2001.??.??"]
+[WhiteElo "2600"]
+[Result "1/2-1/2"]
+
+1. Nf3 Nc6 2. e4 e5 3. Bb5 Nf6 1/2-1/2
+
+[Date "1985.??.??"]
+[Result "0-1"]
+
+1. d4 d5 2. c4 e6 3. Nc3 Nf6 0-1
+
+[Date "2010.??.??"]
+[WhiteElo "2700"]
+[BlackElo "2650"]
+[Result "0-1"]
+
+1. e4 e5 2. Nf3 Nc6 3. Bb5 Nf6 0-1
+)";
+
+GameMetadata metadata(unsigned year, std::uint16_t white_elo, std::uint16_t black_elo, GameResult result) {
+  GameMetadata game;
+  game.date = MetadataFilter::year(year);
+  game.white_elo = white_elo;
+  game.black_elo = black_elo;
+  game.result = static_cast<std::uint8_t>(result);
+  return game;
+}
+
+bool check(const OpeningTree &tree) {
+  struct Expected {
+    std::string_view san;
+    std::uint32_t games, white_wins, draws, black_wins;
+    std::uint16_t average_elo, last_year;
+  };
+
+  struct Query {
+    std::vector<std::string_view> sans;
+    std::vector<Expected> expected;
+  };
+
+  const std::array<Query, 4> queries {{
+    {{}, {{"e4", 2, 1, 0, 1, 2600, 2010}, {"d4", 1, 0, 0, 1, 0, 1985}, {"Nf3", 1, 0, 1, 0, 2600, 2001}}},
+    // reached by three games, one of them through a transposition
+    {{"e4", "e5", "Nf3", "Nc6"}, {{"Bb5", 3, 1, 1, 1, 2600, 2010}}},
+    // black's Elo is unknown in the second game
+    {{"e4", "e5", "Nf3", "Nc6", "Bb5"}, {{"Nf6", 2, 0, 1, 1, 2650, 2010}, {"a6", 1, 1, 0, 0, 2400, 1990}}},
+    {{"e4", "e5", "Nf3", "Nc6", "Bb5", "a6"}, {}},
+  }};
+
+  for (const auto &[sans, expected] : queries) {
+    Position pos = startpos;
+    bool black = false;
+
+    for (const auto san : sans) {
+      pos = make_move(pos, *parse_san(san, pos, black));
+      black ^= 1;
+    }
+
+    const auto moves = tree.moves(pos, black);
+    bool ok = moves.size() == expected.size();
+
+    for (std::size_t i = 0; ok && i < moves.size(); ++i) {
+      const auto &m = moves[i];
+      const auto &e = expected[i];
+
+      const auto move = parse_san(e.san, pos, black);
+      ok = move && Token::encode(m.move) == Token::encode(*move) && m.games == e.games && m.white_wins == e.white_wins
+           && m.draws == e.draws && m.black_wins == e.black_wins && m.average_elo == e.average_elo
+           && m.last_year == e.last_year;
+    }
+
+    if (!ok) {
+      std::cerr << "bad moves after " << sans.size() << " plies (" << moves.size() << " moves)\n";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// builds the tree from two builders, as threads would, spilling a run every
+// run_size pairs
+bool check_builder(std::size_t run_size) {
+  const std::array<GameMetadata, Games.size()> games {
+    metadata(1990, 2500, 2400, GameResult::White),
+    metadata(2001, 2600, 0, GameResult::Draw),
+    metadata(1985, 0, 0, GameResult::Black),
+    metadata(2010, 2700, 2650, GameResult::Black),
+  };
+
+  std::array<OpeningTreeBuilder, 2> builders {OpeningTreeBuilder {run_size}, OpeningTreeBuilder {run_size}};
+
+  for (std::uint32_t game = 0; game < Games.size(); ++game) {
+    Position pos = startpos;
+    bool black = false;
+
+    for (const auto san : Games[game]) {
+      const auto move = parse_san(san, pos, black);
+      if (!move) {
+        std::cerr << "failed to parse " << san << '\n';
+        return false;
+      }
+
+      builders[game % 2].add(pos, black, *move, games[game]);
+      pos = make_move(pos, *move);
+      black ^= 1;
+    }
+  }
+
+  builders[0].merge(std::move(builders[1]));
+  if ((run_size < 12) != (builders[0].runs() > 0)) {
+    std::cerr << "expected runs only with a run size under 12, got " << builders[0].runs() << '\n';
+    return false;
+  }
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_openingtree_test.tree";
+  if (auto ec = builders[0].write(path)) {
+    std::cerr << "failed to write tree: " << ec.message() << '\n';
+    return false;
+  }
+
+  auto tree = OpeningTree::open(path);
+  if (!tree) {
+    std::cerr << "failed to open tree\n";
+    return false;
+  }
+
+  const bool ok = check(*tree);
+
+  *tree = OpeningTree {};
+  std::filesystem::remove(path);
+  return ok;
+}
+
+// the tree a database builds from its own games, on import and again with
+// several workers over single-page morsels
+bool check_db() {
+  auto db = test::import("openingtree", Pgn);
+  if (!db || db->no_games() != Games.size()) {
+    std::cerr << "failed to import games\n";
+    return false;
+  }
+
+  if (!db->openings().is_open() || !check(db->openings()))
+    return false;
+
+  if (auto ec = db->build_opening_tree(30, {.threads = 4, .morsel_pages = 1})) {
+    std::cerr << "failed to rebuild tree: " << ec.message() << '\n';
+    return false;
+  }
+
+  const bool ok = check(db->openings());
+  db->close();
+  test::remove("openingtree");
+  return ok;
+}
+
+int main(int, char *[]) {
+  for (std::size_t run_size : {OpeningTreeBuilder::DefaultRunSize, std::size_t(3)})
+    if (!check_builder(run_size))
+      return -1;
+
+  if (!check_db())
+    return -1;
+
+  return 0;
+}
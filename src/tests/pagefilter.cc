@@ -0,0 +1,171 @@
+#include "chess/movegen.hh"
+#include "chess/notation.hh"
+#include "db/codec.hh"
+#include "db/db.hh"
+#include "db/pagefilter.hh"
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+constexpr std::array<std::array<std::string_view, 4>, 2> Games {{
+  {"e4", "e5", "Nf3", "Nc6"},
+  {"d4", "d5", "c4", "e6"},
+}};
+
+// enough copies of each game to fill several pages
+constexpr std::uint32_t Copies = 10000;
+
+Result<std::vector<std::byte>> encode(const std::array<std::string_view, 4> &sans) {
+  GameEncoder enc;
+  Position pos = startpos;
+  bool black = false;
+
+  for (const auto san : sans) {
+    const auto move = parse_san(san, pos, black);
+    if (!move)
+      return std::unexpected(move.error());
+
+    enc.move(*move);
+    pos = make_move(pos, *move);
+    black ^= 1;
+  }
+
+  return write_record(0, {}, enc.data());
+}
+
+bool test_filters() {
+  constexpr std::size_t NoPages = 16, KeysPerPage = 2000, NoProbes = 100000;
+
+  std::mt19937_64 rng {42};
+  std::vector<std::vector<std::uint64_t>> keys(NoPages);
+
+  PageFilters filters {10};
+  for (std::uint32_t page_no = 0; page_no < NoPages; ++page_no) {
+    for (std::size_t i = 0; i < KeysPerPage; ++i)
+      keys[page_no].push_back(rng());
+
+    filters.build(page_no, keys[page_no]);
+  }
+
+  // rebuilding a page in the middle must leave the ones after it intact
+  keys[3].resize(KeysPerPage / 4);
+  filters.build(3, keys[3]);
+
+  for (std::uint32_t page_no = 0; page_no < NoPages; ++page_no) {
+    for (const auto key : keys[page_no]) {
+      if (!filters.may_contain(page_no, key)) {
+        std::cerr << "false negative on page " << page_no << '\n';
+        return false;
+      }
+    }
+  }
+
+  std::size_t passed = 0;
+  for (std::size_t i = 0; i < NoProbes; ++i)
+    passed += filters.may_contain(i % NoPages, rng());
+
+  if (passed > NoProbes / 50) {
+    std::cerr << "false positive rate " << double(passed) / NoProbes << " at 10 bits per key\n";
+    return false;
+  }
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_pagefilter_test.bloom";
+  if (filters.write(path)) {
+    std::cerr << "failed to write filters\n";
+    return false;
+  }
+
+  auto read = PageFilters::open(path);
+  std::filesystem::remove(path);
+
+  if (!read || read->bits_per_key() != 10 || read->no_pages() != NoPages) {
+    std::cerr << "failed to read back filters\n";
+    return false;
+  }
+
+  for (std::uint32_t page_no = 0; page_no < NoPages; ++page_no) {
+    for (const auto key : keys[page_no]) {
+      if (!read->may_contain(page_no, key)) {
+        std::cerr << "false negative on page " << page_no << " after reading back\n";
+        return false;
+      }
+    }
+  }
+
+  return !PageFilters {}.enabled() && PageFilters {}.may_contain(0, 0);
+}
+
+int main(int, char *[]) {
+  if (!test_filters())
+    return -1;
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_pagefilter_test.cdb";
+  const auto filters_path = Db::sidecar_path(path, ".bloom");
+
+  auto db = Db::create(path, 1 << 20);
+  if (!db) {
+    std::cerr << "failed to create database\n";
+    return -1;
+  }
+
+  // the games are not interleaved, so the pages of one never hold the other
+  for (std::uint32_t i = 0; i < Copies * Games.size(); ++i) {
+    const auto record = encode(Games[i / Copies]);
+    if (!record || !db->append(*record)) {
+      std::cerr << "failed to append game " << i << '\n';
+      return -1;
+    }
+  }
+
+  db->enable_filters(10);
+  db->commit();
+
+  const auto written = PageFilters::open(filters_path);
+  if (!written || written->bits_per_key() != 10 || written->no_pages() != db->filters().no_pages()
+      || db->filters().no_pages() < 4) {
+    std::cerr << "failed to build filters for every page\n";
+    return -1;
+  }
+
+  // after 1. d4 d5, with white to move
+  Position pos = startpos;
+  for (bool black : {false, true})
+    pos = make_move(pos, *parse_san(black ? "d5" : "d4", pos, black));
+
+  const auto no_pages = db->filters().no_pages();
+
+  std::vector<PositionEntry> expected;
+  for (std::uint32_t i = 0; i < Copies; ++i)
+    expected.push_back({Copies + i, 2});
+
+  for (unsigned threads : {1, 4}) {
+    const auto before = db->filters().stats();
+    if (db->find(pos, false, {threads}) != expected) {
+      std::cerr << "bad hits for 1. d4 d5 on " << threads << " threads\n";
+      return -1;
+    }
+
+    // only the pages of the second game can hold the position
+    const auto after = db->filters().stats();
+    if (after.tested - before.tested != no_pages
+        || after.skipped - before.skipped + 1 < no_pages / 2) {
+      std::cerr << "filters skipped " << after.skipped - before.skipped << " of "
+                << no_pages << " pages\n";
+      return -1;
+    }
+  }
+
+  db->close();
+  std::filesystem::remove(path);
+  std::filesystem::remove(filters_path);
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "chess/movegen.hh"
+#include "chess/notation.hh"
+#include "db/codec.hh"
+#include "db/db.hh"
+
+#include <array>
+#include <filesystem>
+#include <initializer_list>
+#include <iostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+constexpr std::array<std::array<std::string_view, 6>, 3> Games {{
+  {"e4", "e5", "Nf3", "Nc6", "Bb5", "a6"},
+  {"Nf3", "Nc6", "e4", "e5", "Bb5", "Nf6"},
+  {"d4", "d5", "c4", "e6", "Nc3", "Nf6"},
+}};
+
+// enough copies of the games to fill several pages
+constexpr std::uint32_t Copies = 3000;
+
+Result<std::vector<std::byte>> encode(const std::array<std::string_view, 6> &sans) {
+  GameEncoder enc;
+  Position pos = startpos, prev = startpos;
+  bool black = false;
+
+  for (const auto san : sans) {
+    const auto move = parse_san(san, pos, black);
+    if (!move)
+      return std::unexpected(move.error());
+
+    enc.move(*move);
+    prev = std::exchange(pos, make_move(pos, *move));
+    black ^= 1;
+  }
+
+  // replaces the last move, so that "Bb5 !pa7" would match it in the first
+  // game if variations were searched
+  const auto alternative = parse_san("a5", prev, !black);
+  if (!alternative)
+    return std::unexpected(alternative.error());
+
+  (void) enc.begin_variation();
+  enc.move(*alternative);
+  (void) enc.end_variation();
+
+  return write_record(0, {}, enc.data());
+}
+
+// plays the moves and tells whether the pattern can still be reached
+bool reachable(std::string_view pattern, std::initializer_list<std::string_view> sans) {
+  Position pos = startpos;
+  bool black = false;
+
+  for (const auto san : sans) {
+    pos = make_move(pos, *parse_san(san, pos, black));
+    black ^= 1;
+  }
+
+  return Pattern::parse(pattern)->reachable(pos, black);
+}
+
+bool test_pruning() {
+  struct Case {
+    std::string_view pattern;
+    std::initializer_list<std::string_view> sans;
+    bool expected;
+  };
+
+  const std::array<Case, 8> cases {{
+    {"Pd4", {}, true},
+    {"Pe2", {"e4"}, false},
+    {"Pe3", {"e4"}, true},                  // the d or f pawn can capture onto e3
+    {"pe5", {"e4"}, true},
+    {"pe7", {"e4", "e5", "Nf3"}, false},
+    {"Pa7", {"d4", "d5", "c4", "e6"}, true},
+    {"Pa2b2c2d2e2f2g2h2 Pa3", {}, false},   // more pawns than there are
+    {"Pa4 Nb1 Qd1", {"d4", "d5", "c4", "e6"}, true},
+  }};
+
+  for (const auto &[pattern, sans, expected] : cases) {
+    if (reachable(pattern, sans) != expected) {
+      std::cerr << "bad reachability of " << pattern << " after " << sans.size() << " plies\n";
+      return false;
+    }
+  }
+
+  Position pos = startpos;
+  for (bool black : {false, true})
+    pos = make_move(pos, *parse_san(black ? "e5" : "d4", pos, black));
+
+  if (home_pawns(startpos, false) != 0xffff
+      || home_pawns(pos, false) != (0xffff & ~(1 << 3) & ~(1 << 12))
+      || Pattern::parse("!Pd2 !pe7 !Pd4")->moved_pawns() != ((1 << 3) | (1 << 12))) {
+    std::cerr << "bad home pawns\n";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int, char *[]) {
+  if (!test_pruning())
+    return -1;
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_pattern_test.cdb";
+  auto db = Db::create(path, 1 << 20);
+  if (!db) {
+    std::cerr << "failed to create database\n";
+    return -1;
+  }
+
+  std::array<std::vector<std::byte>, Games.size()> records;
+  for (std::size_t i = 0; i < Games.size(); ++i) {
+    auto record = encode(Games[i]);
+    if (!record) {
+      std::cerr << "failed to encode game " << i << '\n';
+      return -1;
+    }
+
+    records[i] = std::move(*record);
+  }
+
+  for (std::uint32_t i = 0; i < Copies * Games.size(); ++i) {
+    if (!db->append(records[i % Games.size()])) {
+      std::cerr << "failed to append game " << i << '\n';
+      return -1;
+    }
+  }
+
+  struct Query {
+    std::string_view pattern;
+    std::vector<PositionEntry> expected; // for the first copy of the games
+  };
+
+  const std::array<Query, 4> queries {{
+    {"Pe4 nc6", {{0, 4}, {0, 5}, {0, 6}, {1, 3}, {1, 4}, {1, 5}, {1, 6}}},
+    {"Pd4,nf6 !Pe4", {{2, 6}}},
+    {"Bb5 !pa7", {{0, 6}}},
+    {"Pd4c4 pd5 !pe6", {{2, 3}}},
+  }};
+
+  for (const auto &[text, expected] : queries) {
+    const auto pattern = Pattern::parse(text);
+    if (!pattern) {
+      std::cerr << "failed to parse " << text << '\n';
+      return -1;
+    }
+
+    std::vector<PositionEntry> all;
+    for (std::uint32_t copy = 0; copy < Copies; ++copy)
+      for (const auto &[game, ply] : expected)
+        all.push_back({static_cast<std::uint32_t>(copy * Games.size() + game), ply});
+
+    for (unsigned threads : {1, 4}) {
+      if (db->find(*pattern, {threads}) != all) {
+        std::cerr << "bad hits for " << text << " on " << threads << " threads\n";
+        return -1;
+      }
+    }
+  }
+
+  for (const auto text : {"Xe4", "Pe9", "P", "!Pe4x"}) {
+    if (Pattern::parse(text)) {
+      std::cerr << "parsed invalid pattern " << text << '\n';
+      return -1;
+    }
+  }
+
+  db->close();
+  std::filesystem::remove(path);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include "chess/movegen.hh"
+#include "chess/notation.hh"
+#include "db/positionindex.hh"
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::chess;
+using namespace cdb::db;
+
+constexpr std::array<std::array<std::string_view, 6>, 3> Games {{
+  {"e4", "e5", "Nf3", "Nc6", "Bb5", "a6"},
+  {"Nf3", "Nc6", "e4", "e5", "Bb5", "Nf6"}, // transposes at ply 4
+  {"d4", "d5", "c4", "e6", "Nc3", "Nf6"},
+}};
+
+// builds an index of Games, spilling a run every run_size entries, and
+// checks a few lookups against it
+bool check(std::size_t run_size) {
+  PositionIndexBuilder builder {run_size};
+
+  for (std::uint32_t game = 0; game < Games.size(); ++game) {
+    Position pos = startpos;
+    bool black = false;
+
+    for (std::uint16_t ply = 1; ply <= Games[game].size(); ++ply) {
+      const auto move = parse_san(Games[game][ply - 1], pos, black);
+      if (!move) {
+        std::cerr << "failed to parse " << Games[game][ply - 1] << '\n';
+        return false;
+      }
+
+      pos = make_move(pos, *move);
+      black ^= 1;
+      builder.add(pos, black, game, ply);
+    }
+  }
+
+  const std::size_t expected_runs = run_size < 18 ? 18 / run_size : 0;
+  if (builder.runs() != expected_runs) {
+    std::cerr << "expected " << expected_runs << " runs, got " << builder.runs() << '\n';
+    return false;
+  }
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_positionindex_test.positions";
+  if (auto ec = builder.write(path, Games.size())) {
+    std::cerr << "failed to write index: " << ec.message() << '\n';
+    return false;
+  }
+
+  auto index = PositionIndex::open(path);
+  if (!index) {
+    std::cerr << "failed to open index\n";
+    return false;
+  }
+
+  if (index->no_games() != Games.size()) {
+    std::cerr << "index covers " << index->no_games() << " games\n";
+    return false;
+  }
+
+  struct Query {
+    std::string_view fen;
+    std::vector<PositionEntry> expected;
+  };
+
+  const std::array<Query, 4> queries {{
+    // 1. e4 e5 2. Nf3 Nc6, reached by both of the first two games
+    {"r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3", {{0, 4}, {1, 4}}},
+    {"r1bqkbnr/1ppp1ppp/p1n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 0 4", {{0, 6}}},
+    {"rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR w KQkq - 0 2", {{2, 2}}},
+    // same placement as after 1. d4 d5, but with black to move
+    {"rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 2", {}},
+  }};
+
+  for (const auto &[fen, expected] : queries) {
+    const auto postings = index->find(fen);
+    if (!postings) {
+      std::cerr << "failed to parse " << fen << '\n';
+      return false;
+    }
+
+    if (postings->entries() != expected) {
+      std::cerr << "bad postings for " << fen << " (" << postings->size() << " entries)\n";
+      return false;
+    }
+  }
+
+  *index = PositionIndex {};
+  std::filesystem::remove(path);
+  return true;
+}
+
+int main(int, char *[]) {
+  // everything in memory, then merged from runs of 4 with an in-memory tail
+  for (std::size_t run_size : {PositionIndexBuilder::DefaultRunSize, std::size_t(4)})
+    if (!check(run_size))
+      return -1;
+
+  return 0;
+}
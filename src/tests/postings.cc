@@ -0,0 +1,98 @@
+#include "db/postings.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+struct Encoded {
+  std::unique_ptr<std::byte []> mem;
+  Postings postings;
+};
+
+Encoded encode(const std::vector<PositionEntry> &entries) {
+  const auto size = Postings::encoded_size(entries);
+  auto mem = std::make_unique<std::byte []>(size);
+  Postings::encode(entries, {mem.get(), size});
+
+  const Postings postings {{mem.get(), size}, static_cast<std::uint32_t>(entries.size())};
+  return {std::move(mem), postings};
+}
+
+// sorted entries with games spaced by up to max_gap, some repeated
+std::vector<PositionEntry> make_list(std::mt19937 &rng, std::size_t count, std::uint32_t max_gap) {
+  std::vector<PositionEntry> entries;
+  std::uint32_t game = rng() % max_gap;
+
+  for (std::size_t i = 0; i < count; ++i) {
+    entries.push_back({game, static_cast<std::uint16_t>(rng() % 300 + 1)});
+    if (rng() % 8)
+      game += rng() % max_gap + 1;
+  }
+
+  std::ranges::sort(entries);
+  return entries;
+}
+
+std::vector<std::uint32_t> naive_intersect(const std::vector<PositionEntry> &a,
+                                           const std::vector<PositionEntry> &b) {
+  std::vector<std::uint32_t> x, y, games;
+  for (const auto &e : a) if (x.empty() || x.back() != e.game) x.push_back(e.game);
+  for (const auto &e : b) if (y.empty() || y.back() != e.game) y.push_back(e.game);
+
+  std::ranges::set_intersection(x, y, std::back_inserter(games));
+  return games;
+}
+
+int main(int, char *[]) {
+  std::mt19937 rng {2024};
+
+  std::vector<std::vector<PositionEntry>> lists;
+  for (std::size_t count : {0, 1, 5, 127, 128, 129, 1000, 5000})
+    for (std::uint32_t max_gap : {1u, 40u, 100'000u})
+      lists.push_back(make_list(rng, count, max_gap));
+
+  // extreme deltas need the full 32 bits
+  lists.push_back({});
+  for (std::uint32_t i = 0; i < 300; ++i)
+    lists.back().push_back({i % 2 ? 0xfffffff0u + i / 150 : i / 150, 0xffff});
+
+  std::ranges::sort(lists.back());
+
+  for (const auto &list : lists) {
+    const auto encoded = encode(list);
+    if (encoded.postings.entries() != list) {
+      std::cerr << "failed to decode list of " << list.size() << " entries\n";
+      return -1;
+    }
+
+    if (encoded.postings.games().to_vector() != naive_intersect(list, list)) {
+      std::cerr << "bad game set for list of " << list.size() << " entries\n";
+      return -1;
+    }
+  }
+
+  // dense lists should pack to a fraction of their raw size
+  const auto dense = make_list(rng, 5000, 40);
+  if (Postings::encoded_size(dense) > Postings::EntrySize * dense.size() / 2) {
+    std::cerr << "list of " << dense.size() << " entries compressed to "
+              << Postings::encoded_size(dense) << " bytes\n";
+    return -1;
+  }
+
+  for (const auto &a : lists) {
+    for (const auto &b : lists) {
+      const auto x = encode(a), y = encode(b);
+      if (intersect(x.postings, y.postings).to_vector() != naive_intersect(a, b)) {
+        std::cerr << "bad intersection of lists of " << a.size() << " and " << b.size() << " entries\n";
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include "db/db.hh"
+#include "db/import.hh"
+#include "tests/fixture.hh"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+std::vector<std::uint32_t> ids(const roaring_bitmap &games) {
+  return games.to_vector();
+}
+
+int main(int, char *[]) {
+  // one database with every index and one that can only scan its records
+  ImportOptions no_indexes;
+  no_indexes.index_positions = false;
+  no_indexes.opening_tree_plies = 0;
+  no_indexes.line_trie_plies = 0;
+  no_indexes.index_tags = false;
+  no_indexes.sort_games = false;
+
+  auto indexed = test::import("query");
+  auto scanned = test::import("query_scan", test::Pgn, 1, no_indexes);
+  if (!indexed || !scanned || indexed->no_games() != 5) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+  const auto catalan = LineTrie::parse("1. d4 Nf6 2. c4 e6 3. g3");
+  const auto pattern = Pattern::parse("Bg2");
+  const auto material = Material::parse("QRRBBNNPPPPPPP v QRRBBNNPPPPPPP");
+  if (!catalan || !pattern || !material) {
+    std::cerr << "failed to parse query\n";
+    return -1;
+  }
+
+  struct Case {
+    std::string_view name;
+    Query query;
+    std::vector<std::uint32_t> expected;
+  };
+
+  std::vector<Case> cases;
+  cases.push_back({"everything", Query {}, {0, 1, 2, 3, 4}});
+  cases.push_back({"player", Query {}.player("Carlsen, Magnus"), {0, 1, 2, 4}});
+  cases.push_back({"player prefix", Query {}.player("carl", TagMatch::Prefix), {0, 1, 2, 4}});
+  cases.push_back({"player and line", Query {}.player("Carlsen, Magnus").begins_with(*catalan), {0, 2}});
+
+  Query years = Query {}.player("Carlsen, Magnus").begins_with(*catalan);
+  years.metadata.years(2016, 2020);
+  cases.push_back({"player, line and years", years, {2}});
+
+  cases.push_back({"position", Query {}.reaches(test::after("1. e4 d5 2. exd5"), true), {4}});
+  cases.push_back({"material", Query {}.reaches(*material), {4}});
+  cases.push_back({"pattern", Query {}.matches(*pattern), {0, 2}});
+  cases.push_back({"pattern and event", Query {}.matches(*pattern).event("Norway", TagMatch::Contains), {2}});
+  cases.push_back({"no games", Query {}.matches(*pattern).player("Nakamura, Hikaru", TagMatch::Exact), {}});
+
+  for (const auto &[name, query, expected] : cases) {
+    for (const auto *db : {&*indexed, &*scanned}) {
+      if (ids(*db->select(query)) != expected) {
+        std::cerr << "bad games for " << name << (db == &*indexed ? "" : " without indexes") << '\n'
+                  << db->plan(query).to_string();
+        return -1;
+      }
+    }
+  }
+
+  // the line trie answers the line exactly and is more selective than the
+  // player, so nothing is left for a scan
+  const auto plan = indexed->plan(cases[3].query);
+  if (plan.stages.empty() || plan.stages.front().kind != PlanStage::Line
+      || std::ranges::any_of(plan.stages, [] (const PlanStage &s) { return s.kind == PlanStage::Record; })) {
+    std::cerr << "bad plan for player and line\n" << plan.to_string();
+    return -1;
+  }
+
+  // patterns always need the records, after the event has narrowed them
+  const auto scan_plan = indexed->plan(cases[8].query);
+  if (scan_plan.stages.back().kind != PlanStage::Record || scan_plan.stages.front().kind != PlanStage::Tag) {
+    std::cerr << "bad plan for pattern and event\n" << scan_plan.to_string();
+    return -1;
+  }
+
+  // without a position index, the pawns that left home before the position
+  // rule out games in the metadata before any record is replayed
+  const auto pushed_plan = scanned->plan(cases[5].query);
+  if (pushed_plan.stages.size() != 2 || pushed_plan.stages[0].kind != PlanStage::Metadata
+      || pushed_plan.metadata.moved_pawns == 0) {
+    std::cerr << "bad plan for position without an index\n" << pushed_plan.to_string();
+    return -1;
+  }
+
+  // the scan reads the one page and replays games until the pattern matches
+  // or can no longer be reached
+  QueryProfile profile;
+  const auto games = *scanned->select(cases[7].query, {1}, &profile);
+  const auto &scan_stats = profile.stages.back();
+  if (profile.stages.size() != profile.plan.stages.size() || scan_stats.pages != 1 || scan_stats.plies == 0
+      || scan_stats.bytes == 0 || scan_stats.rows_out != games.cardinality() || profile.total.rows_out != 2) {
+    std::cerr << "bad profile for pattern\n" << profile.to_string();
+    return -1;
+  }
+
+  const auto json = profile.to_json();
+  if (!json.starts_with(R"({"stages":[{"kind":)") || !json.contains(R"("actual":{"rows_in":)")
+      || !json.ends_with("}}") || !indexed->plan(cases[3].query).to_json().contains(R"(player exact \"carlsen magnus\")")) {
+    std::cerr << "bad json profile " << json << '\n';
+    return -1;
+  }
+
+  // games appended after the indexes were built are not in them, so their
+  // predicates fall back to the records
+  ImportOptions inline_names;
+  inline_names.intern_names = false;
+
+  auto stale = test::import("query_stale", test::Pgn, 1, inline_names);
+  if (!stale || Importer(*stale, inline_names).import_pgn(test::Pgn) || stale->no_games() != 10) {
+    std::cerr << "failed to append games\n";
+    return -1;
+  }
+
+  stale->commit();
+
+  for (const auto &[name, query, expected] : {
+         Case {"player", Query {}.player("Carlsen, Magnus"), {0, 1, 2, 4, 5, 6, 7, 9}},
+         Case {"player and line", Query {}.player("Carlsen, Magnus").begins_with(*catalan), {0, 2, 5, 7}},
+         Case {"position", Query {}.reaches(test::after("1. e4 d5 2. exd5"), true), {4, 9}}}) {
+    if (ids(*stale->select(query)) != expected) {
+      std::cerr << "bad games for " << name << " after an append\n" << stale->plan(query).to_string();
+      return -1;
+    }
+  }
+
+  const auto stale_line = stale->find_line(*catalan);
+  const auto stale_position = stale->find(test::after("1. e4 d5 2. exd5"), true);
+  if (!stale_line || *stale_line != std::vector<std::uint32_t> {0, 2, 3, 5, 7, 8}
+      || !stale_position || stale_position->size() != 2) {
+    std::cerr << "bad lookups after an append\n";
+    return -1;
+  }
+
+  indexed->close();
+  scanned->close();
+  stale->close();
+
+  for (const auto name : {"query", "query_scan", "query_stale"})
+    test::remove(name);
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "db/codec.hh"
+#include "db/db.hh"
+#include "db/querycache.hh"
+#include "tests/fixture.hh"
+
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+roaring_bitmap range(std::uint32_t first, std::uint32_t last) {
+  roaring_bitmap games;
+  games.add_range(first, last);
+  return games;
+}
+
+bool expect(const QueryCacheStats &stats, std::uint64_t hits, std::uint64_t misses, std::uint64_t evictions,
+            std::uint64_t invalidations, std::size_t entries, const char *what) {
+  if (stats.hits != hits || stats.misses != misses || stats.evictions != evictions
+      || stats.invalidations != invalidations || stats.entries != entries) {
+    std::cerr << "bad stats " << what << ": " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.evictions << " evictions, " << stats.invalidations << " invalidations, "
+              << stats.entries << " entries\n";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int, char *[]) {
+  // room for two small sets but not three
+  QueryCache cache {500};
+
+  cache.insert("a", 1, range(0, 9));
+  cache.insert("b", 1, range(10, 19));
+  if (cache.find("a", 1) != range(0, 9) || cache.find("c", 1) || !expect(cache.stats(), 1, 1, 0, 0, 2, "after inserts"))
+    return -1;
+
+  // b is the least recently used
+  cache.insert("c", 1, range(20, 29));
+  if (cache.find("b", 1) || !cache.find("a", 1) || !cache.find("c", 1)
+      || !expect(cache.stats(), 3, 2, 1, 0, 2, "after eviction") || cache.stats().bytes > cache.max_bytes())
+    return -1;
+
+  // too large on its own
+  cache.insert("d", 1, range(0, 1 << 20));
+  roaring_bitmap sparse;
+  for (std::uint32_t i = 0; i < 1000; ++i)
+    sparse.add(i * 7919);
+
+  cache.insert("e", 1, sparse);
+  if (cache.find("d", 1) || cache.find("e", 1) || !cache.find("a", 1))
+    return -1;
+
+  // older results are not kept, and newer generations drop every entry
+  cache.insert("f", 0, range(0, 1));
+  if (cache.find("f", 1) || cache.find("a", 2) || !expect(cache.stats(), 4, 6, 1, 2, 0, "after a new generation"))
+    return -1;
+
+  cache.insert("a", 2, range(0, 3));
+  if (cache.find("a", 2) != range(0, 3) || cache.stats().bytes == 0)
+    return -1;
+
+  cache.clear();
+  if (cache.find("a", 2) || cache.stats().bytes != 0)
+    return -1;
+
+  // queries of a database, with the same predicates in any order
+  auto db = test::import("querycache");
+  if (!db || db->no_games() != 5) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+  db->enable_cache(1 << 20);
+
+  const auto query = Query {}.player("Carlsen, Magnus").event("Tata Steel");
+  const auto same = Query {}.event("tata steel").player("CARLSEN, Magnus").player("Carlsen Magnus");
+  if (query.key() != same.key() || query.key() == Query {}.player("Carlsen, Magnus").key()) {
+    std::cerr << "bad query keys: " << query.key() << " and " << same.key() << '\n';
+    return -1;
+  }
+
+  const std::vector<std::uint32_t> expected {0};
+  if (db->select(query)->to_vector() != expected || db->select(same)->to_vector() != expected
+      || !expect(db->cache_stats(), 1, 1, 0, 0, 1, "of the database"))
+    return -1;
+
+  // profiles measure the query, so they always run it
+  QueryProfile profile;
+  if (db->select(query, {}, &profile)->to_vector() != expected || profile.stages.empty()
+      || !expect(db->cache_stats(), 1, 1, 0, 0, 1, "after a profile"))
+    return -1;
+
+  // a new game changes the generation, and the query runs again
+  const auto generation = db->generation();
+  const auto record = write_record(0, {}, {});
+  if (!record || !db->append(*record) || db->generation() == generation) {
+    std::cerr << "failed to append a game\n";
+    return -1;
+  }
+
+  if (db->select(query)->to_vector() != expected || !expect(db->cache_stats(), 1, 2, 0, 1, 1, "after an append"))
+    return -1;
+
+  db->enable_cache(0);
+  if (db->select(query)->to_vector() != expected || db->cache_stats().misses != 0)
+    return -1;
+
+  db->close();
+  test::remove("querycache");
+  return 0;
+}
@@ -0,0 +1,111 @@
+#include "util/roaring.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace cdb;
+
+struct Set {
+  roaring_bitmap bitmap;
+  std::set<std::uint32_t> expected;
+};
+
+// mixes sparse values, dense ranges and long runs, so that every kind of
+// container is made
+Set make_set(std::mt19937 &rng) {
+  Set s;
+
+  for (int i = 0; i < 2000; ++i) {
+    const auto x = rng() % (1u << 20);
+    s.bitmap.add(x);
+    s.expected.insert(x);
+  }
+
+  for (std::uint32_t x = 3 << 16; x < (4 << 16); ++x) {
+    if (rng() % 3) {
+      s.bitmap.add(x);
+      s.expected.insert(x);
+    }
+  }
+
+  const auto first = rng() % (1u << 22), last = first + rng() % 200'000;
+  s.bitmap.add_range(first, last);
+  for (auto x = first; x <= last; ++x)
+    s.expected.insert(x);
+
+  s.bitmap.add(0xffffffff);
+  s.expected.insert(0xffffffff);
+  return s;
+}
+
+bool check(const roaring_bitmap &bitmap, const std::set<std::uint32_t> &expected, const char *what) {
+  const std::vector<std::uint32_t> values {expected.begin(), expected.end()};
+
+  if (bitmap.cardinality() != expected.size() || bitmap.to_vector() != values) {
+    std::cerr << "bad " << what << ": " << bitmap.cardinality() << " values, expected "
+              << expected.size() << '\n';
+    return false;
+  }
+
+  for (auto x : {0u, 1u, 65535u, 65536u, 3u << 16, 0xfffffffeu, 0xffffffffu}) {
+    if (bitmap.contains(x) != expected.contains(x)) {
+      std::cerr << "bad " << what << ": wrong membership of " << x << '\n';
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int, char *[]) {
+  std::mt19937 rng {34};
+
+  for (int round = 0; round < 4; ++round) {
+    const auto a = make_set(rng), b = make_set(rng);
+
+    if (!check(a.bitmap, a.expected, "insertion"))
+      return -1;
+
+    std::set<std::uint32_t> both, either, only_a;
+    std::ranges::set_intersection(a.expected, b.expected, std::inserter(both, both.end()));
+    std::ranges::set_union(a.expected, b.expected, std::inserter(either, either.end()));
+    std::ranges::set_difference(a.expected, b.expected, std::inserter(only_a, only_a.end()));
+
+    if (!check(a.bitmap & b.bitmap, both, "and")
+        || !check(a.bitmap | b.bitmap, either, "or")
+        || !check(and_not(a.bitmap, b.bitmap), only_a, "and not"))
+      return -1;
+
+    const std::vector<std::uint32_t> values {a.expected.begin(), a.expected.end()};
+    if (roaring_bitmap::from_sorted(values) != a.bitmap) {
+      std::cerr << "bad bitmap from sorted values\n";
+      return -1;
+    }
+
+    // added values leave arrays that are smaller as runs
+    auto optimized = a.bitmap;
+    optimized.optimize();
+    if (!check(optimized, a.expected, "optimized") || optimized.size_in_bytes() >= a.bitmap.size_in_bytes()) {
+      std::cerr << "bad optimized bitmap (" << optimized.size_in_bytes() << " bytes)\n";
+      return -1;
+    }
+  }
+
+  // bit i of word k is value 64 * k + i
+  std::vector<std::uint64_t> words(3000);
+  std::set<std::uint32_t> expected;
+  for (std::uint32_t i = 0; i < 64 * words.size(); ++i) {
+    if (i < 5000 || (i > 100'000 && rng() % 2)) {
+      words[i / 64] |= std::uint64_t(1) << (i % 64);
+      expected.insert(i);
+    }
+  }
+
+  if (!check(roaring_bitmap::from_words(words), expected, "bitmap from words"))
+    return -1;
+
+  return 0;
+}
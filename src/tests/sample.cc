@@ -0,0 +1,127 @@
+#include "db/db.hh"
+#include "db/sample.hh"
+#include "tests/fixture.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+// the first two games, one with Bg2 and one without, so that every page has
+// about the same share of games that match
+constexpr std::string_view Games = test::Pgn.substr(0, test::Pgn.find("[Event \"Norway Chess\"]"));
+
+// enough games to fill tens of pages
+constexpr unsigned NoCopies = 20000;
+
+int main(int, char *[]) {
+  // the same pages in the same order for a seed
+  auto order = PageSample::order(1000, 7);
+  if (order != PageSample::order(1000, 7) || order == PageSample::order(1000, 8)) {
+    std::cerr << "bad page orders\n";
+    return -1;
+  }
+
+  std::ranges::sort(order);
+  std::vector<std::uint32_t> pages(1000);
+  std::iota(pages.begin(), pages.end(), 0);
+  if (order != pages) {
+    std::cerr << "page order is not a permutation\n";
+    return -1;
+  }
+
+  // pages of 100 games where a varying share match. the intervals narrow as
+  // pages are added, and hold the true count about as often as they claim
+  std::mt19937_64 rng {1};
+  unsigned covered = 0, trials = 200;
+  for (unsigned trial = 0; trial < trials; ++trial) {
+    std::vector<std::uint64_t> hits(1000);
+    for (auto &h : hits)
+      h = std::binomial_distribution<unsigned> {100, 0.05 + 0.3 * (rng() % 3)} (rng);
+
+    const auto total = std::accumulate(hits.begin(), hits.end(), std::uint64_t(0));
+
+    PageSample sample {1000, 100'000};
+    std::uint64_t width = 100'000;
+    for (unsigned i = 0; i < 1000; ++i) {
+      sample.add(100, hits[i]);
+      const auto estimate = sample.estimate();
+      if (estimate.low > estimate.count || estimate.count > estimate.high) {
+        std::cerr << "estimate outside its interval\n";
+        return -1;
+      }
+
+      if (i == 49)
+        covered += estimate.low <= total && total <= estimate.high;
+
+      if (i % 100 == 99) {
+        if (estimate.high - estimate.low > width) {
+          std::cerr << "interval widened after " << i + 1 << " pages\n";
+          return -1;
+        }
+
+        width = estimate.high - estimate.low;
+      }
+
+      if (i == 999 && (!estimate.exact() || estimate.count != total || estimate.low != total || estimate.high != total)) {
+        std::cerr << "bad estimate after every page\n";
+        return -1;
+      }
+    }
+  }
+
+  if (covered < trials * 88 / 100) {
+    std::cerr << "intervals held the count " << covered << " of " << trials << " times\n";
+    return -1;
+  }
+
+  // estimates of a query over a database, ending with the exact count
+  auto db = test::import("sample", Games, NoCopies);
+  const auto pattern = Pattern::parse("Bg2");
+  if (!db || db->no_games() != 2 * NoCopies || !pattern) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+  const auto query = Query {}.matches(*pattern);
+  std::vector<CountEstimate> estimates;
+  for (auto it = db->estimate(query, {.step_pages = 4}); it; )
+    estimates.push_back(it());
+
+  const auto no_pages = db->filters().no_pages();
+  if (estimates.size() < 2 || !estimates.back().exact() || estimates.back().count != NoCopies
+      || estimates.front().pages != 4 || estimates.front().low > NoCopies || estimates.front().high < NoCopies
+      || !std::ranges::is_sorted(estimates, {}, &CountEstimate::pages) || estimates.back().pages != no_pages) {
+    std::cerr << "bad estimates (" << estimates.size() << " over " << no_pages << " pages)\n";
+    return -1;
+  }
+
+  // a query the indexes answer is exact at once
+  std::vector<CountEstimate> exact;
+  for (auto it = db->estimate(Query {}.player("Anand, Viswanathan", TagMatch::Exact)); it; )
+    exact.push_back(it());
+
+  if (exact.size() != 1 || !exact.front().exact() || exact.front().count != 2 * NoCopies) {
+    std::cerr << "bad estimate from the indexes\n";
+    return -1;
+  }
+
+  // no games left to check after the indexes
+  std::vector<CountEstimate> none;
+  for (auto it = db->estimate(Query {}.player("Kasparov, Garry", TagMatch::Exact).matches(*pattern)); it; )
+    none.push_back(it());
+
+  if (none.size() != 1 || none.front().count != 0 || !none.front().exact()) {
+    std::cerr << "bad estimate of no games\n";
+    return -1;
+  }
+
+  db->close();
+  test::remove("sample");
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include "db/codec.hh"
+#include "db/db.hh"
+#include "db/scan.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+// enough games to fill a few dozen pages
+constexpr std::uint32_t NoGames = 20000;
+
+int main(int, char *[]) {
+  // every morsel is run exactly once, however many workers share them and
+  // however uneven they are
+  for (const unsigned threads : {1u, 3u, 8u}) {
+    for (const std::uint32_t no_pages : {0u, 1u, 7u, 100u, 1001u}) {
+      MorselScan scan {no_pages, {threads, 4}};
+      std::vector<std::atomic<unsigned>> runs(scan.no_morsels());
+
+      scan.run([&] (unsigned worker, std::uint32_t morsel) {
+        if (worker >= scan.workers() || morsel >= scan.no_morsels()) {
+          std::cerr << "bad worker " << worker << " or morsel " << morsel << '\n';
+          std::exit(-1);
+        }
+
+        // the first worker's morsels are slow, so the others steal them
+        if (worker == 0 && threads > 1)
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+        ++runs[morsel];
+      });
+
+      if (!std::ranges::all_of(runs, [] (const auto &n) { return n == 1; })) {
+        std::cerr << "morsels not run once each (" << no_pages << " pages, " << threads << " threads)\n";
+        return -1;
+      }
+
+      // morsels cover every page once
+      std::uint32_t next = 0;
+      for (std::uint32_t morsel = 0; morsel < scan.no_morsels(); ++morsel) {
+        const auto [first, last] = scan.pages(morsel);
+        if (first != next || last <= first) {
+          std::cerr << "morsel " << morsel << " does not follow the previous one\n";
+          return -1;
+        }
+
+        next = last;
+      }
+
+      if (next != no_pages) {
+        std::cerr << "morsels do not cover " << no_pages << " pages\n";
+        return -1;
+      }
+    }
+  }
+
+  // results in page order, or in any order but all of them
+  std::vector<std::uint32_t> expected(1000);
+  std::iota(expected.begin(), expected.end(), 0);
+
+  for (const bool ordered : {true, false}) {
+    auto pages = *collect_pages<std::uint32_t>(1000, {4, 3, ordered}, [] (std::uint32_t page_no, auto &out) {
+      out.push_back(page_no);
+    });
+
+    if (!ordered)
+      std::ranges::sort(pages);
+
+    if (pages != expected) {
+      std::cerr << "bad " << (ordered ? "ordered" : "unordered") << " results\n";
+      return -1;
+    }
+  }
+
+  // a database's games, visited and filtered in parallel
+  const auto path = std::filesystem::temp_directory_path() / "cdb_scan_test.cdb";
+  auto db = Db::create(path, 4 << 20);
+  if (!db) {
+    std::cerr << "failed to create database\n";
+    return -1;
+  }
+
+  for (std::uint32_t i = 0; i < NoGames; ++i) {
+    // records of a few sizes, told apart by their length
+    const std::vector<std::byte> moves(2 * (i % 3));
+    const auto record = write_record(0, {}, moves);
+    if (!record || !db->append(*record)) {
+      std::cerr << "failed to append game " << i << '\n';
+      return -1;
+    }
+  }
+
+  std::atomic<std::uint64_t> visited = 0, ids = 0;
+  db->for_each([&] (std::uint32_t id, std::span<const std::byte>) {
+    ++visited;
+    ids += id;
+  }, {4});
+
+  if (visited != NoGames || ids != std::uint64_t(NoGames) * (NoGames - 1) / 2) {
+    std::cerr << "visited " << visited << " of " << NoGames << " games\n";
+    return -1;
+  }
+
+  const auto longest = *db->filter([] (std::uint32_t, std::span<const std::byte> record) {
+    return record_move_data(record).size() == 4;
+  }, {4, 2});
+
+  if (longest.size() != NoGames / 3 || !std::ranges::is_sorted(longest)
+      || !std::ranges::all_of(longest, [] (std::uint32_t id) { return id % 3 == 2; })) {
+    std::cerr << "bad filtered games (" << longest.size() << ")\n";
+    return -1;
+  }
+
+  db->close();
+  std::filesystem::remove(path);
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "db/sortedindex.hh"
+#include "util/top_n.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <ranges>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+constexpr std::uint32_t NoGames = 5000;
+
+int main(int, char *[]) {
+  // games with a few unknown values and many ties
+  std::mt19937 rng {42};
+  std::vector<GameMetadata> games(NoGames);
+  for (auto &game : games) {
+    game.date      = rng() % 10 ? MetadataFilter::year(1990 + rng() % 30) | rng() % 512 : 0;
+    game.white_elo = rng() % 8 ? 2000 + rng() % 800 : 0;
+    game.black_elo = rng() % 8 ? 2000 + rng() % 800 : 0;
+  }
+
+  SortedIndexBuilder builder;
+  for (const auto &game : games)
+    builder.push(game);
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_sortedindex_test.sorted";
+  if (auto ec = builder.write(path)) {
+    std::cerr << "failed to write index: " << ec.message() << '\n';
+    return -1;
+  }
+
+  auto index = SortedIndex::open(path);
+  if (!index || index->size() != NoGames) {
+    std::cerr << "failed to open index\n";
+    return -1;
+  }
+
+  // every game with a known value, in order, in either direction
+  for (const auto key : {SortKey::Date, SortKey::WhiteElo, SortKey::BlackElo, SortKey::Elo}) {
+    std::vector<SortedIndex::Entry> expected;
+    for (std::uint32_t id = 0; id < NoGames; ++id)
+      if (const auto value = SortedIndex::value(key, games[id]))
+        expected.push_back({value, id});
+
+    std::ranges::sort(expected);
+
+    const auto scan = index->scan(key);
+    if (!std::ranges::equal(scan, expected)) {
+      std::cerr << "bad order for key " << int(key) << '\n';
+      return -1;
+    }
+
+    const auto reversed = index->scan(key, {}, true);
+    if (!std::ranges::equal(reversed, expected | std::views::reverse)) {
+      std::cerr << "bad descending order for key " << int(key) << '\n';
+      return -1;
+    }
+  }
+
+  // games between 2400 and 2500 on average, both bounds included
+  const auto range = index->scan(SortKey::Elo, {2400, 2500});
+  const auto in_range = std::ranges::count_if(games, [] (const GameMetadata &game) {
+    const auto elo = SortedIndex::value(SortKey::Elo, game);
+    return elo >= 2400 && elo <= 2500;
+  });
+
+  if (range.size() != std::size_t(in_range) || range[0].value < 2400 || range[range.size() - 1].value > 2500) {
+    std::cerr << "bad range scan (" << range.size() << " of " << in_range << " games)\n";
+    return -1;
+  }
+
+  if (!index->scan(SortKey::Elo, {2500, 2400}).empty() || !index->scan(SortKey::Elo, {9000}).empty()) {
+    std::cerr << "empty ranges are not empty\n";
+    return -1;
+  }
+
+  // the 50 most recent games with an even id, from the index in order,
+  // stopping as soon as the heap is full
+  top_n<SortedIndex::Entry, std::greater<>> recent(50);
+  std::size_t read = 0;
+  for (const auto &entry : index->scan(SortKey::Date, {1}, true)) {
+    if (recent.full())
+      break;
+
+    ++read;
+    if (entry.game % 2 == 0)
+      recent.push(entry);
+  }
+
+  // the same from every game, unsorted
+  top_n<SortedIndex::Entry, std::greater<>> all(50);
+  for (std::uint32_t id = 0; id < NoGames; id += 2)
+    if (games[id].date)
+      all.push({games[id].date, id});
+
+  const auto expected = all.take();
+  if (recent.take() != expected || expected.size() != 50 || read >= NoGames / 2) {
+    std::cerr << "bad top games (read " << read << " entries)\n";
+    return -1;
+  }
+
+  // best first, ties by the higher id
+  if (!std::ranges::is_sorted(expected, std::greater<>())) {
+    std::cerr << "top games are not sorted\n";
+    return -1;
+  }
+
+  top_n<int> none(0);
+  if (none.push(1) || none.size() != 0) {
+    std::cerr << "an empty heap kept a value\n";
+    return -1;
+  }
+
+  *index = SortedIndex {};
+  std::filesystem::remove(path);
+  return 0;
+}
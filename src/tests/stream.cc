@@ -0,0 +1,108 @@
+#include "async/generator.hh"
+#include "db/db.hh"
+#include "db/scan.hh"
+#include "tests/fixture.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <numeric>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+std::vector<std::uint32_t> read_all(async::generator<std::uint32_t> games) {
+  std::vector<std::uint32_t> ids;
+  while (games)
+    ids.push_back(games());
+
+  return ids;
+}
+
+int main(int, char *[]) {
+  // results come in page order, whichever worker scanned them
+  for (const unsigned threads : {1u, 4u}) {
+    MorselStream<std::uint32_t> stream {1000, {threads, 3, true, 4}, [] (std::uint32_t page_no, auto &out) {
+      out.push_back(page_no);
+    }};
+
+    std::vector<std::uint32_t> pages;
+    while (const auto results = stream.next())
+      pages.insert(pages.end(), results->begin(), results->end());
+
+    std::vector<std::uint32_t> expected(1000);
+    std::iota(expected.begin(), expected.end(), 0);
+    if (pages != expected) {
+      std::cerr << "bad streamed pages (" << pages.size() << ") on " << threads << " threads\n";
+      return -1;
+    }
+  }
+
+  // a reader that stops after one morsel leaves no more than the window
+  // scanned ahead of it
+  std::atomic<unsigned> visited = 0;
+  {
+    MorselStream<std::uint32_t> stream {1000, {4, 1, true, 8}, [&] (std::uint32_t page_no, auto &out) {
+      ++visited;
+      out.push_back(page_no);
+    }};
+
+    if (stream.next() != std::vector<std::uint32_t> {0}) {
+      std::cerr << "bad first morsel\n";
+      return -1;
+    }
+  }
+
+  if (visited > 1 + 8) {
+    std::cerr << "scanned " << visited << " pages past an abandoned stream\n";
+    return -1;
+  }
+
+  // queries of a database, streamed as the records are checked
+  auto db = test::import("stream", test::Pgn, test::PageCopies);
+  const auto pattern = Pattern::parse("Bg2");
+  if (!db || db->no_games() != 5 * test::PageCopies || !pattern) {
+    std::cerr << "failed to import games\n";
+    return -1;
+  }
+
+  for (const auto &query : {Query {}.matches(*pattern), Query {}.player("Anand, Viswanathan", TagMatch::Exact),
+                            Query {}.matches(*pattern).event("Tata Steel"), Query {}}) {
+    const auto streamed = read_all(db->stream(query, {2, 1}));
+    if (streamed != db->select(query)->to_vector()) {
+      std::cerr << "bad streamed games (" << streamed.size() << ")\n" << db->plan(query).to_string();
+      return -1;
+    }
+  }
+
+  // results are sorted by game however the pages are collected
+  const ScanOptions unordered {4, 1, false};
+  const auto games = db->select(Query {}.matches(*pattern), unordered);
+  const auto positions = db->find(*pattern, unordered);
+  const auto line = db->find_line(*LineTrie::parse("1. d4 Nf6 2. c4 e6 3. g3 d5 4. Bg2"), unordered);
+  if (!games || games->to_vector() != read_all(db->stream(Query {}.matches(*pattern)))
+      || !positions || !std::ranges::is_sorted(*positions, {}, &PositionEntry::game)
+      || !line || *line != games->to_vector()) {
+    std::cerr << "bad unordered results\n";
+    return -1;
+  }
+
+  // the first games of a stream, which is then dropped with the scan unfinished
+  {
+    auto games = db->stream(Query {}.matches(*pattern));
+    std::vector<std::uint32_t> first;
+    for (unsigned i = 0; i < 3 && games; ++i)
+      first.push_back(games());
+
+    if (first != std::vector<std::uint32_t> {0, 2, 5}) {
+      std::cerr << "bad first streamed games\n";
+      return -1;
+    }
+  }
+
+  db->close();
+  test::remove("stream");
+  return 0;
+}
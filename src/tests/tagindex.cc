@@ -0,0 +1,102 @@
+#include "db/tagindex.hh"
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace cdb;
+using namespace cdb::db;
+
+struct Game {
+  std::string_view white, black, event, site;
+};
+
+constexpr std::array<Game, 5> Games {{
+  {"Carlsen, Magnus", "Anand, Viswanathan", "Tata Steel", "Wijk aan Zee NED"},
+  {"Anand, Viswanathan", "Carlsen, Magnus", "World Championship", "Chennai IND"},
+  {"Caruana, Fabiano", "Carlsen,Magnus", "Tata Steel", "Wijk aan Zee NED"},
+  {"Nakamura, Hikaru", "Caruana, Fabiano", "Sinquefield Cup", "Saint Louis USA"},
+  {"Karlsson, Carl", "Anand, Viswanathan", "Carlsbad", "Karlovy Vary"},
+}};
+
+int main(int, char *[]) {
+  if (TagIndex::normalise(" Carlsen,  Magnus ") != "carlsen magnus"
+      || TagIndex::normalise("Wijk aan Zee (NED)") != "wijk aan zee ned") {
+    std::cerr << "bad normalisation\n";
+    return -1;
+  }
+
+  // one builder per half of the games, as threads would, merged before writing
+  std::array<TagIndexBuilder, 2> builders;
+
+  for (std::uint32_t game = 0; game < Games.size(); ++game) {
+    const auto &[white, black, event, site] = Games[game];
+    auto &builder = builders[game % 2];
+
+    builder.add(game, TagId::White, white);
+    builder.add(game, TagId::Black, black);
+    builder.add(game, TagId::Event, event);
+    builder.add(game, TagId::Site, site);
+    builder.add(game, TagId::Round, "1");
+  }
+
+  builders[0].merge(std::move(builders[1]));
+
+  const auto path = std::filesystem::temp_directory_path() / "cdb_tagindex_test.tags";
+  if (auto ec = builders[0].write(path, Games.size())) {
+    std::cerr << "failed to write index: " << ec.message() << '\n';
+    return -1;
+  }
+
+  auto index = TagIndex::open(path);
+  if (!index) {
+    std::cerr << "failed to open index\n";
+    return -1;
+  }
+
+  if (index->no_games() != Games.size()) {
+    std::cerr << "index covers " << index->no_games() << " games\n";
+    return -1;
+  }
+
+  using Expected = std::vector<std::uint32_t>;
+
+  struct Query {
+    std::string_view name;
+    roaring_bitmap games;
+    Expected expected;
+  };
+
+  const std::array<Query, 12> queries {{
+    {"exact", index->exact("carlsen, magnus"), {0, 1, 2}},
+    {"exact white", index->exact("Carlsen, Magnus", TagField::White), {0}},
+    {"exact part", index->exact("Carlsen"), {}},
+    {"prefix", index->prefix("Carls"), {0, 1, 2, 4}},
+    {"prefix players", index->prefix("Carls", TagField::Players), {0, 1, 2}},
+    {"prefix event", index->prefix("Carls", TagField::Event), {4}},
+    {"prefix words", index->prefix("wijk aan"), {0, 2}},
+    {"prefix inside", index->prefix("arlsen"), {}},
+    {"contains", index->contains("arlsen"), {0, 1, 2}},
+    {"contains short", index->contains("ij"), {0, 2}},
+    {"contains site", index->contains("Zee", TagField::Site), {0, 2}},
+    {"similar", index->similar("Carlson, Magnus"), {0, 1, 2}},
+  }};
+
+  for (const auto &[name, games, expected] : queries) {
+    if (games.to_vector() != expected) {
+      std::cerr << "bad games for " << name << " (" << games.cardinality() << " games)\n";
+      return -1;
+    }
+  }
+
+  if (index->size() != 13) {
+    std::cerr << "expected 13 distinct names, got " << index->size() << '\n';
+    return -1;
+  }
+
+  *index = TagIndex {};
+  std::filesystem::remove(path);
+  return 0;
+}
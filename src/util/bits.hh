@@ -4,6 +4,7 @@
 #include <concepts>
 #include <cstdint>
 #include <span>
+#include <tuple>
 #include <utility>
 
 #ifdef _MSC_VER
@@ -76,7 +77,7 @@ constexpr auto pdep(std::uint64_t x, std::uint64_t mask) -> std::uint64_t {
 }
 
 template <unsigned B>
-using uint_t = std::tuple_element_t<(B > 1 + B > 2 + B > 4),
+using uint_t = std::tuple_element_t<(B > 1) + (B > 2) + (B > 4),
                                     std::tuple<std::uint8_t, std::uint16_t,
                                                std::uint32_t, std::uint64_t>>;
 
@@ -86,18 +87,18 @@ constexpr auto read_le(std::span<const std::byte, S> data, std::size_t offset =
   static_assert(B <= sizeof(T));
 
   return [&]<auto... I>(std::index_sequence<I...>) {
-    return ((static_cast<T>(data[offset + I]) << (8 * (B - I - 1))) | ...);
+    return ((static_cast<T>(data[offset + I]) << (8 * I)) | ...);
   } (std::make_index_sequence<B>());
 }
 
 template <unsigned B, std::size_t S>
 constexpr auto read_le(std::span<const std::byte, S> data, std::size_t offset = 0) -> uint_t<B> {
-  return read_le<uint_t<B>>(data, offset);
+  return read_le<uint_t<B>, S, B>(data, offset);
 }
 
 template <unsigned B, std::size_t S>
 constexpr auto read_le(std::span<std::byte, S> data, std::size_t offset = 0) -> uint_t<B> {
-  return read_le<uint_t<B>>(std::span<const std::byte, S> {data}, offset);
+  return read_le<B>(std::span<const std::byte, S> {data}, offset);
 }
 
 template <std::size_t S>
@@ -121,8 +122,8 @@ constexpr auto read_be(std::span<const std::byte, S> data, std::size_t offset =
   static_assert(B <= sizeof(T));
 
   return [&]<auto... I>(std::index_sequence<I...>) {
-    return ((static_cast<T>(data[offset + I]) << (8 * I)) | ...);
-  } (std::make_index_sequence<sizeof(T)>());
+    return ((static_cast<T>(data[offset + I]) << (8 * (B - I - 1))) | ...);
+  } (std::make_index_sequence<B>());
 }
 
 template <std::size_t S>
@@ -136,4 +137,36 @@ constexpr void write_be(std::span<std::byte, S> data, std::unsigned_integral aut
   } (std::make_index_sequence<sizeof uint>());
 }
 
+// number of bytes needed to store value as an LEB128 varint
+constexpr std::size_t varint_size(std::uint64_t value) {
+  return 1 + (std::bit_width(value | 1) - 1) / 7;
+}
+
+// reads an LEB128 varint, returns the number of bytes read or zero if the
+// data is truncated or the varint is too long
+constexpr std::size_t read_varint(std::span<const std::byte> data, std::uint64_t &value,
+                                  std::size_t offset = 0) {
+  value = 0;
+  for (std::size_t i = 0; i < 10 && offset + i < data.size(); ++i) {
+    const auto b = std::to_integer<std::uint64_t>(data[offset + i]);
+    value |= (b & 0x7f) << (7 * i);
+
+    if (!(b & 0x80))
+      return i + 1;
+  }
+
+  return 0;
+}
+
+// writes an LEB128 varint, data must have at least varint_size(value) bytes
+constexpr std::size_t write_varint(std::span<std::byte> data, std::uint64_t value,
+                                   std::size_t offset = 0) {
+  std::size_t i = 0;
+  for (; value >= 0x80; value >>= 7)
+    data[offset + i++] = static_cast<std::byte>((value & 0x7f) | 0x80);
+
+  data[offset + i++] = static_cast<std::byte>(value);
+  return i;
+}
+
 } // cdb
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <concepts>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace cdb {
+
+/**
+ * Compressed set of 32 bit integers, after Roaring bitmaps
+ * (https://roaringbitmap.org). Values are split by their upper 16 bits into
+ * containers, each stored as whichever of these is smallest:
+ *
+ *  array   sorted 16 bit values, for up to 4096 values
+ *  bitmap  1024 64 bit words
+ *  run     sorted pairs of first and last value in a run
+ *
+ * Set operations work on two containers at a time, using merges for arrays
+ * and word-wise operations (which compilers vectorise) and popcounts for
+ * everything else.
+ */
+class roaring_bitmap {
+public:
+  static constexpr std::size_t ArrayMax = 4096;
+  static constexpr std::size_t BitmapWords = 1024;
+
+private:
+  using words = std::array<std::uint64_t, BitmapWords>;
+
+  struct container {
+    enum kind_type : std::uint8_t { Array, Bitmap, Run };
+
+    kind_type kind = Array;
+    std::uint32_t cardinality = 0;
+
+    std::vector<std::uint16_t> values;  // array values, or run first/last pairs
+    std::vector<std::uint64_t> bitmap;
+
+    bool contains(std::uint16_t x) const {
+      switch (kind) {
+      case Array:
+        return std::ranges::binary_search(values, x);
+      case Bitmap:
+        return (bitmap[x / 64] >> (x % 64)) & 1;
+      case Run: {
+        // find the last run starting at or before x
+        std::size_t lo = 0, hi = values.size() / 2;
+        while (lo < hi) {
+          const auto mid = (lo + hi) / 2;
+          (values[2 * mid] <= x ? lo : hi) = mid + (values[2 * mid] <= x);
+        }
+
+        return lo && x <= values[2 * lo - 1];
+      }
+      }
+
+      return false;
+    }
+
+    void to_words(words &w) const {
+      switch (kind) {
+      case Array:
+        w.fill(0);
+        for (auto x : values)
+          w[x / 64] |= std::uint64_t(1) << (x % 64);
+        break;
+      case Bitmap:
+        std::ranges::copy(bitmap, w.begin());
+        break;
+      case Run:
+        w.fill(0);
+        for (std::size_t i = 0; i < values.size(); i += 2)
+          set_range(w, values[i], values[i + 1]);
+        break;
+      }
+    }
+
+    // sets bits first to last inclusive
+    static void set_range(words &w, unsigned first, unsigned last) {
+      const auto fw = first / 64, lw = last / 64;
+      const auto fmask = ~std::uint64_t(0) << (first % 64);
+      const auto lmask = ~std::uint64_t(0) >> (63 - last % 64);
+
+      if (fw == lw) {
+        w[fw] |= fmask & lmask;
+      } else {
+        w[fw] |= fmask;
+        std::fill(w.begin() + fw + 1, w.begin() + lw, ~std::uint64_t(0));
+        w[lw] |= lmask;
+      }
+    }
+
+    // picks the smallest representation of a set of bits
+    static container from_words(const words &w) {
+      std::uint32_t cardinality = 0, runs = 0;
+      for (std::size_t i = 0; i < BitmapWords; ++i) {
+        // a run starts wherever a set bit follows a clear bit
+        const auto prev = i ? w[i - 1] >> 63 : 0;
+        cardinality += std::popcount(w[i]);
+        runs += std::popcount(w[i] & ~((w[i] << 1) | prev));
+      }
+
+      container c;
+      c.cardinality = cardinality;
+
+      const auto run_size = 4 * std::size_t(runs), array_size = 2 * std::size_t(cardinality);
+      if (run_size < std::min(array_size, 8 * BitmapWords)) {
+        c.kind = Run;
+        c.values.reserve(2 * runs);
+
+        for (std::size_t i = 0; i < BitmapWords; ++i) {
+          for (auto word = w[i]; word; ) {
+            const auto first = std::countr_zero(word);
+            const auto length = std::countr_one(word >> first);
+
+            if (first == 0 && !c.values.empty() && c.values.back() + 1u == 64 * i)
+              c.values.back() = 64 * i + length - 1;
+            else
+              c.values.insert(c.values.end(), {std::uint16_t(64 * i + first),
+                                               std::uint16_t(64 * i + first + length - 1)});
+
+            word = first + length < 64 ? word & (~std::uint64_t(0) << (first + length)) : 0;
+          }
+        }
+      } else if (cardinality <= ArrayMax) {
+        c.kind = Array;
+        c.values.reserve(cardinality);
+
+        for (std::size_t i = 0; i < BitmapWords; ++i)
+          for (auto word = w[i]; word; word &= word - 1)
+            c.values.push_back(64 * i + std::countr_zero(word));
+      } else {
+        c.kind = Bitmap;
+        c.bitmap.assign(w.begin(), w.end());
+      }
+
+      return c;
+    }
+
+    static container from_array(std::vector<std::uint16_t> &&values) {
+      container c;
+      c.cardinality = values.size();
+      c.values = std::move(values);
+      return c;
+    }
+
+    template <class Op>
+    static container combine(const container &a, const container &b, Op op) {
+      words x, y;
+      a.to_words(x);
+      b.to_words(y);
+
+      for (std::size_t i = 0; i < BitmapWords; ++i)
+        x[i] = op(x[i], y[i]);
+
+      return from_words(x);
+    }
+
+    template <bool Keep>
+    static container filter(const container &a, const container &b) {
+      std::vector<std::uint16_t> values;
+      for (auto x : a.values)
+        if (b.contains(x) == Keep)
+          values.push_back(x);
+
+      return from_array(std::move(values));
+    }
+
+    static container intersect(const container &a, const container &b) {
+      if (a.kind == Array && b.kind == Array) {
+        std::vector<std::uint16_t> values;
+        std::ranges::set_intersection(a.values, b.values, std::back_inserter(values));
+        return from_array(std::move(values));
+      }
+
+      if (a.kind == Array) return filter<true>(a, b);
+      if (b.kind == Array) return filter<true>(b, a);
+
+      return combine(a, b, [] (auto x, auto y) { return x & y; });
+    }
+
+    static container unite(const container &a, const container &b) {
+      if (a.kind == Array && b.kind == Array && a.cardinality + b.cardinality <= ArrayMax) {
+        std::vector<std::uint16_t> values;
+        std::ranges::set_union(a.values, b.values, std::back_inserter(values));
+        return from_array(std::move(values));
+      }
+
+      return combine(a, b, [] (auto x, auto y) { return x | y; });
+    }
+
+    static container subtract(const container &a, const container &b) {
+      if (a.kind == Array)
+        return filter<false>(a, b);
+
+      return combine(a, b, [] (auto x, auto y) { return x & ~y; });
+    }
+  };
+
+  std::vector<std::uint16_t> _keys;
+  std::vector<container> _containers;
+
+  // applies op to every pair of containers with the same key. containers
+  // only in a are kept if keep_a, and likewise for b.
+  template <class Op>
+  static roaring_bitmap merge(const roaring_bitmap &a, const roaring_bitmap &b,
+                              bool keep_a, bool keep_b, Op op) {
+    roaring_bitmap r;
+    std::size_t i = 0, j = 0;
+
+    const auto push = [&] (std::uint16_t key, container &&c) {
+      if (c.cardinality) {
+        r._keys.push_back(key);
+        r._containers.push_back(std::move(c));
+      }
+    };
+
+    while (i < a._keys.size() || j < b._keys.size()) {
+      if (j == b._keys.size() || (i < a._keys.size() && a._keys[i] < b._keys[j])) {
+        if (keep_a) push(a._keys[i], container {a._containers[i]});
+        ++i;
+      } else if (i == a._keys.size() || b._keys[j] < a._keys[i]) {
+        if (keep_b) push(b._keys[j], container {b._containers[j]});
+        ++j;
+      } else {
+        push(a._keys[i], op(a._containers[i], b._containers[j]));
+        ++i, ++j;
+      }
+    }
+
+    return r;
+  }
+
+public:
+  roaring_bitmap() = default;
+
+  // values must be sorted, and may contain duplicates
+  static roaring_bitmap from_sorted(std::span<const std::uint32_t> values) {
+    roaring_bitmap r;
+
+    for (std::size_t i = 0; i < values.size(); ) {
+      const std::uint16_t key = values[i] >> 16;
+
+      std::vector<std::uint16_t> low;
+      for (; i < values.size() && values[i] >> 16 == key; ++i)
+        if (low.empty() || low.back() != std::uint16_t(values[i]))
+          low.push_back(values[i]);
+
+      words w {};
+      for (auto x : low)
+        w[x / 64] |= std::uint64_t(1) << (x % 64);
+
+      r._keys.push_back(key);
+      r._containers.push_back(low.size() <= ArrayMax / 4 ? container::from_array(std::move(low))
+                                                          : container::from_words(w));
+    }
+
+    return r;
+  }
+
+  // bit i of word k is value 64 * k + i
+  static roaring_bitmap from_words(std::span<const std::uint64_t> bits) {
+    roaring_bitmap r;
+
+    for (std::size_t first = 0; first < bits.size(); first += BitmapWords) {
+      words w {};
+      std::ranges::copy(bits.subspan(first, std::min(BitmapWords, bits.size() - first)), w.begin());
+
+      auto c = container::from_words(w);
+      if (c.cardinality) {
+        r._keys.push_back(first / BitmapWords);
+        r._containers.push_back(std::move(c));
+      }
+    }
+
+    return r;
+  }
+
+  // adds values first to last inclusive
+  void add_range(std::uint32_t first, std::uint32_t last) {
+    assert(first <= last);
+
+    for (std::uint32_t key = first >> 16; key <= last >> 16; ++key) {
+      words w {};
+      container::set_range(w, key == first >> 16 ? first & 0xffff : 0,
+                              key == last >> 16 ? last & 0xffff : 0xffff);
+
+      auto c = container::from_words(w);
+      const auto it = std::ranges::lower_bound(_keys, key);
+      const auto i = it - _keys.begin();
+
+      if (it != _keys.end() && *it == key) {
+        _containers[i] = container::unite(_containers[i], c);
+      } else {
+        _keys.insert(it, key);
+        _containers.insert(_containers.begin() + i, std::move(c));
+      }
+    }
+  }
+
+  void add(std::uint32_t x) {
+    const std::uint16_t key = x >> 16, low = x & 0xffff;
+    const auto it = std::ranges::lower_bound(_keys, key);
+
+    if (it == _keys.end() || *it != key) {
+      _containers.insert(_containers.begin() + (it - _keys.begin()), container::from_array({low}));
+      _keys.insert(it, key);
+      return;
+    }
+
+    auto &c = _containers[it - _keys.begin()];
+    if (c.contains(low))
+      return;
+
+    if (c.kind == container::Array && c.cardinality < ArrayMax) {
+      c.values.insert(std::ranges::upper_bound(c.values, low), low);
+      ++c.cardinality;
+    } else if (c.kind == container::Bitmap) {
+      c.bitmap[low / 64] |= std::uint64_t(1) << (low % 64);
+      ++c.cardinality;
+    } else {
+      add_range(x, x);
+    }
+  }
+
+  bool contains(std::uint32_t x) const {
+    const auto it = std::ranges::lower_bound(_keys, x >> 16);
+    return it != _keys.end() && *it == x >> 16
+        && _containers[it - _keys.begin()].contains(x & 0xffff);
+  }
+
+  std::uint64_t cardinality() const {
+    std::uint64_t n = 0;
+    for (const auto &c : _containers)
+      n += c.cardinality;
+
+    return n;
+  }
+
+  bool empty() const { return _keys.empty(); }
+
+  // calls fn with each value, in order
+  void for_each(std::invocable<std::uint32_t> auto fn) const {
+    for (std::size_t i = 0; i < _keys.size(); ++i) {
+      const std::uint32_t high = std::uint32_t(_keys[i]) << 16;
+      const auto &c = _containers[i];
+
+      switch (c.kind) {
+      case container::Array:
+        for (auto x : c.values)
+          fn(high | x);
+        break;
+      case container::Bitmap:
+        for (std::size_t k = 0; k < BitmapWords; ++k)
+          for (auto word = c.bitmap[k]; word; word &= word - 1)
+            fn(high | (64 * k + std::countr_zero(word)));
+        break;
+      case container::Run:
+        for (std::size_t k = 0; k < c.values.size(); k += 2)
+          for (std::uint32_t x = c.values[k]; x <= c.values[k + 1]; ++x)
+            fn(high | x);
+        break;
+      }
+    }
+  }
+
+  std::vector<std::uint32_t> to_vector() const {
+    std::vector<std::uint32_t> values;
+    values.reserve(cardinality());
+    for_each([&] (std::uint32_t x) { values.push_back(x); });
+    return values;
+  }
+
+  friend roaring_bitmap operator&(const roaring_bitmap &a, const roaring_bitmap &b) {
+    return merge(a, b, false, false, container::intersect);
+  }
+
+  friend roaring_bitmap operator|(const roaring_bitmap &a, const roaring_bitmap &b) {
+    return merge(a, b, true, true, container::unite);
+  }
+
+  // values in a but not in b
+  friend roaring_bitmap and_not(const roaring_bitmap &a, const roaring_bitmap &b) {
+    return merge(a, b, true, false, container::subtract);
+  }
+
+  roaring_bitmap &operator&=(const roaring_bitmap &b) { return *this = *this & b; }
+  roaring_bitmap &operator|=(const roaring_bitmap &b) { return *this = *this | b; }
+
+  // converts every container to its smallest kind and frees spare capacity,
+  // for sets that are kept around
+  void optimize() {
+    for (auto &c : _containers) {
+      words w;
+      c.to_words(w);
+      c = container::from_words(w);
+      c.values.shrink_to_fit();
+    }
+
+    _keys.shrink_to_fit();
+    _containers.shrink_to_fit();
+  }
+
+  // bytes held by the set, including spare capacity
+  std::size_t size_in_bytes() const {
+    std::size_t bytes = sizeof(*this) + _keys.capacity() * sizeof(std::uint16_t)
+                        + _containers.capacity() * sizeof(container);
+    for (const auto &c : _containers)
+      bytes += c.values.capacity() * sizeof(std::uint16_t) + c.bitmap.capacity() * sizeof(std::uint64_t);
+
+    return bytes;
+  }
+
+  friend bool operator==(const roaring_bitmap &a, const roaring_bitmap &b) {
+    return a.cardinality() == b.cardinality() && and_not(a, b).empty();
+  }
+};
+
+} // cdb
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace cdb {
+
+/**
+ * Keeps the first n values pushed in the order of Compare, e.g. the n
+ * largest with std::greater, in a heap of at most n values whose top is the
+ * worst value kept. Values from a source already sorted by Compare can stop
+ * as soon as the heap is full, since no later value can take a place.
+ */
+template <class T, class Compare = std::less<T>>
+class top_n {
+private:
+  std::size_t _n;
+  Compare _cmp;
+  std::vector<T> _heap;
+
+public:
+  explicit top_n(std::size_t n, Compare cmp = {}) : _n(n), _cmp(std::move(cmp)) {
+    _heap.reserve(n);
+  }
+
+  std::size_t capacity() const { return _n; }
+  std::size_t size() const { return _heap.size(); }
+  bool full() const { return _heap.size() == _n; }
+
+  // the worst value kept, which a value must beat once the heap is full
+  const T &worst() const { return _heap.front(); }
+
+  // whether a value would be kept if pushed now
+  bool accepts(const T &value) const {
+    return !full() || (_n > 0 && _cmp(value, worst()));
+  }
+
+  // returns false if the value was dropped
+  bool push(T value) {
+    if (!accepts(value))
+      return false;
+
+    if (full()) {
+      std::ranges::pop_heap(_heap, _cmp);
+      _heap.back() = std::move(value);
+    } else
+      _heap.push_back(std::move(value));
+
+    std::ranges::push_heap(_heap, _cmp);
+    return true;
+  }
+
+  // the values kept, best first, leaving the heap empty
+  std::vector<T> take() {
+    std::ranges::sort_heap(_heap, _cmp);
+    return std::exchange(_heap, {});
+  }
+};
+
+} // cdb